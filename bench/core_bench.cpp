@@ -0,0 +1,440 @@
+#include "chip8.h"
+#include "lockstep.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Micro- and macro-benchmarks of the emulator core
+//
+// Micro-benchmarks time instruction dispatch per engine, every opcode in a
+// tight loop of copies of itself, DRW across sprite sizes and clipping cases,
+// the framebuffer clear and a machine reset. Macro-benchmarks run synthetic ALU, draw and
+// call heavy programs for a fixed number of cycles on every engine, and on
+// the lockstep engine at several lane counts. Each
+// benchmark is sampled several times and reported as mean, standard
+// deviation, min and max in JSON, so runs can be diffed over time.
+
+namespace {
+using Program = std::vector<uint16_t>;
+
+constexpr uint16_t START = PChip8::START_EXEC_LOCATION;
+// free memory well past every program, used as I for loads and stores
+constexpr uint16_t SCRATCH = 0xE00;
+
+constexpr PChip8::Engine ENGINES[] = {
+    PChip8::Engine::Switch, PChip8::Engine::Table, PChip8::Engine::Threaded,
+    PChip8::Engine::Predecoded, PChip8::Engine::Jit};
+
+struct Options {
+  uint64_t cycles = 2'000'000;
+  int repeats = 5;
+  PChip8::Engine engine = PChip8::DEFAULT_ENGINE;
+  std::string filter;
+};
+
+struct Result {
+  std::string name;
+  std::string unit;
+  double mean;
+  double stddev;
+  double min;
+  double max;
+};
+
+std::vector<uint8_t> toBytes(const Program &program) {
+  std::vector<uint8_t> bytes;
+  for (uint16_t instruction : program) {
+    bytes.push_back(instruction >> 8);
+    bytes.push_back(instruction & 0xFF);
+  }
+  return bytes;
+}
+
+// `setup` once, then `copies` of `body` in a loop that jumps back to the
+// first copy
+Program loop(const Program &setup, const Program &body, int copies = 256) {
+  Program program = setup;
+  uint16_t loopStart = START + 2 * program.size();
+  for (int copy = 0; copy < copies; ++copy) {
+    program.insert(program.end(), body.begin(), body.end());
+  }
+  program.push_back(0x1000 | loopStart);
+  return program;
+}
+
+// Copies of a jump-like instruction, each one targeting the next
+Program chain(const Program &setup, uint16_t opcode, int copies = 256) {
+  Program program = setup;
+  uint16_t loopStart = START + 2 * program.size();
+  for (int copy = 0; copy < copies; ++copy) {
+    uint16_t next = START + 2 * (program.size() + 1);
+    program.push_back(opcode | next);
+  }
+  program.push_back(0x1000 | loopStart);
+  return program;
+}
+
+// Copies of CALL to a subroutine that only returns
+Program callReturn(int copies = 256) {
+  uint16_t subroutine = START + 2 * (copies + 1);
+  Program program(copies, 0x2000 | subroutine);
+  program.push_back(0x1000 | START);
+  program.push_back(0x00EE);
+  return program;
+}
+
+std::unique_ptr<PChip8::Chip8> makeMachine(const Program &program,
+                                           PChip8::Engine engine) {
+  auto chip8 = std::make_unique<PChip8::Chip8>();
+  chip8->loadROM(toBytes(program));
+  chip8->setEngine(engine);
+  // FX0A finds a key down and continues instead of waiting
+  chip8->keyPress[0] = true;
+  return chip8;
+}
+
+// Run `sample` repeats times, each call returns one measurement
+Result measure(const std::string &name, const std::string &unit, int repeats,
+               const std::function<double()> &sample) {
+  std::vector<double> values;
+  for (int repeat = 0; repeat < repeats; ++repeat) {
+    values.push_back(sample());
+  }
+
+  double mean = 0;
+  for (double value : values) {
+    mean += value;
+  }
+  mean /= values.size();
+
+  double variance = 0;
+  for (double value : values) {
+    variance += (value - mean) * (value - mean);
+  }
+  variance /= values.size() > 1 ? values.size() - 1 : 1;
+
+  auto [min, max] = std::minmax_element(values.begin(), values.end());
+  return {name, unit, mean, std::sqrt(variance), *min, *max};
+}
+
+// Benchmarks whose name contains the filter, and their results
+struct Suite {
+  const Options &options;
+  std::vector<Result> results;
+
+  void add(const std::string &name, const std::string &unit,
+           const std::function<double()> &sample) {
+    if (name.find(options.filter) != std::string::npos)
+      results.push_back(measure(name, unit, options.repeats, sample));
+  }
+};
+
+template <typename Function> double timeNs(Function &&function) {
+  auto start = std::chrono::steady_clock::now();
+  function();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+// ns per instruction of a program run for `cycles` instructions
+void addProgram(Suite &suite, const std::string &name, const Program &program,
+                PChip8::Engine engine, uint64_t cycles) {
+  suite.add(name, "ns/instruction", [&] {
+    auto chip8 = makeMachine(program, engine);
+    chip8->run(cycles / 10); // warm up decode caches and the JIT
+    return timeNs([&] { chip8->run(cycles); }) / cycles;
+  });
+}
+
+// ---- micro ----
+
+void dispatchBenchmarks(Suite &suite) {
+  Program alu = loop({0x6001, 0x6102}, {0x8014});
+  uint64_t cycles = suite.options.cycles / 10;
+
+  for (auto engine : ENGINES) {
+    std::string engineName{PChip8::engineName(engine)};
+    suite.add("dispatch/cpuCycle/" + engineName, "ns/instruction", [&] {
+      auto chip8 = makeMachine(alu, engine);
+      return timeNs([&] {
+               for (uint64_t cycle = 0; cycle < cycles; ++cycle) {
+                 chip8->cpuCycle();
+               }
+             }) /
+             cycles;
+    });
+    addProgram(suite, "dispatch/run/" + engineName, alu, engine, cycles);
+  }
+}
+
+void opcodeBenchmarks(Suite &suite) {
+  // V0 = 0 and V1 = 1 throughout, so skips and key tests are not taken
+  // unless noted
+  const Program registers = {0x6000, 0x6101};
+  const Program scratch = {0x6000, 0x6101, 0xA000 | SCRATCH};
+
+  const std::vector<std::pair<std::string, Program>> opcodes = {
+      {"00E0", loop({}, {0x00E0})},
+      {"2NNN+00EE", callReturn()},
+      {"1NNN", chain({}, 0x1000)},
+      {"3XKK", loop(registers, {0x3001})},
+      {"4XKK", loop(registers, {0x4000})},
+      {"5XY0", loop(registers, {0x5010})},
+      {"6XKK", loop({}, {0x6012})},
+      {"7XKK", loop({}, {0x7201})},
+      {"8XY0", loop(registers, {0x8210})},
+      {"8XY1", loop(registers, {0x8211})},
+      {"8XY2", loop(registers, {0x8212})},
+      {"8XY3", loop(registers, {0x8213})},
+      {"8XY4", loop(registers, {0x8214})},
+      {"8XY5", loop(registers, {0x8215})},
+      {"8XY6", loop(registers, {0x8216})},
+      {"8XY7", loop(registers, {0x8217})},
+      {"8XYE", loop(registers, {0x821E})},
+      {"9XY0", loop({0x6000, 0x6100}, {0x9010})},
+      {"ANNN", loop({}, {0xA000 | SCRATCH})},
+      {"BNNN", chain(registers, 0xB000)},
+      {"CXKK", loop({}, {0xC2FF})},
+      {"DXYN", loop({0xA050, 0x6000, 0x6100}, {0xD015})},
+      {"EX9E", loop(registers, {0xE19E})},
+      // key 1 is up, so every EXA1 skips the next copy
+      {"EXA1", loop(registers, {0xE1A1})},
+      {"FX07", loop({}, {0xF207})},
+      {"FX0A", loop({}, {0xF20A})},
+      {"FX15", loop({}, {0xF215})},
+      {"FX18", loop({}, {0xF218})},
+      {"FX1E", loop(registers, {0xF01E})},
+      {"FX29", loop(registers, {0xF129})},
+      {"FX33", loop(scratch, {0xF133})},
+      // I moves past the registers under the default profile, so each copy
+      // points it back at the scratch area first
+      {"FX55", loop(scratch, {0xA000 | SCRATCH, 0xFF55})},
+      {"FX65", loop(scratch, {0xA000 | SCRATCH, 0xFF65})},
+  };
+
+  auto engine = suite.options.engine;
+  std::string engineName{PChip8::engineName(engine)};
+  for (const auto &[name, program] : opcodes) {
+    addProgram(suite, "opcode/" + name + "/" + engineName, program, engine,
+               suite.options.cycles / 10);
+  }
+}
+
+void drawBenchmarks(Suite &suite) {
+  struct DrawCase {
+    std::string name;
+    uint8_t x;
+    uint8_t y;
+    uint8_t rows;
+  };
+  const DrawCase cases[] = {
+      {"rows1", 0, 0, 1},
+      {"rows5", 0, 0, 5},
+      {"rows8", 0, 0, 8},
+      {"rows15", 0, 0, 15},
+      {"unaligned", 3, 0, 8},
+      {"clip_right", 60, 0, 8},
+      {"clip_bottom", 0, 28, 8},
+      {"offscreen", 70, 40, 8},
+  };
+
+  auto engine = suite.options.engine;
+  std::string engineName{PChip8::engineName(engine)};
+  for (const auto &drawCase : cases) {
+    Program program = loop({0xA050, uint16_t(0x6000 | drawCase.x),
+                            uint16_t(0x6100 | drawCase.y)},
+                           {uint16_t(0xD010 | drawCase.rows)});
+    addProgram(suite, "draw/" + drawCase.name + "/" + engineName, program,
+               engine, suite.options.cycles / 10);
+  }
+
+  constexpr int clears = 100'000;
+  suite.add("display/clear", "ns/clear", [] {
+    PChip8::PlanarDisplay display;
+    return timeNs([&] {
+             for (int clear = 0; clear < clears; ++clear) {
+               display.clear();
+               asm volatile("" : : "r"(&display) : "memory");
+             }
+           }) /
+           clears;
+  });
+
+  // the SUPER-CHIP scroll opcodes, by the pixels each one moves
+  struct ScrollCase {
+    std::string name;
+    void (PChip8::PlanarDisplay::*scroll)(int);
+    int pixels;
+  };
+  const std::vector<ScrollCase> scrolls = {
+      {"down", &PChip8::PlanarDisplay::scrollDown, 4},
+      {"up", &PChip8::PlanarDisplay::scrollUp, 4},
+      {"right", &PChip8::PlanarDisplay::scrollRight, 4},
+      {"left", &PChip8::PlanarDisplay::scrollLeft, 4},
+  };
+  constexpr int scrollCount = 100'000;
+  for (const auto &scrollCase : scrolls) {
+    for (bool hires : {false, true}) {
+      std::string name = "display/scroll_" + scrollCase.name +
+                         (hires ? "/hires" : "/lores");
+      suite.add(name, "ns/scroll", [scrollCase, hires] {
+        PChip8::PlanarDisplay display;
+        display.setHires(hires);
+        return timeNs([&] {
+                 for (int scroll = 0; scroll < scrollCount; ++scroll) {
+                   (display.*scrollCase.scroll)(scrollCase.pixels);
+                   asm volatile("" : : "r"(&display) : "memory");
+                 }
+               }) /
+               scrollCount;
+      });
+    }
+  }
+}
+
+void resetBenchmarks(Suite &suite) {
+  // a reset restores the cached ROM image, batch jobs do this per run
+  constexpr int resets = 10'000;
+  suite.add("machine/reset", "ns/reset", [] {
+    auto chip8 = makeMachine(loop({}, {0x7001}), PChip8::Engine::Predecoded);
+    return timeNs([&] {
+             for (int reset = 0; reset < resets; ++reset) {
+               chip8->reset();
+             }
+           }) /
+           resets;
+  });
+}
+
+// ---- macro ----
+
+// Arithmetic loop with a data dependent skip
+Program aluProgram() {
+  return loop({0x6001, 0x6102, 0x6203},
+              {0x8014, 0x8125, 0x8236, 0x820E, 0x8013, 0x8121, 0x7003, 0x3000,
+               0x8012, 0x8207, 0xA300, 0xF01E},
+              64);
+}
+
+// Sprites marching across the screen with a clear every 64 draws
+Program drawProgram() {
+  Program body = {0xA050, 0x7005, 0x7103, 0xD015, 0xD01A, 0xF029, 0xD015};
+  Program program = loop({0x6000, 0x6100}, body, 64);
+  program.insert(program.end() - 1, 0x00E0);
+  return program;
+}
+
+// Nested calls three deep
+Program callProgram() {
+  const uint16_t callOuter = 0x2000 | (START + 2 * 5);
+  const uint16_t callMiddle = callOuter + 2 * 3;
+  const uint16_t callInner = callMiddle + 2 * 3;
+  return {callOuter, 0x7001, callOuter, 0x7101, 0x1000 | START,
+          // outer
+          callMiddle, callMiddle, 0x00EE,
+          // middle
+          callInner, 0x7201, 0x00EE,
+          // inner
+          0x8014, 0x00EE};
+}
+
+void macroBenchmarks(Suite &suite) {
+  const std::pair<std::string, Program> programs[] = {
+      {"alu", aluProgram()},
+      {"draw", drawProgram()},
+      {"call", callProgram()},
+  };
+
+  for (const auto &[name, program] : programs) {
+    for (auto engine : ENGINES) {
+      std::string engineName{PChip8::engineName(engine)};
+      suite.add("rom/" + name + "/" + engineName, "mips", [&] {
+        auto chip8 = makeMachine(program, engine);
+        uint64_t cycles = suite.options.cycles;
+        return cycles / timeNs([&] { chip8->run(cycles); }) * 1000;
+      });
+    }
+
+    // millions of lane-instructions per second, comparable with the above
+    for (int lanes : {1, 16, 256, 4096}) {
+      suite.add("lockstep/" + name + "/" + std::to_string(lanes), "mips", [&] {
+        PChip8::Lockstep lockstep{toBytes(program), lanes};
+        uint64_t steps = std::max<uint64_t>(suite.options.cycles / lanes, 1);
+        double ns = timeNs([&] { lockstep.run(steps); });
+        return steps * lanes / ns * 1000;
+      });
+    }
+  }
+}
+
+void printJson(const Options &options, const std::vector<Result> &results) {
+  std::cout << "{\n  \"cycles\": " << options.cycles
+            << ",\n  \"repeats\": " << options.repeats << ",\n  \"engine\": \""
+            << PChip8::engineName(options.engine) << "\",\n  \"results\": [";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const auto &result = results[i];
+    std::cout << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << result.name
+              << "\", \"unit\": \"" << result.unit
+              << "\", \"mean\": " << result.mean
+              << ", \"stddev\": " << result.stddev
+              << ", \"min\": " << result.min << ", \"max\": " << result.max
+              << "}";
+  }
+  std::cout << "\n  ]\n}\n";
+}
+
+void printUsage(const char *program) {
+  std::cerr << "usage: " << program
+            << " [-c cycles] [-r repeats] [-e engine] [filter]\n";
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    try {
+      if (arg == "-c" && i + 1 < argc)
+        options.cycles = std::stoull(argv[++i]);
+      else if (arg == "-r" && i + 1 < argc)
+        options.repeats = std::stoi(argv[++i]);
+      else if (arg == "-e" && i + 1 < argc)
+        options.engine = PChip8::parseEngine(argv[++i]);
+      else if (options.filter.empty() && arg[0] != '-')
+        options.filter = arg;
+      else
+        throw std::invalid_argument(arg);
+    } catch (std::exception &e) {
+      printUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (options.cycles < 10 || options.repeats < 1) {
+    printUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Suite suite{.options = options, .results = {}};
+  try {
+    dispatchBenchmarks(suite);
+    opcodeBenchmarks(suite);
+    drawBenchmarks(suite);
+    resetBenchmarks(suite);
+    macroBenchmarks(suite);
+  } catch (std::exception &e) {
+    std::cerr << "error: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+
+  printJson(options, suite.results);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include "chip8.h"
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace PChip8 {
+// A basic block translated to C++ by pchip8-aot: `length` instructions
+// starting at `address`. run executes all of them and runPrefix only the
+// first `count` (less than length, nullptr for single instruction blocks),
+// both return the next pc.
+struct AotBlock {
+  uint16_t address;
+  uint16_t length;
+  uint16_t (*run)(Chip8 &chip8);
+  uint16_t (*runPrefix)(Chip8 &chip8, uint16_t count);
+};
+
+// A ROM translated by pchip8-aot for one quirk profile. The generated
+// translation unit registers it during static initialization, so linking it
+// in is enough to use it.
+struct AotProgram {
+  std::string_view name;
+  std::span<const uint8_t> rom;
+  std::span<const AotBlock> blocks;
+  QuirkProfile quirks;
+};
+
+// Always returns true, so it can initialize a namespace scope variable
+bool registerAotProgram(const AotProgram &program);
+[[nodiscard]] std::span<const AotProgram *const> registeredAotPrograms();
+
+// Runs a Chip8 on the registered program for its quirk profile that best
+// matches its memory
+//
+// A block only runs while the memory it was translated from still holds the
+// same bytes, anything else (BNNN targets, self-modifying code, addresses
+// outside the ROM) is executed one instruction at a time by the predecoded
+// interpreter until pc reaches a block again. A block longer than the
+// remaining cycle budget runs only as far as the budget goes.
+class AotRuntime {
+public:
+  explicit AotRuntime(const Chip8 &chip8);
+
+  AotRuntime(const AotRuntime &) = delete;
+  AotRuntime &operator=(const AotRuntime &) = delete;
+
+  // Execute exactly `cycles` instructions on chip8, returns the number executed
+  uint64_t run(Chip8 &chip8, uint64_t cycles);
+  // Stop trusting the blocks translated from address until they are checked
+  // against memory again
+  void invalidate(uint16_t address);
+
+  // nullptr when no registered program matches
+  [[nodiscard]] const AotProgram *getProgram() const;
+
+  // ---- used by generated code ----
+
+  static std::array<uint8_t, VREG_COUNT> &registers(Chip8 &chip8) {
+    return chip8.V;
+  }
+  static uint16_t &index(Chip8 &chip8) { return chip8.I; }
+  static uint8_t &delayTimer(Chip8 &chip8) { return chip8.delayTimer; }
+  // FX18 as instruction `index` of the running block, whose cycles are only
+  // counted once it returns
+  static void setSoundTimer(Chip8 &chip8, uint8_t value, int index) {
+    chip8.setSoundTimer(value, chip8.aot->blockCycle + index + 1);
+  }
+  static const std::array<uint8_t, MEMORY_SIZE> &memory(const Chip8 &chip8) {
+    return chip8.memory;
+  }
+  // Execute instruction `index` of the running block with its opCode_*
+  // handler, pc and the cycle count set as if it had just been fetched,
+  // returns pc afterwards
+  static uint16_t execute(Chip8 &chip8, Op op, uint16_t opCode, uint16_t next,
+                          int index);
+
+private:
+  // invalidate() only looks at the blocks overlapping the written page
+  static constexpr int PAGE_SIZE = 64;
+
+  bool revalidate(int block, const Chip8 &chip8);
+
+  const AotProgram *program = nullptr;
+  // cycle count before the running block
+  uint64_t blockCycle = 0;
+  // index of the block starting at each address, -1 for none
+  std::array<int16_t, MEMORY_SIZE> entries;
+  // blocks not checked against memory since it last changed under them
+  std::vector<bool> stale;
+  // addresses translated into some block
+  std::bitset<MEMORY_SIZE> codeMap;
+  // indices of the blocks overlapping each page
+  std::array<std::vector<uint16_t>, MEMORY_SIZE / PAGE_SIZE> pages;
+};
+} // namespace PChip8
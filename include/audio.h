@@ -0,0 +1,134 @@
+#pragma once
+#include "chip8.h"
+#include "spsc_queue.h"
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace PChip8 {
+enum class AudioBackend : uint8_t {
+  // changes are counted and dropped
+  Null,
+  // an audio device thread pulls samples with Buzzer::render()
+  Device,
+  // samples are rendered on the emulation thread at every frame end and
+  // written to a 16-bit mono WAV file
+  Wav
+};
+
+struct AudioConfig {
+  int sampleRate = 44100;
+  // square wave pitch in Hz and amplitude from 0 to 1
+  float frequency = 440.0f;
+  float volume = 0.2f;
+  // Device: frames of emulated time playback trails the emulator by. The
+  // changes of a frame are only known once it ran, so at least 1.
+  int latencyFrames = 1;
+};
+
+// The CHIP-8 buzzer as a square wave.
+//
+// Every frame end the Scheduler hands over the buzzer changes the Chip8
+// logged during the frame (getBuzzerChanges()). endFrame() turns their
+// cycles into sample positions of emulated time, 60 frames per second, and
+// queues them on a lock-free ring without ever waiting: when the ring is
+// full the latest change is held back and queued at a later frame end, so
+// only a burst of toggles can lose detail and the state always catches up.
+//
+// render() consumes the ring on the audio device's thread and switches the
+// wave on and off exactly at each change's sample. It plays changes
+// latencyFrames behind emulated time, and moves that anchor whenever a
+// change arrives too late for it or too far ahead, e.g. after the emulator
+// waited for a key, ran turbo or the two clocks drifted apart.
+//
+// The WAV backend renders each frame as it ends with the same code, sample
+// accurate against emulated time, for headless runs and tests.
+class Buzzer {
+public:
+  // Null or Device backend
+  explicit Buzzer(AudioBackend backend, AudioConfig config = {});
+  // Wav backend, throws std::runtime_error if the file cannot be created
+  Buzzer(const std::string &wavFile, AudioConfig config = {});
+  ~Buzzer();
+
+  Buzzer(const Buzzer &) = delete;
+  Buzzer &operator=(const Buzzer &) = delete;
+
+  // Emulation thread, at every frame end: queue the frame's buzzer changes,
+  // which ended at frameEndCycle, with `on` the buzzer state the frame ended
+  // in. Changes missing from the log (a state load, a reset) are made up at
+  // the frame end from `on`.
+  void endFrame(std::span<const BuzzerChange> changes, uint64_t frameEndCycle,
+                uint32_t instructionsPerFrame, bool on);
+  // Emulation thread: a frame of wall-clock time in which the machine did
+  // not run, e.g. while rewinding, which is silent
+  void idleFrame();
+
+  // Audio thread (Device backend): fill `samples`, silence until the first
+  // change arrives
+  void render(std::span<int16_t> samples);
+
+  // Wav backend: complete the header and close the file. Throws
+  // std::runtime_error if a write failed.
+  void finish();
+
+  [[nodiscard]] AudioBackend getBackend() const;
+  [[nodiscard]] const AudioConfig &getConfig() const;
+  // Changes queued so far, those made up from `on` included
+  [[nodiscard]] uint64_t getChangeCount() const;
+  [[nodiscard]] uint64_t getFrameCount() const;
+
+private:
+  static constexpr std::size_t QUEUE_SIZE = 256;
+  // Device: how far ahead of its anchor a change may arrive before the
+  // anchor moves, in frames
+  static constexpr int MAX_EARLY_FRAMES = 3;
+
+  struct Change {
+    // sample of emulated time, or of playback once render() placed it
+    uint64_t sample;
+    bool on;
+  };
+
+  [[nodiscard]] uint64_t frameStart(uint64_t frame) const;
+  void queue(Change change);
+  // Playback sample for a change of emulated time
+  uint64_t place(uint64_t sample);
+  void synthesize(std::span<int16_t> samples);
+  void writeWav(std::span<const int16_t> samples);
+
+  AudioBackend backend;
+  AudioConfig config;
+
+  // ---- emulation thread ----
+  uint64_t frameCount = 0;
+  uint64_t changeCount = 0;
+  bool queuedOn = false;
+  // the newest change when the ring was full
+  std::optional<Change> heldBack;
+
+  SpscQueue<Change, QUEUE_SIZE> changes;
+
+  // ---- render side ----
+  // samples rendered so far
+  uint64_t position = 0;
+  // playback sample minus emulated sample of every change (Device)
+  int64_t anchor = 0;
+  bool anchored = false;
+  // samples asked for by the last render() call
+  uint64_t requestSize = 0;
+  std::optional<Change> next;
+  bool playing = false;
+  // of the square wave, 0 to 1
+  float phase = 0;
+
+  // ---- Wav backend ----
+  std::string fileName;
+  std::ofstream out;
+  std::vector<int16_t> frameSamples;
+  uint64_t samplesWritten = 0;
+};
+} // namespace PChip8
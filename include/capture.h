@@ -0,0 +1,157 @@
+#pragma once
+#include "chip8.h"
+#include "delta_codec.h"
+#include "spsc_queue.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace PChip8 {
+// -- CAPTURE FILES --
+
+// Little-endian stream of the frames of a run:
+//   header  magic "P8CF", u16 version, u16 reserved, u32 instructions per
+//           frame
+//   frames  u8 flags (bit 0 hi-res, bit 1 two planes, bit 2 keyframe),
+//           varint cycles since the previous frame, varint delta size, delta
+// A frame's image is the packed rows of plane 0, then of plane 1 when it has
+// two, at the frame's resolution with one u64 per 64 pixels. Its delta is
+// encodeDelta of the image against the previous frame's, or against zeros
+// for a keyframe. A frame of another resolution or plane count than the
+// previous one is always a keyframe.
+inline constexpr uint32_t CAPTURE_MAGIC = 0x46433850;
+inline constexpr uint16_t CAPTURE_VERSION = 1;
+inline constexpr int CAPTURE_HEADER_SIZE = 12;
+
+struct CaptureConfig {
+  // a keyframe at least every this many frames, so players can seek
+  uint32_t keyframeInterval = 600;
+  // when the writer is behind by every buffer, drop frames instead of
+  // waiting for it, for machines paced to real time
+  bool dropFrames = false;
+};
+
+// Streams the frames of a running machine to a capture file.
+//
+// capture() runs on the emulation thread at every frame end and only copies
+// the display rows drawn to into a batch buffer, which is handed to a
+// writer thread through a lock-free queue once full. The writer rebuilds
+// every frame from those rows, then delta and run length encodes it and
+// writes it out unless nothing changed, so the core only waits for the
+// disk when the writer falls behind by every buffer. With
+// CaptureConfig::dropFrames it never does: frames are dropped instead and
+// the next one captured is sent whole.
+//
+// The capture takes the dirty rows of the display (takeDirtyRows()) and
+// clears drawFlag, so it stands in for the frontend of a headless machine.
+class FrameCapture {
+public:
+  // Creates the file and starts the writer thread, throws std::runtime_error
+  // if the file cannot be created
+  FrameCapture(const std::string &fileName, uint32_t instructionsPerFrame,
+               CaptureConfig config = {});
+  ~FrameCapture();
+
+  // Record the display if it changed since the last call
+  void capture(Chip8 &chip8);
+  // Hand over what is buffered, wait for the writer to write it and close
+  // the file. Throws std::runtime_error if a write failed.
+  void finish();
+
+  [[nodiscard]] uint64_t getFrameCount() const;
+  [[nodiscard]] uint64_t getDroppedFrameCount() const;
+
+private:
+  static constexpr std::size_t BATCH_COUNT = 8;
+  static constexpr std::size_t BATCH_BYTES = 64 * 1024;
+  using Batch = std::vector<uint8_t>;
+
+  // Make room for a record of `size` bytes, handing the current batch to the
+  // writer once full. False when dropping frames and no batch is free.
+  bool reserve(std::size_t size);
+  void wake();
+  void writeLoop();
+  void writeBatch(const Batch &batch);
+
+  std::string fileName;
+  CaptureConfig config;
+  std::ofstream out;
+
+  // emulation thread: the batch being filled, frames recorded and dropped,
+  // and the layout of the last frame sent
+  Batch *current = nullptr;
+  uint64_t frameCount = 0;
+  uint64_t droppedFrames = 0;
+  bool resend = false;
+  bool sentHires = false;
+  bool sentTwoPlanes = false;
+
+  std::array<Batch, BATCH_COUNT> batches;
+  SpscQueue<Batch *, BATCH_COUNT> filled;
+  SpscQueue<Batch *, BATCH_COUNT> empty;
+  // bumped after every hand over and on stop, the writer waits on it
+  std::atomic<uint32_t> wakeups{0};
+  // bumped whenever the writer frees a batch, capture() waits on it
+  std::atomic<uint32_t> freed{0};
+  std::atomic<bool> stopping{false};
+  std::atomic<bool> failed{false};
+  std::thread writer;
+
+  // writer thread: the layout of the last frame, the image being built and
+  // the one last written, where in it the rows of the frame are, and the
+  // encoded batch
+  bool hires = false;
+  bool twoPlanes = false;
+  uint64_t lastCycle = 0;
+  uint32_t framesSinceKeyframe;
+  std::vector<uint8_t> image;
+  std::vector<uint8_t> previousImage;
+  std::vector<DeltaRange> ranges;
+  std::vector<uint8_t> encoded;
+  std::vector<uint8_t> output;
+};
+
+// A decoded frame of a capture file
+struct CaptureFrame {
+  uint64_t cycle = 0;
+  bool hires = false;
+  bool twoPlanes = false;
+  bool keyframe = false;
+  std::array<std::array<uint64_t, PlanarDisplay::MAX_WORDS>, PLANE_COUNT>
+      planes{};
+
+  [[nodiscard]] int getWidth() const;
+  [[nodiscard]] int getHeight() const;
+  // The rows of a plane, getWidth() / 64 words each
+  [[nodiscard]] std::span<const uint64_t> getRows(int plane) const;
+};
+
+// Reads a capture file front to back
+class CaptureReader {
+public:
+  // Throws std::runtime_error if the file cannot be opened or is not a
+  // capture
+  explicit CaptureReader(const std::string &fileName);
+
+  [[nodiscard]] uint32_t getInstructionsPerFrame() const;
+  // Decode the next frame into getFrame(), false at the end of the file.
+  // Throws std::runtime_error on a truncated or corrupt frame.
+  bool next();
+  [[nodiscard]] const CaptureFrame &getFrame() const;
+  // Bytes read so far, header included
+  [[nodiscard]] uint64_t getBytesRead() const;
+
+private:
+  std::ifstream in;
+  uint32_t instructionsPerFrame = 0;
+  uint64_t bytesRead = 0;
+  CaptureFrame frame;
+  std::vector<uint8_t> image;
+  std::vector<uint8_t> delta;
+};
+} // namespace PChip8
@@ -1,20 +1,45 @@
 #pragma once
-#include "display.h"
+#include "opcodes.h"
+#include "planar_display.h"
+#include "profile.h"
+#include "rng.h"
 #include <array>
-#include <stack>
 #include <cstdint>
+#include <memory>
+#include <span>
 #include <string>
+#include <string_view>
 
 namespace PChip8 {
 // --- CONSTANTS ---
 
-inline constexpr int DISPLAY_WIDTH = 64;
-inline constexpr int DISPLAY_HEIGHT = 32;
 inline constexpr int MEMORY_SIZE = 4096;
+inline constexpr int MEMORY_MASK = MEMORY_SIZE - 1;
+inline constexpr int STACK_DEPTH = 16;
 inline constexpr int VREG_COUNT = 16;
+inline constexpr int KEY_COUNT = 16;
 inline constexpr int FONT_LOCATION = 0x50;
 inline constexpr int START_EXEC_LOCATION = 0x200;
 
+// -- SAVE STATES --
+
+// Little-endian snapshot of the whole machine:
+//   header       magic "P8SS", u16 version, u16 reserved
+//   memory       MEMORY_SIZE bytes
+//   registers    V0-VF, u16 I, u16 pc, u8 sp, u8 delay, u8 sound,
+//                u8 display flags (bit 0 hi-res, bits 1-2 plane mask)
+//   stack        STACK_DEPTH x u16
+//   cycle count  u64
+//   rng state    u64
+//   display      per plane, packed rows at the current resolution, one u64
+//                per 64 pixels, zero padded to PlanarDisplay::MAX_WORDS
+inline constexpr uint32_t SAVE_STATE_MAGIC = 0x53533850;
+inline constexpr uint16_t SAVE_STATE_VERSION = 3;
+inline constexpr int SAVE_STATE_SIZE = 8 + MEMORY_SIZE + VREG_COUNT + 8 +
+                                       2 * STACK_DEPTH + 8 + 8 +
+                                       PLANE_COUNT * PlanarDisplay::MAX_WORDS * 8;
+using SaveState = std::array<uint8_t, SAVE_STATE_SIZE>;
+
 // ----- FONT -----
 
 inline constexpr std::array<uint8_t, 80> BUILTIN_FONT = {
@@ -36,70 +61,401 @@ inline constexpr std::array<uint8_t, 80> BUILTIN_FONT = {
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
+// ---- ENGINES ---
+
+// Instruction dispatch strategies, all sharing the same opCode_* semantics
+//   Switch:     nested switch on the opcode nibbles
+//   Table:      64K-entry handler table indexed by the full opcode
+//   Threaded:   labels-as-values threaded interpreter (GCC/Clang only,
+//               falls back to Table elsewhere)
+//   Predecoded: per-address cache of decoded handlers and operands,
+//               invalidated when the program writes over its own code
+//   Jit:        x86-64 basic-block recompiler on top of Predecoded
+//               (falls back to Predecoded when built without PCHIP8_HAS_JIT)
+//   Aot:        blocks compiled to C++ ahead of time by pchip8-aot, on top of
+//               Predecoded (same as Predecoded when no ROM was compiled in)
+enum class Engine { Switch, Table, Threaded, Predecoded, Jit, Aot };
+
+#ifndef PCHIP8_DEFAULT_ENGINE
+#define PCHIP8_DEFAULT_ENGINE Predecoded
+#endif
+
+inline constexpr Engine DEFAULT_ENGINE = Engine::PCHIP8_DEFAULT_ENGINE;
+
+[[nodiscard]] std::string_view engineName(Engine engine);
+// throws std::invalid_argument on an unknown name
+[[nodiscard]] Engine parseEngine(std::string_view name);
+
+// ---- QUIRKS ----
+
+// Interpreters that disagree on what some instructions do, in a fixed order
+//   Vip:       the original COSMAC VIP interpreter
+//   Chip48:    CHIP-48 on the HP-48
+//   SuperChip: SUPER-CHIP 1.1
+//   XoChip:    XO-CHIP as implemented by Octo
+#define PCHIP8_QUIRK_PROFILES(X)                                               \
+  X(Vip, "vip")                                                                \
+  X(Chip48, "chip48")                                                          \
+  X(SuperChip, "schip")                                                        \
+  X(XoChip, "xochip")
+
+enum class QuirkProfile : uint8_t {
+#define PCHIP8_QUIRK_ENUM(profile, name) profile,
+  PCHIP8_QUIRK_PROFILES(PCHIP8_QUIRK_ENUM)
+#undef PCHIP8_QUIRK_ENUM
+};
+
+inline constexpr int QUIRK_PROFILE_COUNT =
+    static_cast<int>(QuirkProfile::XoChip) + 1;
+inline constexpr QuirkProfile DEFAULT_QUIRKS = QuirkProfile::Vip;
+
+// Where FX55 and FX65 leave I
+enum class IndexIncrement : uint8_t { None, X, XPlusOne };
+
+struct Quirks {
+  // 8XY1, 8XY2 and 8XY3 reset VF to 0
+  bool logicResetsVF;
+  // 8XY6 and 8XYE shift VY into VX, rather than VX in place
+  bool shiftReadsVY;
+  IndexIncrement indexIncrement;
+  // BNNN is BXNN, a jump to XNN + VX rather than NNN + V0
+  bool jumpUsesVX;
+  // DXYN wraps sprites around the edges of the display instead of clipping
+  // them. The starting position always wraps.
+  bool spritesWrap;
+  // 00CN, 00FB-00FF and 16x16 DXY0 sprites on a 128x64 hi-res screen
+  bool superChip;
+  // 00DN and FN01, with a second bitplane that DXYN and the scrolls apply to
+  bool xoChip;
+};
+
+constexpr Quirks quirksOf(QuirkProfile profile) {
+  switch (profile) {
+  case QuirkProfile::Vip:
+    return {true, true, IndexIncrement::XPlusOne, false, false, false, false};
+  case QuirkProfile::Chip48:
+    return {false, false, IndexIncrement::X, true, false, false, false};
+  case QuirkProfile::SuperChip:
+    return {false, false, IndexIncrement::None, true, false, true, false};
+  case QuirkProfile::XoChip:
+    return {false, true, IndexIncrement::XPlusOne, false, true, true, true};
+  }
+  return {};
+}
+
+[[nodiscard]] std::string_view quirkProfileName(QuirkProfile profile);
+// throws std::invalid_argument on an unknown name
+[[nodiscard]] QuirkProfile parseQuirkProfile(std::string_view name);
+
+// What the program is doing when it only waits for something outside the
+// CPU, see Chip8::idleState
+enum class IdleState {
+  Running,
+  // FX0A with no key down
+  WaitingForKey,
+  // FX07 / 3XKK or 4XKK / 1NNN loop polling the delay timer, which the
+  // current timer value does not exit
+  WaitingForTimer,
+  // 1NNN jumping to itself, the usual way to end a program, or the
+  // SUPER-CHIP 00FD exit
+  Halted
+};
+
+// The buzzer turned on or off, at the cycle of the FX18 or timer tick that
+// did it. It sounds while the sound timer is nonzero.
+struct BuzzerChange {
+  uint64_t cycle;
+  bool on;
+};
+
+// Changes kept between Chip8::clearBuzzerChanges calls, beyond it the
+// newest on/off pair is dropped so the log still ends in the current state
+inline constexpr int BUZZER_LOG_SIZE = 16;
+
+class AotRuntime;
+class Debugger;
+class Jit;
+class RomImage;
+class Lockstep;
+
+// Watches a Chip8 instruction by instruction, see Chip8::setDebugHook
+class DebugHook {
+public:
+  virtual ~DebugHook() = default;
+  // Before the instruction at pc executes, false ends the run without it
+  virtual bool beforeInstruction(uint16_t pc) = 0;
+  // After it executed, false ends the run there
+  virtual bool afterInstruction() = 0;
+  // Every byte stored to guest memory, by an instruction or a reset or
+  // state load
+  virtual void memoryWritten(uint16_t address) = 0;
+};
+
 // ----------------
 class Chip8 {
 public:
   void debug();
   void cpuCycle();
+  // Execute up to `cycles` instructions with the selected engine,
+  // returns the number executed, fewer only when a debug hook stopped it
+  uint64_t run(uint64_t cycles);
+  // Memory becomes the ROM image: the file through RomCache::shared(), so
+  // it is read from disk once per process, or a copy of romData
   void loadROM(std::string fileName);
+  void loadROM(std::span<const uint8_t> romData);
+  void loadROM(std::shared_ptr<const RomImage> image);
   void printMemory() const;
+  // Back to the power-on state with the loaded ROM in place again, restored
+  // from its cached image without touching the file. The random generator
+  // carries on, seedRandom() again for a run identical to the first.
   void reset();
-  Display<DISPLAY_WIDTH, DISPLAY_HEIGHT, uint32_t> display;
-  [[nodiscard]] const bool getDrawFlag() const;
+  // Decrement the delay and sound timers, called at 60 Hz of emulated time
+  void tickTimers();
+
+  // Whether the next instructions only spin until a timer tick or a key
+  // change, recognised from the FX0A, delay timer polling loop and jump to
+  // self patterns
+  [[nodiscard]] IdleState idleState() const;
+  // Same result as run(cycles) with no key changing meanwhile, but an idle
+  // machine is advanced to that state directly instead of spinning
+  uint64_t fastForward(uint64_t cycles);
+  PlanarDisplay display;
+  [[nodiscard]] bool getDrawFlag() const;
+  [[nodiscard]] uint16_t getPC() const;
+  [[nodiscard]] uint64_t getCycleCount() const;
+  [[nodiscard]] uint8_t getDelayTimer() const;
+  [[nodiscard]] uint8_t getSoundTimer() const;
+  // Buzzer changes since the last clearBuzzerChanges(), oldest first. A
+  // reset or state load clears them, the buzzer just takes the new state.
+  [[nodiscard]] std::span<const BuzzerChange> getBuzzerChanges() const;
+  void clearBuzzerChanges();
+  // Hash of the whole machine state, used to compare engines in lockstep
+  [[nodiscard]] uint64_t stateHash() const;
+  // Hash of V, I and pc only, cheap enough for per-checkpoint golden tests
+  [[nodiscard]] uint64_t registerHash() const;
+
+  // Snapshot and restore the whole machine state. Loading validates the
+  // header first and throws std::runtime_error without touching the machine
+  // if the snapshot is not a supported version.
+  void saveState(SaveState &state) const;
+  void loadState(const SaveState &state);
+  void saveStateFile(std::string fileName) const;
+  void loadStateFile(std::string fileName);
+
+  void setEngine(Engine newEngine);
+  [[nodiscard]] Engine getEngine() const;
+  // Every engine runs an interpreter specialized for the profile, so
+  // quirks cost nothing per instruction. Changing it drops decoded and
+  // compiled code.
+  void setQuirks(QuirkProfile profile);
+  [[nodiscard]] QuirkProfile getQuirks() const;
+  // nullptr before the first loadROM
+  [[nodiscard]] const std::shared_ptr<const RomImage> &getROM() const;
+
+  // Run every instruction through `hook` from now on, nullptr to stop.
+  // While attached, run() and fastForward() execute one instruction at a
+  // time on the selected engine. The machine does not own the hook.
+  void setDebugHook(DebugHook *hook);
+
+  // Restart the CXKK generator from seed. Machines start from seed 0, so
+  // runs are reproducible unless seeded otherwise.
+  void seedRandom(uint64_t seed);
+
+#ifdef PCHIP8_INSTRUMENTATION
+  // Everything executed since construction or the last clear
+  [[nodiscard]] const Profile &getProfile() const;
+  void clearProfile();
+#endif
 
   Chip8();
   ~Chip8();
 
+  Chip8(const Chip8 &) = delete;
+  Chip8 &operator=(const Chip8 &) = delete;
+
   bool drawFlag = false;
-  std::array<bool, 16> keyPress = {false};
+  std::array<bool, KEY_COUNT> keyPress = {false};
 
 private:
+  friend class AotRuntime;
+  friend class Debugger;
+  friend class Jit;
+  friend class Lockstep;
+
   std::array<uint8_t, MEMORY_SIZE> memory{0};
   std::array<uint8_t, VREG_COUNT> V{0};
   uint16_t I{0};
 
   uint16_t pc{START_EXEC_LOCATION};
-  std::stack<uint16_t> stack;
-
+  // fixed array instead of std::stack so the whole state is plain data
+  std::array<uint16_t, STACK_DEPTH> stack{0};
+  uint8_t sp{0};
 
   uint8_t delayTimer{0};
   uint8_t soundTimer{0};
 
-  uint16_t currentOpCode{0};
-
-  void opCode_CLS();        // 00E0
-  void opCode_RET();        // 00EE
-  void opCode_JP();         // 1NNN
-  void opCode_CALL();       // 2NNN
-  void opCode_SE_VX_KK();   // 3XKK
-  void opCode_SNE_VX_KK();  // 4XKK
-  void opCode_SE_VX_VY();   // 5XY0
-  void opCode_LD_VX_KK();   // 6XKK
-  void opCode_ADD_VX_KK();  // 7XKK
-  void opCode_LD_VX_VY();   // 8XY0
-  void opCode_OR_VX_VY();   // 8XY1
-  void opCode_AND_VX_VY();  // 8XY2
-  void opCode_XOR_VX_VY();  // 8XY3
-  void opCode_ADD_VX_VY();  // 8XY4
-  void opCode_SUB_VX_VY();  // 8XY5
-  void opCode_SHR_VX();     // 8XY6
-  void opCode_SUBN_VX_VY(); // 8XY7
-  void opCode_SHL_VX();     // 8XYE
-  void opCode_SNE_VX_VY();  // 9XY0
-  void opCode_LD_I();       // ANNN
-  void opCode_JP_V0();      // BNNN
-  void opCode_RND_VX();     // CXKK
-  void opCode_DRW_VX_VY();  // DXYN
-  void opCode_SKP_VX();     // EX9E
-  void opCode_SKNP_VX();    // EXA1
-  void opCode_LD_VX_DT();   // FX07
-  void opCode_LD_VX_K();    // FX0A
-  void opCode_LD_DT_VX();   // FX15
-  void opCode_LD_ST_VX();   // FX18
-  void opCode_ADD_I_VX();   // FX1E
-  void opCode_LD_F_VX();    // FX29
-  void opCode_LD_B_VX();    // FX33
-  void opCode_LD_I_VX();    // FX55
-  void opCode_LD_VX_I();    // FX65
+  std::array<BuzzerChange, BUZZER_LOG_SIZE> buzzerChanges{};
+  uint8_t buzzerChangeCount{0};
+
+  Instruction current;
+  uint64_t cycleCount{0};
+  Rng rng;
+  std::shared_ptr<const RomImage> rom;
+
+  Engine engine{DEFAULT_ENGINE};
+  QuirkProfile quirks{DEFAULT_QUIRKS};
+#ifdef PCHIP8_HAS_JIT
+  std::unique_ptr<Jit> jit;
+#endif
+  std::unique_ptr<AotRuntime> aot;
+  DebugHook *debugHook = nullptr;
+#ifdef PCHIP8_INSTRUMENTATION
+  Profile profile;
+#endif
+
+  using OpHandler = void (*)(Chip8 &);
+  template <void (Chip8::*Handler)()> static void invoke(Chip8 &chip8) {
+    (chip8.*Handler)();
+  }
+  template <QuirkProfile Profile> static OpHandler handlerFor(Op op);
+  static OpHandler handlerFor(QuirkProfile profile, Op op);
+  template <QuirkProfile Profile>
+  static const std::array<OpHandler, 0x10000> &handlerTable();
+  static const std::array<Op, 0x10000> &opTable();
+
+  struct DecodedInstruction {
+    OpHandler handler;
+    Instruction instruction;
+  };
+  // Parallel to memory, entries start out as (and are reset to) a stub
+  // that decodes the instruction at that address on first execution
+  std::array<DecodedInstruction, MEMORY_SIZE> decodeCache;
+  template <QuirkProfile Profile> static void decodeAndExecute(Chip8 &chip8);
+  // decodeAndExecute for the current profile
+  OpHandler decodeStub;
+  void invalidateDecodeCache();
+  void invalidateJit(uint16_t address);
+  void invalidateAot(uint16_t address);
+
+  // Every store to guest memory goes through here, so that the decode cache
+  // entries overlapping the written byte are dropped
+  void writeMemory(uint16_t address, uint8_t value) {
+    address &= MEMORY_MASK;
+    memory[address] = value;
+    decodeCache[address].handler = decodeStub;
+    decodeCache[(address - 1) & MEMORY_MASK].handler = decodeStub;
+#ifdef PCHIP8_HAS_JIT
+    if (jit)
+      invalidateJit(address);
+#endif
+    if (aot)
+      invalidateAot(address);
+    if (debugHook)
+      debugHook->memoryWritten(address);
+  }
+  // Bring memory to image with writeMemory() on the bytes that differ, for
+  // reset() and loadState(), which then keep every engine's cache
+  void restoreMemory(const std::array<uint8_t, MEMORY_SIZE> &image);
+
+  // FX18 and the timer tick set the sound timer through here, so that
+  // buzzer changes are logged at the cycle they happen
+  void setSoundTimer(uint8_t value, uint64_t cycle) {
+    if ((soundTimer > 0) != (value > 0))
+      logBuzzer(cycle, value > 0);
+    soundTimer = value;
+  }
+  void logBuzzer(uint64_t cycle, bool on);
+
+  void fetch() {
+    current = decodeInstruction((memory[pc & MEMORY_MASK] << 8) |
+                                memory[(pc + 1) & MEMORY_MASK]);
+
+    // next instruction
+    // skip 2 bc instructions are 16 bits
+    // while memory is stored in 8 bit blocks
+    pc += 2;
+    ++cycleCount;
+  }
+
+  // Called by every engine after each instruction fetched from `address`,
+  // empty (and optimized out) unless built with PCHIP8_INSTRUMENTATION
+  void profileStep([[maybe_unused]] uint16_t address) {
+#ifdef PCHIP8_INSTRUMENTATION
+    profile.record(opTable()[current.opCode], current, address & MEMORY_MASK,
+                   pc);
+#endif
+  }
+
+  // run() without a debug hook, and with one instruction by instruction
+  uint64_t runEngine(uint64_t cycles);
+  uint64_t runHooked(uint64_t cycles);
+  template <QuirkProfile Profile> uint64_t runWithQuirks(uint64_t cycles);
+  template <QuirkProfile Profile> void executeSwitch();
+  template <QuirkProfile Profile> uint64_t runSwitch(uint64_t cycles);
+  template <QuirkProfile Profile> uint64_t runTable(uint64_t cycles);
+  template <QuirkProfile Profile> uint64_t runThreaded(uint64_t cycles);
+  uint64_t runPredecoded(uint64_t cycles);
+  uint64_t runJit(uint64_t cycles);
+  uint64_t runAot(uint64_t cycles);
+
+  [[noreturn]] void throwUnknownOpCode() const;
+
+  // An FX07 / skip / 1NNN polling loop starting at `start`, with pc at
+  // instruction `position` of it
+  struct TimerLoop {
+    uint16_t start;
+    int position;
+    uint8_t x;
+  };
+  [[nodiscard]] uint16_t opCodeAt(uint16_t address) const;
+  [[nodiscard]] bool findTimerLoop(TimerLoop &loop) const;
+  [[nodiscard]] bool waitingForKey() const;
+  [[nodiscard]] bool halted() const;
+
+  // Instruction handlers, instantiated for every quirk profile, the ones
+  // without quirks identically
+  template <QuirkProfile Profile> void opCode_SCD();        // 00CN
+  template <QuirkProfile Profile> void opCode_SCU();        // 00DN
+  template <QuirkProfile Profile> void opCode_CLS();        // 00E0
+  template <QuirkProfile Profile> void opCode_RET();        // 00EE
+  template <QuirkProfile Profile> void opCode_SCR();        // 00FB
+  template <QuirkProfile Profile> void opCode_SCL();        // 00FC
+  template <QuirkProfile Profile> void opCode_EXIT();       // 00FD
+  template <QuirkProfile Profile> void opCode_LOW();        // 00FE
+  template <QuirkProfile Profile> void opCode_HIGH();       // 00FF
+  template <QuirkProfile Profile> void opCode_JP();         // 1NNN
+  template <QuirkProfile Profile> void opCode_CALL();       // 2NNN
+  template <QuirkProfile Profile> void opCode_SE_VX_KK();   // 3XKK
+  template <QuirkProfile Profile> void opCode_SNE_VX_KK();  // 4XKK
+  template <QuirkProfile Profile> void opCode_SE_VX_VY();   // 5XY0
+  template <QuirkProfile Profile> void opCode_LD_VX_KK();   // 6XKK
+  template <QuirkProfile Profile> void opCode_ADD_VX_KK();  // 7XKK
+  template <QuirkProfile Profile> void opCode_LD_VX_VY();   // 8XY0
+  template <QuirkProfile Profile> void opCode_OR_VX_VY();   // 8XY1
+  template <QuirkProfile Profile> void opCode_AND_VX_VY();  // 8XY2
+  template <QuirkProfile Profile> void opCode_XOR_VX_VY();  // 8XY3
+  template <QuirkProfile Profile> void opCode_ADD_VX_VY();  // 8XY4
+  template <QuirkProfile Profile> void opCode_SUB_VX_VY();  // 8XY5
+  template <QuirkProfile Profile> void opCode_SHR_VX();     // 8XY6
+  template <QuirkProfile Profile> void opCode_SUBN_VX_VY(); // 8XY7
+  template <QuirkProfile Profile> void opCode_SHL_VX();     // 8XYE
+  template <QuirkProfile Profile> void opCode_SNE_VX_VY();  // 9XY0
+  template <QuirkProfile Profile> void opCode_LD_I();       // ANNN
+  template <QuirkProfile Profile> void opCode_JP_V0();      // BNNN
+  template <QuirkProfile Profile> void opCode_RND_VX();     // CXKK
+  template <QuirkProfile Profile> void opCode_DRW_VX_VY();  // DXYN
+  template <QuirkProfile Profile> void opCode_SKP_VX();     // EX9E
+  template <QuirkProfile Profile> void opCode_SKNP_VX();    // EXA1
+  template <QuirkProfile Profile> void opCode_LD_VX_DT();   // FX07
+  template <QuirkProfile Profile> void opCode_LD_VX_K();    // FX0A
+  template <QuirkProfile Profile> void opCode_LD_DT_VX();   // FX15
+  template <QuirkProfile Profile> void opCode_LD_ST_VX();   // FX18
+  template <QuirkProfile Profile> void opCode_ADD_I_VX();   // FX1E
+  template <QuirkProfile Profile> void opCode_LD_F_VX();    // FX29
+  template <QuirkProfile Profile> void opCode_LD_B_VX();    // FX33
+  template <QuirkProfile Profile> void opCode_LD_I_VX();    // FX55
+  template <QuirkProfile Profile> void opCode_LD_VX_I();    // FX65
+  template <QuirkProfile Profile> void opCode_PLANE();      // FN01
+  template <QuirkProfile Profile> void opCode_UNKNOWN();
 };
 } // namespace PChip8
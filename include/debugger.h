@@ -0,0 +1,144 @@
+#pragma once
+#include "chip8.h"
+#include "scheduler.h"
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace PChip8 {
+// Register index of I for register watches, after V0 to VF
+inline constexpr int REGISTER_I = VREG_COUNT;
+
+enum class StopReason : uint8_t {
+  // the requested cycles ran out, or a single step finished
+  Finished,
+  Breakpoint,
+  Watchpoint,
+  RegisterChange,
+  // only a key can change the machine, or it halted
+  WaitingForKey,
+  Halted,
+  Interrupted
+};
+
+[[nodiscard]] std::string_view stopReasonName(StopReason reason);
+
+// Why and where a run stopped
+struct DebugStop {
+  StopReason reason = StopReason::Finished;
+  // instruction that hit the breakpoint, wrote the watched byte or changed
+  // the register
+  uint16_t pc = 0;
+  // watched byte written
+  uint16_t address = 0;
+  // register that changed, REGISTER_I for I, and its values around the
+  // instruction
+  int reg = 0;
+  uint16_t oldValue = 0;
+  uint16_t newValue = 0;
+};
+
+// A register watch stops when the register changes, or only when it changes
+// to `value` if given
+struct RegisterWatch {
+  int reg = 0;
+  std::optional<uint16_t> value;
+};
+
+// Breakpoints, watchpoints and stepping on top of any engine.
+//
+// The debugger runs the machine through a Scheduler, so runs go frame by
+// frame with the timers ticked between frames and the scheduler's key
+// events, buzzer and capture applied as in any other run. While nothing is
+// armed every frame is the scheduler's usual Chip8::run() calls of the
+// selected engine, so an idle debugger costs nothing per instruction. Once
+// a breakpoint, watchpoint or register watch is set, the debugger attaches
+// itself as the Chip8's DebugHook and sees every instruction: a breakpoint
+// stops before the instruction at its address executes, a watchpoint after
+// an instruction stored to its range and a register watch after the
+// register changed.
+class Debugger : private DebugHook {
+public:
+  Debugger(Chip8 &chip8, Scheduler &scheduler);
+  ~Debugger() override;
+
+  Debugger(const Debugger &) = delete;
+  Debugger &operator=(const Debugger &) = delete;
+
+  void addBreakpoint(uint16_t address);
+  // false if there was none at address
+  bool removeBreakpoint(uint16_t address);
+  // Stop after any write to the `length` bytes from address, which wrap
+  // around from 0xFFF to 0 like every memory access
+  void addWatchpoint(uint16_t address, uint16_t length = 1);
+  bool removeWatchpoint(uint16_t address);
+  void addRegisterWatch(RegisterWatch watch);
+  bool removeRegisterWatch(int reg);
+  void clearAll();
+  [[nodiscard]] bool isArmed() const;
+
+  [[nodiscard]] std::vector<uint16_t> getBreakpoints() const;
+  [[nodiscard]] const std::vector<std::pair<uint16_t, uint16_t>> &
+  getWatchpoints() const;
+  [[nodiscard]] const std::vector<RegisterWatch> &getRegisterWatches() const;
+
+  // Run `cycles` instructions unless something armed stops it first. An
+  // instruction with a breakpoint that the last run stopped at executes
+  // without stopping again.
+  DebugStop run(uint64_t cycles);
+  // Run until something armed stops it, the machine only waits for a key
+  // or halts, or interrupt() is called
+  DebugStop resume();
+  // Execute one instruction, reported as Finished unless it hit a watch
+  DebugStop step();
+  // Make a resume() in progress stop, safe from other threads and signal
+  // handlers
+  void interrupt();
+
+  // V0 to VF, or I for REGISTER_I
+  [[nodiscard]] uint16_t getRegister(int reg) const;
+  void setRegister(int reg, uint16_t value);
+  [[nodiscard]] uint8_t peek(uint16_t address) const;
+  // Return addresses, innermost last
+  [[nodiscard]] std::span<const uint16_t> getCallStack() const;
+
+  // e.g. "D125 DRW_VX_VY x=1 y=2 n=5"
+  [[nodiscard]] static std::string disassemble(uint16_t opCode);
+  // The opcode at address
+  [[nodiscard]] uint16_t opCodeAt(uint16_t address) const;
+
+private:
+  bool beforeInstruction(uint16_t pc) override;
+  bool afterInstruction() override;
+  void memoryWritten(uint16_t address) override;
+  // Attached as the Chip8's hook exactly while something is armed
+  void updateHook();
+
+  Chip8 &chip8;
+  Scheduler &scheduler;
+
+  std::bitset<MEMORY_SIZE> breakpoints;
+  // set bits in breakpoints, so that isArmed() is cheap
+  std::size_t breakpointCount = 0;
+  // (address, length)
+  std::vector<std::pair<uint16_t, uint16_t>> watchpoints;
+  std::vector<RegisterWatch> registerWatches;
+
+  // the breakpoint the last run stopped at, which the next one steps over
+  std::optional<uint16_t> stoppedAt;
+  // why the current run stops, Finished until something armed hit
+  DebugStop stop;
+  // of the instruction executing, from beforeInstruction()
+  uint16_t instructionPC = 0;
+  std::array<uint16_t, VREG_COUNT + 1> registersBefore{};
+  // first watched byte it wrote
+  std::optional<uint16_t> watchedWrite;
+  std::atomic<bool> interrupted{false};
+};
+} // namespace PChip8
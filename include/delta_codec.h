@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace PChip8 {
+// XOR delta of a byte string against a reference of the same size, run
+// length encoded as a sequence of (unchanged run length, literal length,
+// literal XOR bytes) with both lengths as varints. Unchanged stretches are
+// skipped a word at a time, so encoding costs little more than the bytes
+// that differ. Shared by the rewind buffer and capture files.
+void encodeDelta(std::span<const uint8_t> data,
+                 std::span<const uint8_t> reference, std::vector<uint8_t> &out);
+// A literal run ends at this many unchanged bytes, shorter gaps stay inside
+// it
+inline constexpr std::size_t DELTA_MIN_ZERO_RUN = 4;
+
+// Bytes begin to end of the data
+struct DeltaRange {
+  std::size_t begin;
+  std::size_t end;
+};
+// encodeDelta when data can only differ from reference inside `ranges`,
+// sorted and at least DELTA_MIN_ZERO_RUN bytes apart, looking at nothing
+// else. The delta is the same as encodeDelta's.
+void encodeDelta(std::span<const uint8_t> data,
+                 std::span<const uint8_t> reference,
+                 std::span<const DeltaRange> ranges,
+                 std::vector<uint8_t> &out);
+// XOR a delta from encodeDelta into data, turning the reference into the
+// encoded bytes. Throws std::runtime_error if the delta runs past either.
+void applyDelta(std::span<const uint8_t> delta, std::span<uint8_t> data);
+
+// LEB128 unsigned integers, 7 bits per byte
+void putVarint(std::vector<uint8_t> &out, uint64_t value);
+// Throws std::runtime_error if the varint runs past end
+uint64_t getVarint(const uint8_t *&in, const uint8_t *end);
+} // namespace PChip8
@@ -0,0 +1,65 @@
+#pragma once
+#include "chip8.h"
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace PChip8 {
+// A key pressed or released right before the instruction at emulated `cycle`
+// (the Chip8 cycle count) executes
+struct KeyEvent {
+  uint64_t cycle;
+  uint8_t key;
+  bool pressed;
+};
+
+// Key events waiting for the cycle they apply at, in cycle order.
+//
+// The Scheduler stops its runs at every queued cycle, so an event changes
+// keyPress between the same two instructions whatever the engine, the host
+// timing or the way the cycles are split into runs. A recorded sequence of
+// events therefore replays exactly.
+class InputQueue {
+public:
+  // Queue an event after any already queued for the same cycle
+  void push(KeyEvent event);
+  // Apply every event due at or before `cycle` to chip8
+  void apply(Chip8 &chip8, uint64_t cycle) {
+    // the scheduler asks at every frame, almost always for nothing
+    if (nextCycle() <= cycle)
+      applyDue(chip8, cycle);
+  }
+  // Apply everything still queued right away, e.g. before a reset or a state
+  // load moves the cycle count
+  void flush(Chip8 &chip8);
+  void clear();
+
+  // Cycle of the earliest queued event, UINT64_MAX when there is none
+  [[nodiscard]] uint64_t nextCycle() const {
+    return pending.empty() ? std::numeric_limits<uint64_t>::max()
+                           : pending.front().cycle;
+  }
+  [[nodiscard]] bool empty() const { return pending.empty(); }
+
+private:
+  void applyDue(Chip8 &chip8, uint64_t cycle);
+
+  std::deque<KeyEvent> pending;
+};
+
+// A recorded run: the seed its random generator started from, when known,
+// and its key events in cycle order
+struct InputLog {
+  std::optional<uint64_t> seed;
+  std::vector<KeyEvent> events;
+};
+
+// Input replay files are text, an optional "seed n" first line and then one
+// "cycle key down|up" line per event with the key as a hex digit
+void saveInputLog(const std::string &fileName, const InputLog &log);
+// throws std::runtime_error if the file is missing or malformed
+[[nodiscard]] InputLog loadInputLog(const std::string &fileName);
+} // namespace PChip8
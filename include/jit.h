@@ -0,0 +1,88 @@
+#pragma once
+#include "chip8.h"
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+
+namespace PChip8 {
+// x86-64 basic-block recompiler
+//
+// A block is the longest run of straight-line instructions starting at some
+// address, optionally closed by a 1NNN jump, a 2NNN call, a 00EE return or
+// a 3XKK/4XKK/5XY0/9XY0 skip. Anything else (BNNN, DXYN, FX0A, timers,
+// keys, RNG, memory stores, ...) ends the block before it and is executed by
+// the predecoded interpreter, so guest memory is never written from
+// generated code.
+//
+// Inside a block up to eight of the V registers it uses live in host
+// registers, loaded once on entry and stored back on exit, the rest are
+// addressed off a base register. I stays in a host register, and pc is
+// folded into constants. Blocks jump straight into the next one through a
+// table of entry points, which holds an exit back to run() for addresses
+// without a compiled block, so a loop of compiled code never returns to C++
+// until the cycle budget runs out. Each block takes its length off the
+// budget on entry. When less than that is left, it runs a second copy of
+// its code that counts every instruction and stops exactly at the budget.
+class Jit {
+public:
+  Jit();
+  ~Jit();
+
+  Jit(const Jit &) = delete;
+  Jit &operator=(const Jit &) = delete;
+
+  // Execute exactly `cycles` instructions on chip8, returns the number executed
+  uint64_t run(Chip8 &chip8, uint64_t cycles);
+
+  // Drop the blocks covering address, if any
+  void invalidate(uint16_t address);
+  // Drop every compiled block
+  void flush();
+
+private:
+  // pc to continue at and budget left, returned in rax:rdx
+  struct BlockExit {
+    uint64_t pc;
+    uint64_t remaining;
+  };
+  // The trampoline at the start of the code buffer: saves the host
+  // registers blocks use, then jumps to entries[pc] with the budget in r11
+  using EnterFn = BlockExit (*)(uint8_t *V, uint16_t *I, uint64_t budget,
+                                const uint8_t *const *entries, uint64_t pc);
+
+  struct Block {
+    uint16_t length = 0; // instructions, 0 when the first one is not compiled
+    bool compiled = false;
+    // self-modifying code that keeps rewriting a block is left to the
+    // interpreter instead of being recompiled over and over
+    uint8_t invalidations = 0;
+  };
+
+  static constexpr std::size_t CODE_BUFFER_SIZE = 1 << 20;
+  static constexpr int MAX_BLOCK_LENGTH = 64;
+  static constexpr int MAX_INVALIDATIONS = 4;
+  // every pc a block can continue at: the end of one that runs to the last
+  // byte of memory, or the skip target past it, lies beyond MEMORY_MASK
+  static constexpr std::size_t ENTRY_COUNT = MEMORY_SIZE + 4;
+
+  const Block &compile(const Chip8 &chip8, uint16_t address);
+  // Change the protection of the pages holding buffer bytes offset to
+  // offset + size
+  void setWritable(std::size_t offset, std::size_t size, bool writable);
+
+  uint8_t *codeBuffer = nullptr;
+  std::size_t pageSize = 0;
+  std::size_t codeUsed = 0;
+  // the trampoline and the exit every empty entry points at, emitted once
+  EnterFn enter = nullptr;
+  const uint8_t *exitCode = nullptr;
+  std::size_t trampolineSize = 0;
+
+  std::array<Block, MEMORY_SIZE> blocks;
+  // where generated code continues at each pc, exitCode unless compiled
+  std::array<const uint8_t *, ENTRY_COUNT> entries;
+  // addresses whose bytes were translated into some live block
+  std::bitset<MEMORY_SIZE> codeMap;
+};
+} // namespace PChip8
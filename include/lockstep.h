@@ -0,0 +1,131 @@
+#pragma once
+#include "chip8.h"
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace PChip8 {
+enum class LaneStatus : uint8_t {
+  Running,
+  UnknownOpcode,
+  StackOverflow,
+  StackUnderflow,
+  // hi-res or a second bitplane, which lanes do not store
+  Unsupported
+};
+
+[[nodiscard]] std::string_view laneStatusName(LaneStatus status);
+
+// Many CHIP-8 machines running the same ROM in lockstep, with their state
+// stored as a structure of arrays.
+//
+// Each register is an array indexed by lane, so an instruction executed by
+// every lane at the same pc is one pass over contiguous bytes that the
+// compiler turns into SIMD loads, blends and stores. Every step groups the
+// running lanes by pc and executes each group under a lane mask. Once there
+// are more than MAX_GROUPS distinct pcs, the remaining lanes are stepped one
+// at a time. Stack, draw, memory and RNG instructions are always per lane.
+//
+// Memory is the ROM image shared by all lanes plus private copy-on-write
+// pages of PAGE_SIZE bytes, so a lane costs a few hundred bytes (registers,
+// stack, page table and its 256 byte packed framebuffer) until it writes to
+// memory, instead of the kilobytes of memory and decode cache of a Chip8.
+//
+// Instructions behave exactly like the Chip8 engines under the same quirk
+// profile, exportLane() hands a lane over to a Chip8 for inspection or to
+// check one against the other. Lanes keep only a lo-res, single plane
+// screen: SUPER-CHIP scrolls and 16x16 sprites run, and FN01 may select
+// plane 0 or no plane, but a lane that switches to hi-res or selects the
+// XO-CHIP second plane stops as Unsupported.
+class Lockstep {
+public:
+  static constexpr int PAGE_SIZE = 256;
+  static constexpr int PAGE_COUNT = MEMORY_SIZE / PAGE_SIZE;
+  static constexpr int MAX_GROUPS = 8;
+
+  // Lane l draws its random bytes from seed + l. Throws std::runtime_error
+  // if the ROM does not fit.
+  Lockstep(std::span<const uint8_t> romData, int laneCount, uint64_t seed = 0,
+           QuirkProfile quirks = DEFAULT_QUIRKS);
+  ~Lockstep();
+
+  // Execute up to `cycles` instructions on every running lane, returns the
+  // number of steps taken (fewer once every lane has stopped)
+  uint64_t run(uint64_t cycles);
+  // Decrement the delay and sound timers of every running lane
+  void tickTimers();
+
+  // Bit k set for key k held down
+  void setKeys(int lane, uint16_t keyMask);
+  void seedRandom(int lane, uint64_t seed);
+
+  [[nodiscard]] int getLaneCount() const;
+  [[nodiscard]] int getRunningLaneCount() const;
+  [[nodiscard]] LaneStatus getStatus(int lane) const;
+  [[nodiscard]] uint16_t getPC(int lane) const;
+  [[nodiscard]] uint64_t getCycleCount(int lane) const;
+  [[nodiscard]] uint64_t displayHash(int lane) const;
+  [[nodiscard]] std::size_t getPrivatePageCount() const;
+
+  // Copy the full state of a lane into a Chip8
+  void exportLane(int lane, Chip8 &chip8) const;
+
+private:
+  static_assert(DISPLAY_WIDTH == 64, "lanes store one word per display row");
+
+  template <QuirkProfile Profile> uint64_t runWithQuirks(uint64_t cycles);
+  template <QuirkProfile Profile> void step();
+  // Execute one instruction on every lane in [begin, end) with mask set
+  template <QuirkProfile Profile>
+  void execute(const Instruction &instruction, int begin, int end);
+  void halt(int lane, LaneStatus reason);
+
+  uint8_t *reg(int index) { return &V[index * laneCount]; }
+  uint8_t read(int lane, uint16_t address) const {
+    address &= MEMORY_MASK;
+    return pages[lane * PAGE_COUNT + address / PAGE_SIZE][address % PAGE_SIZE];
+  }
+  void write(int lane, uint16_t address, uint8_t value);
+  // `wide` draws DXY0 as a 16x16 sprite
+  void drawSprite(int lane, const Instruction &instruction, bool wrap,
+                  bool wide);
+
+  QuirkProfile quirks;
+  int laneCount;
+  int runningLanes;
+
+  // per lane, register r of lane l at V[r * laneCount + l]
+  std::vector<uint8_t> V;
+  std::vector<uint16_t> I;
+  std::vector<uint16_t> pc;
+  std::vector<uint8_t> delayTimer;
+  std::vector<uint8_t> soundTimer;
+  std::vector<uint8_t> sp;
+  // entry d of lane l at stack[d * laneCount + l]
+  std::vector<uint16_t> stack;
+  std::vector<uint64_t> cycleCount;
+  std::vector<uint16_t> keys;
+  std::vector<Rng> rng;
+  std::vector<LaneStatus> status;
+  // 0xFF while running, so it can be ANDed straight into lane masks
+  std::vector<uint8_t> running;
+  // FN01 mask, 1 or 0 since lanes only store plane 0
+  std::vector<uint8_t> planeMask;
+  // row y of lane l at frames[l * DISPLAY_HEIGHT + y]
+  std::vector<uint64_t> frames;
+
+  // shared ROM image, per lane page tables and the pages copied on write,
+  // bit p of privatePages[l] set once page p of lane l is private
+  std::array<uint8_t, MEMORY_SIZE> image{0};
+  std::vector<uint8_t *> pages;
+  std::vector<uint16_t> privatePages;
+  std::deque<std::array<uint8_t, PAGE_SIZE>> pagePool;
+
+  // lanes not yet executed in the current step, and the current group
+  std::vector<uint8_t> pending;
+  std::vector<uint8_t> mask;
+};
+} // namespace PChip8
@@ -0,0 +1,220 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+namespace PChip8 {
+// Every instruction the interpreter understands, in a fixed order.
+//
+// X(name, pattern) is expanded into the Op enum, the opcode name table and the
+// handler/label tables of the dispatch engines, so they can never disagree.
+#define PCHIP8_OPCODES(X)                                                      \
+  X(SCD, "00CN")                                                               \
+  X(SCU, "00DN")                                                               \
+  X(CLS, "00E0")                                                               \
+  X(RET, "00EE")                                                               \
+  X(SCR, "00FB")                                                               \
+  X(SCL, "00FC")                                                               \
+  X(EXIT, "00FD")                                                              \
+  X(LOW, "00FE")                                                               \
+  X(HIGH, "00FF")                                                              \
+  X(JP, "1NNN")                                                                \
+  X(CALL, "2NNN")                                                              \
+  X(SE_VX_KK, "3XKK")                                                          \
+  X(SNE_VX_KK, "4XKK")                                                         \
+  X(SE_VX_VY, "5XY0")                                                          \
+  X(LD_VX_KK, "6XKK")                                                          \
+  X(ADD_VX_KK, "7XKK")                                                         \
+  X(LD_VX_VY, "8XY0")                                                          \
+  X(OR_VX_VY, "8XY1")                                                          \
+  X(AND_VX_VY, "8XY2")                                                         \
+  X(XOR_VX_VY, "8XY3")                                                         \
+  X(ADD_VX_VY, "8XY4")                                                         \
+  X(SUB_VX_VY, "8XY5")                                                         \
+  X(SHR_VX, "8XY6")                                                            \
+  X(SUBN_VX_VY, "8XY7")                                                        \
+  X(SHL_VX, "8XYE")                                                            \
+  X(SNE_VX_VY, "9XY0")                                                         \
+  X(LD_I, "ANNN")                                                              \
+  X(JP_V0, "BNNN")                                                             \
+  X(RND_VX, "CXKK")                                                            \
+  X(DRW_VX_VY, "DXYN")                                                         \
+  X(SKP_VX, "EX9E")                                                            \
+  X(SKNP_VX, "EXA1")                                                           \
+  X(LD_VX_DT, "FX07")                                                          \
+  X(LD_VX_K, "FX0A")                                                           \
+  X(LD_DT_VX, "FX15")                                                          \
+  X(LD_ST_VX, "FX18")                                                          \
+  X(ADD_I_VX, "FX1E")                                                          \
+  X(LD_F_VX, "FX29")                                                           \
+  X(LD_B_VX, "FX33")                                                           \
+  X(LD_I_VX, "FX55")                                                           \
+  X(LD_VX_I, "FX65")                                                           \
+  X(PLANE, "FN01")                                                             \
+  X(UNKNOWN, "????")
+
+enum class Op : uint8_t {
+#define PCHIP8_OP_ENUM(name, pattern) name,
+  PCHIP8_OPCODES(PCHIP8_OP_ENUM)
+#undef PCHIP8_OP_ENUM
+};
+
+inline constexpr int OP_COUNT = static_cast<int>(Op::UNKNOWN) + 1;
+
+inline constexpr std::array<std::string_view, OP_COUNT> OP_NAMES = {
+#define PCHIP8_OP_NAME(name, pattern) #name,
+    PCHIP8_OPCODES(PCHIP8_OP_NAME)
+#undef PCHIP8_OP_NAME
+};
+
+inline constexpr std::array<std::string_view, OP_COUNT> OP_PATTERNS = {
+#define PCHIP8_OP_PATTERN(name, pattern) pattern,
+    PCHIP8_OPCODES(PCHIP8_OP_PATTERN)
+#undef PCHIP8_OP_PATTERN
+};
+
+// A fetched opcode with its operand fields already extracted
+struct Instruction {
+  uint16_t opCode{0};
+  uint16_t nnn{0}; // lowest 12 bits
+  uint8_t x{0};    // lower nibble of the high byte
+  uint8_t y{0};    // upper nibble of the low byte
+  uint8_t n{0};    // lowest 4 bits
+  uint8_t kk{0};   // lowest 8 bits
+};
+
+constexpr Instruction decodeInstruction(uint16_t opCode) {
+  return Instruction{
+      opCode,
+      static_cast<uint16_t>(opCode & 0x0FFF),
+      static_cast<uint8_t>((opCode & 0x0F00) >> 8),
+      static_cast<uint8_t>((opCode & 0x00F0) >> 4),
+      static_cast<uint8_t>(opCode & 0x000F),
+      static_cast<uint8_t>(opCode & 0x00FF),
+  };
+}
+
+// Decode a raw opcode the same way the switch engine does. The SUPER-CHIP
+// and XO-CHIP instructions always decode, their handlers reject them under
+// the profiles that lack them.
+constexpr Op decodeOp(uint16_t opCode) {
+  switch (opCode & 0xF000) {
+  case 0x0000:
+    switch (opCode & 0x0FF0) {
+    case 0x00C0:
+      return Op::SCD;
+    case 0x00D0:
+      return Op::SCU;
+    case 0x00E0:
+      switch (opCode & 0x000F) {
+      case 0x0000:
+        return Op::CLS;
+      case 0x000E:
+        return Op::RET;
+      default:
+        return Op::UNKNOWN;
+      }
+    case 0x00F0:
+      switch (opCode & 0x000F) {
+      case 0x000B:
+        return Op::SCR;
+      case 0x000C:
+        return Op::SCL;
+      case 0x000D:
+        return Op::EXIT;
+      case 0x000E:
+        return Op::LOW;
+      case 0x000F:
+        return Op::HIGH;
+      default:
+        return Op::UNKNOWN;
+      }
+    default:
+      return Op::UNKNOWN;
+    }
+  case 0x1000:
+    return Op::JP;
+  case 0x2000:
+    return Op::CALL;
+  case 0x3000:
+    return Op::SE_VX_KK;
+  case 0x4000:
+    return Op::SNE_VX_KK;
+  case 0x5000:
+    return Op::SE_VX_VY;
+  case 0x6000:
+    return Op::LD_VX_KK;
+  case 0x7000:
+    return Op::ADD_VX_KK;
+  case 0x8000:
+    switch (opCode & 0x000F) {
+    case 0x0000:
+      return Op::LD_VX_VY;
+    case 0x0001:
+      return Op::OR_VX_VY;
+    case 0x0002:
+      return Op::AND_VX_VY;
+    case 0x0003:
+      return Op::XOR_VX_VY;
+    case 0x0004:
+      return Op::ADD_VX_VY;
+    case 0x0005:
+      return Op::SUB_VX_VY;
+    case 0x0006:
+      return Op::SHR_VX;
+    case 0x0007:
+      return Op::SUBN_VX_VY;
+    case 0x000E:
+      return Op::SHL_VX;
+    default:
+      return Op::UNKNOWN;
+    }
+  case 0x9000:
+    return Op::SNE_VX_VY;
+  case 0xA000:
+    return Op::LD_I;
+  case 0xB000:
+    return Op::JP_V0;
+  case 0xC000:
+    return Op::RND_VX;
+  case 0xD000:
+    return Op::DRW_VX_VY;
+  case 0xE000:
+    switch (opCode & 0x00FF) {
+    case 0x009E:
+      return Op::SKP_VX;
+    case 0x00A1:
+      return Op::SKNP_VX;
+    default:
+      return Op::UNKNOWN;
+    }
+  case 0xF000:
+    switch (opCode & 0x00FF) {
+    case 0x0001:
+      return Op::PLANE;
+    case 0x0007:
+      return Op::LD_VX_DT;
+    case 0x000A:
+      return Op::LD_VX_K;
+    case 0x0015:
+      return Op::LD_DT_VX;
+    case 0x0018:
+      return Op::LD_ST_VX;
+    case 0x001E:
+      return Op::ADD_I_VX;
+    case 0x0029:
+      return Op::LD_F_VX;
+    case 0x0033:
+      return Op::LD_B_VX;
+    case 0x0055:
+      return Op::LD_I_VX;
+    case 0x0065:
+      return Op::LD_VX_I;
+    default:
+      return Op::UNKNOWN;
+    }
+  default:
+    return Op::UNKNOWN;
+  }
+}
+} // namespace PChip8
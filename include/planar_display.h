@@ -0,0 +1,126 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <span>
+
+namespace PChip8 {
+// CHIP-8 screen
+inline constexpr int DISPLAY_WIDTH = 64;
+inline constexpr int DISPLAY_HEIGHT = 32;
+// SUPER-CHIP and XO-CHIP hi-res screen
+inline constexpr int HIRES_WIDTH = 128;
+inline constexpr int HIRES_HEIGHT = 64;
+// XO-CHIP bitplanes
+inline constexpr int PLANE_COUNT = 2;
+
+// The screen of a CHIP-8, SUPER-CHIP or XO-CHIP machine: 64x32 pixels, or
+// 128x64 in hi-res mode, in up to two bitplanes.
+//
+// Every plane is packed 64 pixels per uint64_t with the leftmost pixel in
+// the most significant bit, and laid out for the current resolution: one
+// word per row in lo-res, two in hi-res. A sprite row lands with a shift
+// and XOR per word it touches, vertical scrolls move whole rows and
+// horizontal ones shift each row carrying bits across its words, so no
+// operation ever works pixel by pixel.
+class PlanarDisplay {
+public:
+  static constexpr int MAX_WORDS = HIRES_WIDTH / 64 * HIRES_HEIGHT;
+
+  [[nodiscard]] bool isHires() const { return hires; }
+  [[nodiscard]] int getWidth() const { return width; }
+  [[nodiscard]] int getHeight() const { return height; }
+  [[nodiscard]] int getWordsPerRow() const { return wordsPerRow; }
+  // Switch resolution, which clears every plane
+  void setHires(bool enable);
+
+  // Planes that draws, clears and scrolls apply to, bit p for plane p
+  [[nodiscard]] uint8_t getPlaneMask() const { return planeMask; }
+  void setPlaneMask(uint8_t mask);
+
+  // XOR a sprite row of up to 16 pixels (MSB leftmost, 8 pixel sprites in
+  // the high byte) onto a plane. Pixels past the right or bottom edge are
+  // clipped, or with `wrap` drawn from the opposite edge. Returns true if any
+  // lit pixel was erased.
+  bool drawSpriteRow(int plane, unsigned int xCoord, unsigned int yCoord,
+                     uint16_t spriteRow, bool wrap = false) {
+    if (wrap) {
+      xCoord %= width;
+      yCoord %= height;
+    } else if (xCoord >= static_cast<unsigned int>(width) ||
+               yCoord >= static_cast<unsigned int>(height)) {
+      return false;
+    }
+
+    unsigned int wordIndex = xCoord / 64;
+    unsigned int offset = xCoord % 64;
+    uint64_t *row = &planes[plane][yCoord * wordsPerRow];
+    dirtyRows |= uint64_t{1} << yCoord;
+    usedPlanes |= 1 << plane;
+
+    // whatever falls off bit 0 spills into the next word, or at the right
+    // edge is clipped or wraps to the first
+    uint64_t bits = (uint64_t{spriteRow} << 48) >> offset;
+    bool collision = (row[wordIndex] & bits) != 0;
+    row[wordIndex] ^= bits;
+
+    if (offset > 48) {
+      unsigned int nextWord = wordIndex + 1 < wordsPerRow ? wordIndex + 1 : 0;
+      if (nextWord != 0 || wrap) {
+        uint64_t spill = uint64_t{spriteRow} << (112 - offset);
+        collision |= (row[nextWord] & spill) != 0;
+        row[nextWord] ^= spill;
+      }
+    }
+    return collision;
+  }
+
+  // Clear the selected planes
+  void clear();
+  // Back to a blank lo-res screen with only plane 0 selected
+  void reset();
+
+  // Scroll the selected planes by whole pixels of the current resolution,
+  // pixels scrolled in are unlit
+  void scrollDown(int pixels);
+  void scrollUp(int pixels);
+  void scrollRight(int pixels);
+  void scrollLeft(int pixels);
+
+  // The rows of a plane at the current resolution, getWordsPerRow() words
+  // each
+  [[nodiscard]] std::span<const uint64_t> getRows(int plane = 0) const;
+  // Replace the rows of a plane at the current resolution, e.g. when loading
+  // a save state
+  void setRows(int plane, std::span<const uint64_t> rows);
+  // Whether any pixel of the plane is lit
+  [[nodiscard]] bool isLit(int plane) const;
+  // Whether the plane was drawn to since it was last cleared, which unlike
+  // isLit() costs nothing, but stays true if the drawing was erased again
+  [[nodiscard]] bool isPlaneUsed(int plane) const {
+    return usedPlanes >> plane & 1;
+  }
+
+  // 64-bit FNV-1a over plane 0, then plane 1 if anything is lit on it. A
+  // lo-res single plane screen hashes as its 32 row words alone.
+  [[nodiscard]] uint64_t hash() const;
+
+  // Rows written to since the last call in any plane, bit y set for row y.
+  // A clear, scroll or resolution change reports every row. The display
+  // keeps no copy of what was shown, so a row drawn back to its old pixels
+  // is reported too, and a frontend that cares compares against its own.
+  [[nodiscard]] uint64_t takeDirtyRows();
+
+private:
+  bool hires = false;
+  int width = DISPLAY_WIDTH;
+  int height = DISPLAY_HEIGHT;
+  unsigned int wordsPerRow = DISPLAY_WIDTH / 64;
+  uint8_t planeMask = 1;
+  std::array<std::array<uint64_t, MAX_WORDS>, PLANE_COUNT> planes{};
+
+  // rows touched since takeDirtyRows
+  uint64_t dirtyRows = ~uint64_t{0};
+  // bit p while plane p may have lit pixels
+  uint8_t usedPlanes = 0;
+};
+} // namespace PChip8
@@ -0,0 +1,61 @@
+#pragma once
+#include "opcodes.h"
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace PChip8 {
+// Execution profile collected by builds with PCHIP8_INSTRUMENTATION.
+//
+// Without that define no engine calls record() and Chip8 does not even hold
+// a Profile, so the hot loops are exactly the uninstrumented ones.
+struct Profile {
+  static constexpr int ADDRESS_COUNT = 4096;
+
+  std::array<uint64_t, OP_COUNT> opCounts{};
+  // skips taken per opcode, only the skip instructions are ever non-zero
+  std::array<uint64_t, OP_COUNT> skipsTaken{};
+  // instructions executed from each address
+  std::array<uint64_t, ADDRESS_COUNT> pcHeatmap{};
+  uint64_t spriteRows = 0;
+
+  // One executed instruction, `address` is where it was fetched from and
+  // `nextPc` where execution continues
+  void record(Op op, const Instruction &instruction, uint16_t address,
+              uint16_t nextPc) {
+    ++opCounts[static_cast<int>(op)];
+    ++pcHeatmap[address % ADDRESS_COUNT];
+
+    switch (op) {
+    case Op::SE_VX_KK:
+    case Op::SNE_VX_KK:
+    case Op::SE_VX_VY:
+    case Op::SNE_VX_VY:
+    case Op::SKP_VX:
+    case Op::SKNP_VX:
+      skipsTaken[static_cast<int>(op)] += nextPc == address + 4;
+      break;
+    case Op::DRW_VX_VY:
+      spriteRows += instruction.n;
+      break;
+    default:
+      break;
+    }
+  }
+
+  void clear();
+  void merge(const Profile &other);
+
+  [[nodiscard]] uint64_t instructions() const;
+  // fraction of executed skip instructions that skipped
+  [[nodiscard]] double skipTakenRatio() const;
+
+  // One row per opcode, then one per executed address
+  void writeCsv(std::ostream &out) const;
+  void writeJson(std::ostream &out) const;
+  // CSV when the name ends in .csv, JSON otherwise, throws
+  // std::runtime_error if the file cannot be written
+  void save(const std::string &fileName) const;
+};
+} // namespace PChip8
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+
+namespace PChip8 {
+struct Palette {
+  uint32_t on = 0xFFFFFFFF;
+  uint32_t off = 0xFF000000;
+  // XO-CHIP pixels lit on plane 1 only, and on both planes
+  uint32_t plane2 = 0xFFAAAAAA;
+  uint32_t both = 0xFF555555;
+};
+
+// Expand a packed 1-bit framebuffer (rows of width / 64 uint64_t words, MSB is
+// the leftmost pixel) into ARGB8888, each pixel becoming a scale x scale block.
+// dstPitch is in bytes, as returned by SDL_LockTexture.
+using ExpandKernel = void (*)(const uint64_t *rows, int width, int height,
+                              uint32_t *dst, int dstPitch, int scale,
+                              Palette palette);
+
+enum class KernelIsa { Scalar, SSE2, AVX2 };
+
+[[nodiscard]] std::string_view kernelName(KernelIsa isa);
+[[nodiscard]] bool kernelSupported(KernelIsa isa);
+// nullptr if the kernel was not built for this target
+[[nodiscard]] ExpandKernel expandKernel(KernelIsa isa);
+// Best kernel the running CPU supports
+[[nodiscard]] ExpandKernel selectExpandKernel();
+
+// Expand two planes laid out as for ExpandKernel, a pixel taking the off, on,
+// plane2 or both colour for plane bits 00, 01, 10 and 11
+using ExpandPlanesKernel = void (*)(const uint64_t *plane0,
+                                    const uint64_t *plane1, int width,
+                                    int height, uint32_t *dst, int dstPitch,
+                                    int scale, Palette palette);
+
+// nullptr if the kernel was not built for this target
+[[nodiscard]] ExpandPlanesKernel expandPlanesKernel(KernelIsa isa);
+[[nodiscard]] ExpandPlanesKernel selectExpandPlanesKernel();
+} // namespace PChip8
@@ -0,0 +1,60 @@
+#pragma once
+#include "chip8.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace PChip8 {
+struct RewindConfig {
+  // upper bound on the encoded snapshots kept, oldest frames are dropped
+  std::size_t capacityBytes = 4 * 1024 * 1024;
+  // one full snapshot every this many frames, the rest are deltas against it
+  uint32_t keyframeInterval = 60;
+};
+
+// In-memory history of per-frame save states for stepping backwards.
+//
+// Every capture is XORed against the latest keyframe and the result is run
+// length encoded, so a frame costs little more than the bytes that changed
+// since the keyframe (registers, timers, a few framebuffer rows). Keyframes
+// use the same encoding against an all-zero state, which mostly leaves the
+// ROM. Any frame is restored from its keyframe plus a single delta, and
+// whole keyframe groups are dropped from the front once over capacity.
+class RewindBuffer {
+public:
+  explicit RewindBuffer(RewindConfig config = {});
+
+  // Record the state at the end of a frame
+  void capture(const Chip8 &chip8);
+  // Drop the newest frame, which is the machine's current state, and
+  // restore the one captured before it. Returns false, leaving the machine
+  // alone, when there is no earlier frame.
+  bool rewind(Chip8 &chip8);
+  void clear();
+
+  [[nodiscard]] std::size_t getFrameCount() const;
+  [[nodiscard]] std::size_t getSizeBytes() const;
+
+private:
+  struct Entry {
+    bool keyframe;
+    std::vector<uint8_t> delta;
+  };
+
+  void dropOldestGroup();
+
+  RewindConfig config;
+  std::deque<Entry> entries;
+  std::size_t sizeBytes = 0;
+
+  // the keyframe new captures are encoded against, and how many frames
+  // were captured since it (keyframeInterval forces a new one)
+  SaveState keyframe{};
+  uint32_t framesSinceKeyframe;
+
+  // scratch space, kept around to avoid an allocation per frame
+  SaveState snapshot{};
+  std::vector<uint8_t> encoded;
+};
+} // namespace PChip8
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+
+namespace PChip8 {
+// xorshift64* generator behind CXKK.
+//
+// One per machine, so parallel machines never share or lock anything and a
+// seed fixes every random byte of a run. The whole state is one nonzero
+// word, which goes into save states.
+class Rng {
+public:
+  explicit Rng(uint64_t seed = 0) { setSeed(seed); }
+
+  void setSeed(uint64_t seed) {
+    // splitmix64, so nearby seeds start far apart
+    uint64_t z = seed + 0x9E3779B97F4A7C15;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    setState(z ^ (z >> 31));
+  }
+
+  uint8_t nextByte() {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    // the high bits of the product are the well mixed ones
+    return (state * 0x2545F4914F6CDD1D) >> 56;
+  }
+
+  [[nodiscard]] uint64_t getState() const { return state; }
+  // zero is the one state xorshift never leaves, it is replaced
+  void setState(uint64_t newState) {
+    state = newState != 0 ? newState : 0x9E3779B97F4A7C15;
+  }
+
+private:
+  uint64_t state;
+};
+} // namespace PChip8
@@ -0,0 +1,111 @@
+#pragma once
+#include "chip8.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace PChip8 {
+// largest ROM that fits between START_EXEC_LOCATION and the end of memory
+inline constexpr std::size_t MAX_ROM_SIZE = MEMORY_SIZE - START_EXEC_LOCATION;
+
+// 64-bit FNV-1a of a ROM's bytes, the hash RomImage and RomPack use
+[[nodiscard]] uint64_t romHash(std::span<const uint8_t> bytes);
+
+// A whole file, read only, memory-mapped where the platform allows and read
+// into memory elsewhere
+class MappedFile {
+public:
+  // throws std::runtime_error if the file is missing or unreadable
+  [[nodiscard]] static std::shared_ptr<const MappedFile>
+  open(const std::string &fileName);
+
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  [[nodiscard]] std::span<const uint8_t> getBytes() const;
+
+private:
+  MappedFile() = default;
+
+  void *mapping = nullptr;
+  std::size_t mappingSize = 0;
+  std::vector<uint8_t> owned;
+  std::span<const uint8_t> bytes;
+};
+
+// A ROM loaded once and never modified afterwards: its bytes, mapped straight
+// from the file where the platform allows, their hash, and the whole memory a
+// machine starts with (font and ROM in place), so loading or resetting a
+// machine is a single copy.
+class RomImage {
+public:
+  // throws std::runtime_error if the file is missing, unreadable or too large
+  [[nodiscard]] static std::shared_ptr<const RomImage>
+  fromFile(const std::string &fileName);
+  // throws std::runtime_error if the ROM is too large
+  [[nodiscard]] static std::shared_ptr<const RomImage>
+  fromBytes(std::span<const uint8_t> romData, std::string name = {});
+  // An image over bytes that stay where they are, typically inside a mapped
+  // file, which `owner` keeps alive. Throws std::runtime_error if the ROM is
+  // too large.
+  [[nodiscard]] static std::shared_ptr<const RomImage>
+  fromShared(std::span<const uint8_t> romData,
+             std::shared_ptr<const void> owner, std::string name = {});
+
+  RomImage(const RomImage &) = delete;
+  RomImage &operator=(const RomImage &) = delete;
+
+  [[nodiscard]] std::span<const uint8_t> getBytes() const;
+  // romHash of the bytes
+  [[nodiscard]] uint64_t getHash() const;
+  // file the image came from, empty for one made from bytes
+  [[nodiscard]] const std::string &getName() const;
+  [[nodiscard]] const std::array<uint8_t, MEMORY_SIZE> &getMemory() const;
+
+private:
+  RomImage() = default;
+  void build(std::span<const uint8_t> romData);
+
+  std::string name;
+  // whatever holds the bytes: a mapped file, a pack or a copy
+  std::shared_ptr<const void> owner;
+
+  std::span<const uint8_t> bytes;
+  uint64_t hash = 0;
+  std::array<uint8_t, MEMORY_SIZE> memory{};
+};
+
+// ROM images by file name and content hash.
+//
+// Each file is read from disk once, later loads of the same name are a map
+// lookup, and files with identical contents share one image. Safe to use from
+// several threads.
+class RomCache {
+public:
+  // The cache behind Chip8::loadROM(fileName)
+  [[nodiscard]] static RomCache &shared();
+
+  // throws std::runtime_error like RomImage::fromFile
+  [[nodiscard]] std::shared_ptr<const RomImage> load(const std::string &fileName);
+  // nullptr when no cached ROM has that hash
+  [[nodiscard]] std::shared_ptr<const RomImage> find(uint64_t hash) const;
+
+  // Forget every image, e.g. to pick up ROM files changed on disk. Machines
+  // keep the images they loaded alive.
+  void clear();
+  // number of distinct images
+  [[nodiscard]] std::size_t size() const;
+
+private:
+  mutable std::mutex mutex;
+  std::unordered_map<std::string, std::shared_ptr<const RomImage>> byName;
+  std::unordered_map<uint64_t, std::shared_ptr<const RomImage>> byHash;
+};
+} // namespace PChip8
@@ -0,0 +1,85 @@
+#pragma once
+#include "chip8.h"
+#include "rom_cache.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace PChip8 {
+// How a ROM wants to be run, stored next to it in a pack
+struct RomSettings {
+  // 0 keeps the runner's instructions per frame
+  uint32_t instructionsPerFrame = 0;
+  QuirkProfile quirks = DEFAULT_QUIRKS;
+  // CHIP-8 key pressed by each keypad key, identity by default
+  std::array<uint8_t, KEY_COUNT> keyMap = [] {
+    std::array<uint8_t, KEY_COUNT> keys{};
+    for (int key = 0; key < KEY_COUNT; ++key) {
+      keys[key] = key;
+    }
+    return keys;
+  }();
+
+  bool operator==(const RomSettings &) const = default;
+};
+
+// A ROM to put in a pack
+struct RomPackEntry {
+  std::string name;
+  std::vector<uint8_t> bytes;
+  RomSettings settings;
+};
+
+// Many ROMs in one file.
+//
+// A pack is a header, an index entry per ROM (name, hash, offset, size and
+// settings) sorted by name, the names and then the ROM bytes back to back,
+// all little-endian. Opening one is a single mmap and a pass over the index,
+// and its images point into the mapping, so running thousands of ROMs costs
+// no per-ROM file system work.
+class RomPack {
+public:
+  // throws std::runtime_error if the file is missing or not a valid pack
+  [[nodiscard]] static std::shared_ptr<const RomPack>
+  open(const std::string &fileName);
+  // throws std::runtime_error on duplicate names, a ROM that is too large or
+  // a failed write. Identical ROMs are stored once.
+  static void write(const std::string &fileName,
+                    std::vector<RomPackEntry> entries);
+
+  [[nodiscard]] std::size_t size() const;
+  [[nodiscard]] std::string_view getName(std::size_t index) const;
+  [[nodiscard]] uint64_t getHash(std::size_t index) const;
+  [[nodiscard]] const RomSettings &getSettings(std::size_t index) const;
+  [[nodiscard]] std::span<const uint8_t> getBytes(std::size_t index) const;
+  // An image over the pack's bytes, which keeps the file mapped. Throws
+  // std::runtime_error if the bytes do not match the hash in the index.
+  [[nodiscard]] std::shared_ptr<const RomImage>
+  getImage(std::size_t index) const;
+
+  // index of the ROM with that name
+  [[nodiscard]] std::optional<std::size_t> find(std::string_view name) const;
+
+private:
+  struct Entry {
+    std::string_view name;
+    uint64_t hash;
+    std::span<const uint8_t> bytes;
+    RomSettings settings;
+  };
+
+  RomPack() = default;
+
+  std::shared_ptr<const MappedFile> file;
+  std::vector<Entry> entries;
+};
+
+// Whether fileName names a ROM pack rather than a single ROM, by extension
+[[nodiscard]] bool isRomPack(std::string_view fileName);
+} // namespace PChip8
@@ -0,0 +1,113 @@
+#pragma once
+#include "chip8.h"
+#include "input.h"
+#include <chrono>
+#include <cstdint>
+
+namespace PChip8 {
+class Buzzer;
+class FrameCapture;
+
+inline constexpr int TIMER_HZ = 60;
+
+struct SchedulerConfig {
+  // instructions executed per 1/60 s frame, 12 is roughly 700 IPS
+  uint32_t instructionsPerFrame = 12;
+  // run frames back to back instead of pacing them to wall-clock time
+  bool turbo = false;
+};
+
+// Drives a Chip8 in fixed frames of emulated time.
+//
+// Each frame runs instructionsPerFrame instructions and then ticks the delay
+// and sound timers once, so the timers advance at exactly 60 Hz of emulated
+// time no matter how fast the host is. In paced mode every frame ends by
+// waiting for its deadline on the monotonic clock: the thread sleeps until
+// shortly before it and spins the rest of the way, which keeps frames
+// accurate to well under a millisecond without a syscall per instruction.
+//
+// Frames where the program only spins on FX0A or a delay timer polling loop
+// are fast-forwarded instead of executed and paced with a plain sleep. Once
+// nothing but a key can change the machine, waitingForInput() tells the
+// caller it may block until input arrives.
+//
+// Key events queued on getInput() are applied at their exact cycles, runs
+// are split wherever one falls. cycleAt() turns a host timestamp into the
+// matching cycle of the frame about to run: a key seen during the last frame
+// of wall-clock time lands at the same offset into the next one, so input
+// always takes effect one frame after it happened, with sub-frame precision.
+//
+// With a FrameCapture attached, every frame end hands it the display, and
+// with a Buzzer the buzzer changes the frame logged. A DebugHook on the
+// Chip8 can end a run before its frame does, the frame then resumes where
+// it stopped.
+class Scheduler {
+public:
+  Scheduler(Chip8 &chip8, SchedulerConfig config = {});
+
+  // Run the rest of the current frame, tick the timers and (when paced)
+  // wait for the frame deadline
+  void runFrame();
+  // Run exactly `cycles` instructions, ticking the timers at every frame
+  // boundary crossed, never paces. Returns the number run, fewer only when
+  // a debug hook stopped the machine.
+  uint64_t runCycles(uint64_t cycles);
+  // Let one frame of wall-clock time pass without running anything (when
+  // paced), e.g. while stepping backwards through a rewind buffer
+  void idleFrame();
+
+  // Restart pacing from now, e.g. after a reset or a pause
+  void resync();
+
+  // True when the machine is idle with both timers stopped, so it stays
+  // exactly as it is until a key changes
+  [[nodiscard]] bool waitingForInput() const;
+  // After blocking while waitingForInput(), account for the frames of
+  // wall-clock time that passed and resume pacing from now
+  void resumeAfterWait();
+
+  // Cycle of the frame about to run that corresponds to host time `time`,
+  // the current cycle when running turbo
+  [[nodiscard]] uint64_t cycleAt(std::chrono::steady_clock::time_point time) const;
+  [[nodiscard]] InputQueue &getInput();
+
+  void setConfig(SchedulerConfig newConfig);
+  [[nodiscard]] const SchedulerConfig &getConfig() const;
+  [[nodiscard]] uint64_t getFrameCount() const;
+  // Instructions run of the current frame, 0 between frames
+  [[nodiscard]] uint32_t getCyclesIntoFrame() const;
+  // Capture every frame from now on, nullptr to stop. The scheduler does not
+  // own the capture.
+  void setCapture(FrameCapture *newCapture);
+  // Send the buzzer to `newAudio` from now on, nullptr to stop. The
+  // scheduler does not own it.
+  void setAudio(Buzzer *newAudio);
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  // sleep granularity margin, the last stretch before a deadline is spun
+  static constexpr auto SPIN_MARGIN = std::chrono::microseconds(1500);
+  // when this many frames behind (host stalled), drop them instead of
+  // running a burst to catch up
+  static constexpr int MAX_FRAMES_BEHIND = 5;
+
+  // Run `cycles` instructions without crossing a frame boundary, stopping
+  // at every queued key event to apply it. Returns the number run.
+  uint64_t advance(uint64_t cycles, bool idle);
+  void endFrame();
+  void waitForDeadline(bool idle);
+
+  Chip8 &chip8;
+  SchedulerConfig config;
+  InputQueue input;
+
+  uint32_t cyclesIntoFrame = 0;
+  uint64_t frameCount = 0;
+  FrameCapture *capture = nullptr;
+  Buzzer *audio = nullptr;
+
+  Clock::duration frameDuration;
+  Clock::time_point deadline;
+};
+} // namespace PChip8
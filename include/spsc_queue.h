@@ -0,0 +1,32 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Lock-free bounded single producer / single consumer ring buffer.
+//
+// Head and tail live on separate cache lines so the two threads do not
+// bounce a line back and forth on every push and pop.
+template<typename T, std::size_t capacity>
+class SpscQueue {
+public:
+  static_assert((capacity & (capacity - 1)) == 0, "capacity must be a power of 2");
+
+  SpscQueue();
+  ~SpscQueue();
+
+  // Producer side, false when the queue is full
+  bool push(const T &value);
+  // Consumer side, false when the queue is empty
+  bool pop(T &value);
+  [[nodiscard]] bool empty() const;
+
+private:
+  static constexpr std::size_t CACHE_LINE = 64;
+
+  alignas(CACHE_LINE) std::atomic<std::size_t> head {0}; // next slot to pop
+  alignas(CACHE_LINE) std::atomic<std::size_t> tail {0}; // next slot to push
+  alignas(CACHE_LINE) std::array<T, capacity> items {};
+};
+
+#include "../src/spsc_queue.cpp"
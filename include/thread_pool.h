@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace PChip8 {
+// Fixed-size work-stealing thread pool.
+//
+// Every worker owns a task deque. Workers pop from the back of their own deque
+// and, when it runs dry, steal from the front of the other workers' deques, so
+// a few long-running ROMs never leave the rest of the cores idle.
+class ThreadPool {
+public:
+  explicit ThreadPool(unsigned int workerCount);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void submit(std::function<void()> task);
+  // Block until every submitted task has finished
+  void wait();
+
+  [[nodiscard]] unsigned int getWorkerCount() const;
+
+private:
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  void workerLoop(unsigned int id);
+  bool popTask(unsigned int id, std::function<void()> &task);
+  bool stealTask(unsigned int id, std::function<void()> &task);
+
+  std::vector<WorkQueue> queues;
+  std::vector<std::thread> workers;
+
+  std::mutex stateMutex;
+  std::condition_variable workAvailable;
+  std::condition_variable allDone;
+  std::size_t queuedTasks{0};
+  std::size_t pendingTasks{0};
+  std::atomic<unsigned int> nextQueue{0};
+  bool stopping = false;
+};
+} // namespace PChip8
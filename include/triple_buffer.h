@@ -0,0 +1,37 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Lock-free single producer / single consumer triple buffer.
+//
+// The producer always owns one slot to write into and the consumer one slot
+// to read from, the third slot is handed between them through a single
+// atomic exchange. Neither side ever waits for the other, the consumer just
+// sees the most recently published value and older ones are dropped.
+template<typename T>
+class TripleBuffer {
+public:
+  TripleBuffer();
+  ~TripleBuffer();
+
+  // Producer side: the slot to fill, then publish() to hand it over
+  T &back();
+  void publish();
+
+  // Consumer side: swap in the latest published slot, if there is a new one
+  bool update();
+  [[nodiscard]] const T &front() const;
+
+private:
+  // bits 0-1: index of the shared slot, bit 2: it holds an unread value
+  static constexpr uint8_t INDEX_MASK = 0b011;
+  static constexpr uint8_t FRESH_BIT = 0b100;
+
+  std::array<T, 3> slots {};
+  std::atomic<uint8_t> shared {1};
+  uint8_t backIndex = 0;
+  uint8_t frontIndex = 2;
+};
+
+#include "../src/triple_buffer.cpp"
@@ -0,0 +1,468 @@
+#include "chip8.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Ahead-of-time ROM to C++ compiler
+//
+// Follows the control flow of a ROM from START_EXEC_LOCATION to recover its
+// basic blocks, and writes a translation unit with one function per block
+// plus an AotProgram describing them, which registers itself with the aot
+// engine when linked in. Register and timer instructions become plain C++
+// on the Chip8 state, everything with side effects beyond that (draw, RNG,
+// calls, stores, key wait) calls the interpreter's own handler.
+//
+// BNNN targets are not known until run time and are left to the
+// interpreter, as is anything outside the ROM image. Stores end their block,
+// so self-modifying code is caught by the runtime before the next block runs.
+// The code follows one quirk profile, and the runtime only uses the program
+// for machines set to it.
+
+namespace {
+using PChip8::Op;
+
+constexpr int MAX_BLOCK_LENGTH = 64;
+
+// QuirkProfile enumerator names, for the generated AotProgram
+#define PCHIP8_PROFILE_IDENTIFIER(profile, name) #profile,
+constexpr const char *PROFILE_IDENTIFIERS[] = {
+    PCHIP8_QUIRK_PROFILES(PCHIP8_PROFILE_IDENTIFIER)};
+#undef PCHIP8_PROFILE_IDENTIFIER
+
+struct DecodedInstruction {
+  uint16_t address;
+  PChip8::Instruction instruction;
+  Op op;
+};
+
+struct Block {
+  uint16_t address;
+  std::vector<DecodedInstruction> instructions;
+  // pc after the last instruction when it does not decide it itself
+  uint16_t next;
+};
+
+enum class Flow {
+  Continue,  // straight-line, the block goes on
+  Store,     // writes memory, the block ends after it
+  Jump,      // 1NNN
+  Call,      // 2NNN
+  Skip,      // 3XKK 4XKK 5XY0 9XY0 EX9E EXA1
+  Computed,  // 00EE 00FD BNNN FX0A and unknown opcodes, pc from the handler
+};
+
+Flow flowOf(Op op) {
+  switch (op) {
+  case Op::LD_B_VX:
+  case Op::LD_I_VX:
+    return Flow::Store;
+  case Op::JP:
+    return Flow::Jump;
+  case Op::CALL:
+    return Flow::Call;
+  case Op::SE_VX_KK:
+  case Op::SNE_VX_KK:
+  case Op::SE_VX_VY:
+  case Op::SNE_VX_VY:
+  case Op::SKP_VX:
+  case Op::SKNP_VX:
+    return Flow::Skip;
+  case Op::RET:
+  case Op::EXIT:
+  case Op::JP_V0:
+  case Op::LD_VX_K:
+  case Op::UNKNOWN:
+    return Flow::Computed;
+  default:
+    return Flow::Continue;
+  }
+}
+
+class Analysis {
+public:
+  explicit Analysis(const std::vector<uint8_t> &rom) : rom(rom) {}
+
+  // Blocks reachable from START_EXEC_LOCATION, by address
+  std::map<uint16_t, Block> recover() {
+    std::vector<uint16_t> leaders{PChip8::START_EXEC_LOCATION};
+    std::map<uint16_t, Block> blocks;
+
+    while (!leaders.empty()) {
+      uint16_t leader = leaders.back();
+      leaders.pop_back();
+      if (!inROM(leader) || blocks.contains(leader))
+        continue;
+
+      Block block = walk(leader, leaders);
+      blocks.emplace(leader, std::move(block));
+    }
+    return blocks;
+  }
+
+private:
+  bool inROM(uint32_t address) const {
+    return address >= PChip8::START_EXEC_LOCATION &&
+           address + 1 < PChip8::START_EXEC_LOCATION + rom.size() &&
+           address + 1 < PChip8::MEMORY_SIZE;
+  }
+
+  uint16_t opCodeAt(uint16_t address) const {
+    std::size_t offset = address - PChip8::START_EXEC_LOCATION;
+    return (rom[offset] << 8) | rom[offset + 1];
+  }
+
+  // Straight-line code from leader, pushing the successors it finds
+  Block walk(uint16_t leader, std::vector<uint16_t> &leaders) const {
+    Block block{leader, {}, leader};
+    uint16_t address = leader;
+
+    while (inROM(address) &&
+           block.instructions.size() < MAX_BLOCK_LENGTH) {
+      uint16_t opCode = opCodeAt(address);
+      auto instruction = PChip8::decodeInstruction(opCode);
+      Op op = PChip8::decodeOp(opCode);
+      block.instructions.push_back({address, instruction, op});
+      address += 2;
+
+      switch (flowOf(op)) {
+      case Flow::Continue:
+        continue;
+      case Flow::Store:
+        break;
+      case Flow::Jump:
+        leaders.push_back(instruction.nnn);
+        return block;
+      case Flow::Call:
+        // returns land right after the call
+        leaders.push_back(instruction.nnn);
+        leaders.push_back(address);
+        return block;
+      case Flow::Skip:
+        leaders.push_back(address);
+        leaders.push_back(address + 2);
+        return block;
+      case Flow::Computed:
+        if (op == Op::LD_VX_K)
+          leaders.push_back(address);
+        return block;
+      }
+      break;
+    }
+
+    // fell off the block: length limit, end of the ROM or after a store
+    block.next = address;
+    leaders.push_back(address);
+    return block;
+  }
+
+  const std::vector<uint8_t> &rom;
+};
+
+std::string hex(unsigned value, int width = 3) {
+  std::ostringstream out;
+  out << "0x" << std::uppercase << std::hex << std::setw(width)
+      << std::setfill('0') << value;
+  return out.str();
+}
+
+std::string reg(int index) { return "V[" + hex(index, 1) + "]"; }
+
+// C++ statements for instruction `index` of a block under the given quirks,
+// ending in a return when it decides the next pc
+std::string translate(const DecodedInstruction &decoded, std::size_t index,
+                      const PChip8::Quirks &quirks) {
+  const auto &ins = decoded.instruction;
+  std::string vx = reg(ins.x);
+  std::string vy = reg(ins.y);
+  std::string kk = hex(ins.kk, 2);
+  std::string next = hex(decoded.address + 2);
+  std::string skip = hex(decoded.address + 4);
+  auto skipIf = [&](const std::string &condition) {
+    return "return " + condition + " ? " + skip + " : " + next + ";";
+  };
+  std::string resetVF = quirks.logicResetsVF ? " V[0xF] = 0;" : "";
+  std::string source = quirks.shiftReadsVY ? vy : vx;
+  auto execute = [&] {
+    return "AotRuntime::execute(chip8, Op::" +
+           std::string(PChip8::OP_NAMES[static_cast<int>(decoded.op)]) +
+           ", " + hex(ins.opCode, 4) + ", " + next + ", " +
+           std::to_string(index) + ")";
+  };
+
+  switch (decoded.op) {
+  case Op::JP:
+    return "return " + hex(ins.nnn) + ";";
+  case Op::SE_VX_KK:
+    return skipIf(vx + " == " + kk);
+  case Op::SNE_VX_KK:
+    return skipIf(vx + " != " + kk);
+  case Op::SE_VX_VY:
+    return skipIf(vx + " == " + vy);
+  case Op::SNE_VX_VY:
+    return skipIf(vx + " != " + vy);
+  case Op::SKP_VX:
+    return skipIf("chip8.keyPress[" + vx + " & 0xF]");
+  case Op::SKNP_VX:
+    return skipIf("!chip8.keyPress[" + vx + " & 0xF]");
+  case Op::LD_VX_KK:
+    return vx + " = " + kk + ";";
+  case Op::ADD_VX_KK:
+    return vx + " += " + kk + ";";
+  case Op::LD_VX_VY:
+    return vx + " = " + vy + ";";
+  case Op::OR_VX_VY:
+    return vx + " |= " + vy + ";" + resetVF;
+  case Op::AND_VX_VY:
+    return vx + " &= " + vy + ";" + resetVF;
+  case Op::XOR_VX_VY:
+    return vx + " ^= " + vy + ";" + resetVF;
+  case Op::ADD_VX_VY:
+    return "{ int sum = " + vx + " + " + vy + "; " + vx +
+           " = sum; V[0xF] = sum > 0xFF; }";
+  case Op::SUB_VX_VY:
+    return "{ int result = " + vx + " - " + vy + "; " + vx +
+           " = result; V[0xF] = result >= 0; }";
+  case Op::SHR_VX:
+    return "{ uint8_t flag = " + source + " & 1; " + vx + " = " + source +
+           " >> 1; V[0xF] = flag; }";
+  case Op::SUBN_VX_VY:
+    return "{ int result = " + vy + " - " + vx + "; " + vx +
+           " = result; V[0xF] = result >= 0; }";
+  case Op::SHL_VX:
+    return "{ uint8_t flag = " + source + " >> 7; " + vx + " = " + source +
+           " << 1; V[0xF] = flag; }";
+  case Op::LD_I:
+    return "I = " + hex(ins.nnn) + ";";
+  case Op::LD_VX_DT:
+    return vx + " = AotRuntime::delayTimer(chip8);";
+  case Op::LD_DT_VX:
+    return "AotRuntime::delayTimer(chip8) = " + vx + ";";
+  case Op::LD_ST_VX:
+    return "AotRuntime::setSoundTimer(chip8, " + vx + ", " +
+           std::to_string(index) + ");";
+  case Op::ADD_I_VX:
+    return "I += " + vx + ";";
+  case Op::LD_F_VX:
+    return "I = PChip8::FONT_LOCATION + (" + vx + " & 0xF) * 5;";
+  case Op::LD_VX_I: {
+    std::string loads;
+    for (int offset = 0; offset <= ins.x; ++offset) {
+      if (offset > 0)
+        loads += ' ';
+      loads += reg(offset) + " = memory[(I + " + std::to_string(offset) +
+               ") & PChip8::MEMORY_MASK];";
+    }
+    if (quirks.indexIncrement == PChip8::IndexIncrement::XPlusOne)
+      loads += " I += " + std::to_string(ins.x + 1) + ";";
+    else if (quirks.indexIncrement == PChip8::IndexIncrement::X)
+      loads += " I += " + std::to_string(ins.x) + ";";
+    return loads;
+  }
+  case Op::SCD:
+  case Op::SCU:
+  case Op::CLS:
+  case Op::SCR:
+  case Op::SCL:
+  case Op::LOW:
+  case Op::HIGH:
+  case Op::RND_VX:
+  case Op::DRW_VX_VY:
+  case Op::LD_B_VX:
+  case Op::LD_I_VX:
+  case Op::PLANE:
+    return execute() + ";";
+  case Op::RET:
+  case Op::EXIT:
+  case Op::CALL:
+  case Op::JP_V0:
+  case Op::LD_VX_K:
+  case Op::UNKNOWN:
+    return "return " + execute() + ";";
+  }
+  return execute() + ";";
+}
+
+std::string functionName(const Block &block, bool prefix) {
+  std::ostringstream name;
+  name << (prefix ? "prefix_" : "block_") << std::hex << std::setw(3) << std::setfill('0')
+       << block.address;
+  return name.str();
+}
+
+// The block as a function, or with `prefix` as one that stops after its
+// first `count` instructions, for the end of a cycle budget
+void emitBlock(std::ostream &out, const Block &block, bool prefix,
+               const PChip8::Quirks &quirks) {
+  out << "uint16_t " << functionName(block, prefix) << "(Chip8 &chip8"
+      << (prefix ? ", uint16_t count" : "") << ") {\n"
+      << "  [[maybe_unused]] auto &V = AotRuntime::registers(chip8);\n"
+      << "  [[maybe_unused]] auto &I = AotRuntime::index(chip8);\n"
+      << "  [[maybe_unused]] const auto &memory = AotRuntime::memory(chip8);\n";
+
+  bool returned = false;
+  for (std::size_t i = 0; i < block.instructions.size(); ++i) {
+    const auto &decoded = block.instructions[i];
+    std::string code = translate(decoded, i, quirks);
+    returned = code.starts_with("return");
+    out << "  " << code << " // " << hex(decoded.address) << ' '
+        << hex(decoded.instruction.opCode, 4).substr(2) << ' '
+        << PChip8::OP_NAMES[static_cast<int>(decoded.op)] << '\n';
+    if (prefix && i + 1 < block.instructions.size())
+      out << "  if (count == " << i + 1 << ") return "
+          << hex(decoded.address + 2) << ";\n";
+  }
+  if (!returned)
+    out << "  return " << hex(block.next) << ";\n";
+  out << "}\n";
+}
+
+void emit(std::ostream &out, const std::string &name, const std::string &romName,
+          const std::vector<uint8_t> &rom,
+          const std::map<uint16_t, Block> &blocks,
+          PChip8::QuirkProfile profile) {
+  const auto quirks = PChip8::quirksOf(profile);
+  out << "// Generated by pchip8-aot from " << romName << " for the "
+      << PChip8::quirkProfileName(profile) << " profile, do not edit\n"
+      << "#include \"aot_runtime.h\"\n\n"
+      << "namespace {\n"
+      << "using PChip8::AotRuntime;\n"
+      << "using PChip8::Chip8;\n"
+      << "using PChip8::Op;\n\n"
+      << "constexpr uint8_t ROM[] = {";
+  for (std::size_t i = 0; i < rom.size(); ++i) {
+    out << (i % 12 == 0 ? "\n    " : " ") << hex(rom[i], 2) << ',';
+  }
+  out << "\n};\n";
+
+  for (const auto &[address, block] : blocks) {
+    out << "\n// " << hex(address) << ", " << block.instructions.size()
+        << " instructions\n";
+    emitBlock(out, block, false, quirks);
+    if (block.instructions.size() > 1)
+      emitBlock(out, block, true, quirks);
+  }
+
+  out << "\nconstexpr PChip8::AotBlock BLOCKS[] = {\n";
+  for (const auto &[address, block] : blocks) {
+    out << "    {" << hex(address) << ", " << block.instructions.size()
+        << ", &" << functionName(block, false) << ", ";
+    if (block.instructions.size() > 1)
+      out << '&' << functionName(block, true) << "},\n";
+    else
+      out << "nullptr},\n";
+  }
+  out << "};\n\n"
+      << "const PChip8::AotProgram PROGRAM{\"" << name
+      << "\", ROM, BLOCKS, PChip8::QuirkProfile::"
+      << PROFILE_IDENTIFIERS[static_cast<int>(profile)] << "};\n"
+      << "const bool registered = PChip8::registerAotProgram(PROGRAM);\n"
+      << "} // namespace\n";
+}
+
+// ROM file stem reduced to an identifier-like program name
+std::string programName(const std::string &fileName) {
+  std::string name = std::filesystem::path(fileName).stem().string();
+  for (auto &c : name) {
+    if (!std::isalnum(static_cast<unsigned char>(c)))
+      c = '_';
+  }
+  return name;
+}
+
+void printUsage(const char *program) {
+  std::cerr << "usage: " << program
+            << " [-o output.cpp] [-n name] [-q quirks] rom\n"
+            << "quirks is the profile the code follows, vip by default\n";
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::string outputFile;
+  std::string name;
+  std::string romFile;
+  PChip8::QuirkProfile profile = PChip8::DEFAULT_QUIRKS;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if ((arg == "-o" || arg == "-n" || arg == "-q") && i + 1 >= argc) {
+      printUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+
+    if (arg == "-o") {
+      outputFile = argv[++i];
+    } else if (arg == "-n") {
+      name = argv[++i];
+    } else if (arg == "-q") {
+      try {
+        profile = PChip8::parseQuirkProfile(argv[++i]);
+      } catch (std::invalid_argument &e) {
+        std::cerr << "error: " << e.what() << '\n';
+        return EXIT_FAILURE;
+      }
+    } else if (arg == "-h" || arg == "--help") {
+      printUsage(argv[0]);
+      return EXIT_SUCCESS;
+    } else if (romFile.empty()) {
+      romFile = arg;
+    } else {
+      printUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (romFile.empty()) {
+    printUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (name.empty())
+    name = programName(romFile);
+
+  std::ifstream romData{romFile, std::ios::binary};
+  if (!romData) {
+    std::cerr << "error: could not open " << romFile << '\n';
+    return EXIT_FAILURE;
+  }
+  std::vector<uint8_t> rom{std::istreambuf_iterator<char>(romData), {}};
+  if (rom.size() > PChip8::MEMORY_SIZE - PChip8::START_EXEC_LOCATION) {
+    std::cerr << "error: " << romFile << " is too large\n";
+    return EXIT_FAILURE;
+  }
+
+  auto blocks = Analysis{rom}.recover();
+
+  std::size_t instructions = 0;
+  std::size_t indirect = 0;
+  for (const auto &[address, block] : blocks) {
+    instructions += block.instructions.size();
+    indirect += block.instructions.back().op == Op::JP_V0;
+  }
+  std::cerr << romFile << ": " << blocks.size() << " blocks, " << instructions
+            << " instructions, " << indirect
+            << " indirect jumps left to the interpreter\n";
+
+  std::string romName = std::filesystem::path(romFile).filename().string();
+  if (outputFile.empty()) {
+    emit(std::cout, name, romName, rom, blocks, profile);
+    return EXIT_SUCCESS;
+  }
+
+  std::ofstream output{outputFile};
+  emit(output, name, romName, rom, blocks, profile);
+  if (!output) {
+    std::cerr << "error: could not write " << outputFile << '\n';
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
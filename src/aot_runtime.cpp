@@ -0,0 +1,137 @@
+#include "aot_runtime.h"
+#include <algorithm>
+#include <cstring>
+
+namespace PChip8 {
+namespace {
+std::vector<const AotProgram *> &registry() {
+  static std::vector<const AotProgram *> programs;
+  return programs;
+}
+
+// ROM bytes of program still found at the start of memory
+std::size_t matchingBytes(const AotProgram &program,
+                          const std::array<uint8_t, MEMORY_SIZE> &memory) {
+  std::size_t size = std::min<std::size_t>(program.rom.size(),
+                                           MEMORY_SIZE - START_EXEC_LOCATION);
+  std::size_t matching = 0;
+  for (std::size_t i = 0; i < size; ++i) {
+    matching += program.rom[i] == memory[START_EXEC_LOCATION + i];
+  }
+  return matching;
+}
+} // namespace
+
+bool registerAotProgram(const AotProgram &program) {
+  registry().push_back(&program);
+  return true;
+}
+
+std::span<const AotProgram *const> registeredAotPrograms() {
+  return registry();
+}
+
+AotRuntime::AotRuntime(const Chip8 &chip8) {
+  entries.fill(-1);
+
+  // the ROM may have written over parts of itself already (e.g. after
+  // loading a save state), stale blocks sort that out, so the closest
+  // program is good enough as long as most of it is there
+  std::size_t best = 0;
+  for (const auto *candidate : registry()) {
+    if (candidate->quirks != chip8.quirks)
+      continue;
+    std::size_t matching = matchingBytes(*candidate, chip8.memory);
+    if (matching > best && matching * 2 >= candidate->rom.size()) {
+      best = matching;
+      program = candidate;
+    }
+  }
+  if (!program)
+    return;
+
+  for (std::size_t i = 0; i < program->blocks.size(); ++i) {
+    const auto &block = program->blocks[i];
+    entries[block.address & MEMORY_MASK] = i;
+    for (int offset = 0; offset < 2 * block.length; ++offset) {
+      uint16_t address = (block.address + offset) & MEMORY_MASK;
+      codeMap.set(address);
+      auto &page = pages[address / PAGE_SIZE];
+      if (page.empty() || page.back() != i)
+        page.push_back(i);
+    }
+  }
+  stale.assign(program->blocks.size(), true);
+}
+
+const AotProgram *AotRuntime::getProgram() const { return program; }
+
+uint16_t AotRuntime::execute(Chip8 &chip8, Op op, uint16_t opCode,
+                             uint16_t next, int index) {
+  chip8.current = decodeInstruction(opCode);
+  chip8.pc = next;
+  // what the interpreter counts before a handler, which matters when it
+  // throws
+  chip8.cycleCount = chip8.aot->blockCycle + index + 1;
+  Chip8::handlerFor(chip8.quirks, op)(chip8);
+  return chip8.pc;
+}
+
+void AotRuntime::invalidate(uint16_t address) {
+  if (!codeMap.test(address & MEMORY_MASK))
+    return;
+
+  address &= MEMORY_MASK;
+  for (uint16_t i : pages[address / PAGE_SIZE]) {
+    const auto &block = program->blocks[i];
+    if (address >= block.address && address < block.address + 2 * block.length)
+      stale[i] = true;
+  }
+}
+
+bool AotRuntime::revalidate(int block, const Chip8 &chip8) {
+  const auto &translated = program->blocks[block];
+  std::size_t offset = translated.address - START_EXEC_LOCATION;
+  std::size_t size = 2 * translated.length;
+  if (translated.address < START_EXEC_LOCATION ||
+      offset + size > program->rom.size() ||
+      translated.address + size > MEMORY_SIZE)
+    return false;
+
+  stale[block] = std::memcmp(chip8.memory.data() + translated.address,
+                             program->rom.data() + offset, size) != 0;
+  return !stale[block];
+}
+
+uint64_t AotRuntime::run(Chip8 &chip8, uint64_t cycles) {
+  if (!program)
+    return chip8.runPredecoded(cycles);
+
+  uint64_t executed = 0;
+  while (executed < cycles) {
+    if (chip8.pc <= MEMORY_MASK && entries[chip8.pc] >= 0) {
+      int block = entries[chip8.pc];
+      const auto &translated = program->blocks[block];
+      if (!stale[block] || revalidate(block, chip8)) {
+        // the block's cycles are counted once it ran, like the JIT does
+        uint64_t count = std::min<uint64_t>(translated.length,
+                                            cycles - executed);
+        blockCycle = chip8.cycleCount;
+        if (count == translated.length) {
+          chip8.pc = translated.run(chip8);
+        } else {
+          // only single instruction blocks have no prefix, and those fit
+          chip8.pc = translated.runPrefix(chip8, count);
+        }
+        chip8.cycleCount = blockCycle + count;
+        executed += count;
+        continue;
+      }
+    }
+
+    // no block here, or the block changed
+    executed += chip8.runPredecoded(1);
+  }
+  return executed;
+}
+} // namespace PChip8
@@ -0,0 +1,207 @@
+#include "audio.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace PChip8 {
+namespace {
+constexpr int WAV_HEADER_SIZE = 44;
+
+void putLE(std::ostream &out, uint32_t value, int byteCount) {
+  for (int i = 0; i < byteCount; ++i) {
+    out.put(static_cast<char>((value >> (8 * i)) & 0xFF));
+  }
+}
+
+// RIFF header of a 16-bit mono PCM file with `samples` samples
+void writeWavHeader(std::ostream &out, int sampleRate, uint64_t samples) {
+  uint32_t dataSize = static_cast<uint32_t>(
+      std::min<uint64_t>(samples * 2, UINT32_MAX - WAV_HEADER_SIZE));
+  out.write("RIFF", 4);
+  putLE(out, WAV_HEADER_SIZE - 8 + dataSize, 4);
+  out.write("WAVEfmt ", 8);
+  putLE(out, 16, 4);             // fmt chunk size
+  putLE(out, 1, 2);              // PCM
+  putLE(out, 1, 2);              // mono
+  putLE(out, sampleRate, 4);
+  putLE(out, sampleRate * 2, 4); // bytes per second
+  putLE(out, 2, 2);              // bytes per sample frame
+  putLE(out, 16, 2);             // bits per sample
+  out.write("data", 4);
+  putLE(out, dataSize, 4);
+}
+} // namespace
+
+Buzzer::Buzzer(AudioBackend backend, AudioConfig config)
+    : backend(backend), config(config) {
+  this->config.sampleRate = std::max(1, config.sampleRate);
+  this->config.latencyFrames = std::max(1, config.latencyFrames);
+}
+
+Buzzer::Buzzer(const std::string &wavFile, AudioConfig config)
+    : Buzzer(AudioBackend::Wav, config) {
+  fileName = wavFile;
+  out.open(wavFile, std::ios::binary | std::ios::trunc);
+  if (!out)
+    throw std::runtime_error("Could not create " + wavFile);
+  writeWavHeader(out, this->config.sampleRate, 0);
+}
+
+Buzzer::~Buzzer() {
+  try {
+    finish();
+  } catch (std::exception &) {
+    // nowhere to report it, finish() throws for callers who care
+  }
+}
+
+// ---- EMULATION THREAD ----
+
+uint64_t Buzzer::frameStart(uint64_t frame) const {
+  return frame * config.sampleRate / TIMER_HZ;
+}
+
+void Buzzer::endFrame(std::span<const BuzzerChange> frameChanges,
+                      uint64_t frameEndCycle, uint32_t instructionsPerFrame,
+                      bool on) {
+  uint64_t start = frameStart(frameCount);
+  uint64_t end = frameStart(frameCount + 1);
+  int64_t ipf = std::max<uint32_t>(1, instructionsPerFrame);
+
+  // a held back change goes first, or gives way to this frame's
+  if (heldBack && changes.push(*heldBack))
+    heldBack.reset();
+
+  for (const auto &change : frameChanges) {
+    // cycles into the frame, anything before it (a reset) at its start
+    int64_t offset = ipf - std::clamp<int64_t>(
+                               static_cast<int64_t>(frameEndCycle - change.cycle),
+                               0, ipf);
+    queue({start + (end - start) * offset / ipf, change.on});
+  }
+  if (queuedOn != on)
+    queue({end, on});
+  ++frameCount;
+
+  if (backend == AudioBackend::Wav && out.is_open()) {
+    frameSamples.resize(end - start);
+    render(frameSamples);
+    writeWav(frameSamples);
+  }
+}
+
+void Buzzer::idleFrame() {
+  uint64_t start = frameStart(frameCount);
+  if (heldBack && changes.push(*heldBack))
+    heldBack.reset();
+  if (queuedOn)
+    queue({start, false});
+  ++frameCount;
+
+  if (backend == AudioBackend::Wav && out.is_open()) {
+    frameSamples.resize(frameStart(frameCount) - start);
+    render(frameSamples);
+    writeWav(frameSamples);
+  }
+}
+
+void Buzzer::queue(Change change) {
+  queuedOn = change.on;
+  ++changeCount;
+  if (backend == AudioBackend::Null)
+    return;
+  // never wait for the audio thread, keep the newest change for later
+  if (heldBack || !changes.push(change))
+    heldBack = change;
+}
+
+// ---- RENDERING ----
+
+uint64_t Buzzer::place(uint64_t sample) {
+  if (backend != AudioBackend::Device)
+    return sample;
+
+  uint64_t frame = config.sampleRate / TIMER_HZ;
+  int64_t placed = static_cast<int64_t>(sample) + anchor;
+  int64_t earliest = position;
+  // render() is called a device buffer at a time, so a change can arrive a
+  // whole buffer before playback reaches its frame
+  int64_t latest = position + requestSize +
+                   (config.latencyFrames + MAX_EARLY_FRAMES) * frame;
+  if (!anchored || placed < earliest || placed > latest) {
+    anchor = static_cast<int64_t>(position + config.latencyFrames * frame) -
+             static_cast<int64_t>(sample);
+    anchored = true;
+    placed = static_cast<int64_t>(sample) + anchor;
+  }
+  return placed;
+}
+
+void Buzzer::render(std::span<int16_t> samples) {
+  requestSize = samples.size();
+  std::size_t done = 0;
+  while (done < samples.size()) {
+    Change change;
+    if (!next && changes.pop(change))
+      next = Change{place(change.sample), change.on};
+
+    std::size_t until = samples.size();
+    if (next) {
+      if (next->sample <= position) {
+        playing = next->on;
+        next.reset();
+        continue;
+      }
+      until = std::min<uint64_t>(until, done + (next->sample - position));
+    }
+    synthesize(samples.subspan(done, until - done));
+    position += until - done;
+    done = until;
+  }
+}
+
+void Buzzer::synthesize(std::span<int16_t> samples) {
+  if (!playing) {
+    std::fill(samples.begin(), samples.end(), 0);
+    return;
+  }
+
+  auto amplitude = static_cast<int16_t>(
+      std::clamp(config.volume, 0.0f, 1.0f) * INT16_MAX);
+  float step = config.frequency / config.sampleRate;
+  for (auto &sample : samples) {
+    sample = phase < 0.5f ? amplitude : -amplitude;
+    phase += step;
+    if (phase >= 1.0f)
+      phase -= 1.0f;
+  }
+}
+
+// ---- WAV FILES ----
+
+void Buzzer::writeWav(std::span<const int16_t> samples) {
+  for (int16_t sample : samples) {
+    putLE(out, static_cast<uint16_t>(sample), 2);
+  }
+  samplesWritten += samples.size();
+}
+
+void Buzzer::finish() {
+  if (!out.is_open())
+    return;
+
+  out.seekp(0);
+  writeWavHeader(out, config.sampleRate, samplesWritten);
+  out.close();
+  if (!out)
+    throw std::runtime_error(fileName + " write failed");
+}
+
+AudioBackend Buzzer::getBackend() const { return backend; }
+
+const AudioConfig &Buzzer::getConfig() const { return config; }
+
+uint64_t Buzzer::getChangeCount() const { return changeCount; }
+
+uint64_t Buzzer::getFrameCount() const { return frameCount; }
+} // namespace PChip8
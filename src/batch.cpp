@@ -0,0 +1,540 @@
+#include "audio.h"
+#include "capture.h"
+#include "chip8.h"
+#include "input.h"
+#include "lockstep.h"
+#include "rom_cache.h"
+#include "rom_pack.h"
+#include "scheduler.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Headless batch runner
+//
+// Runs every ROM for a fixed cycle budget on a work-stealing thread pool, with
+// no SDL and no pacing (timers still tick every instructionsPerFrame
+// instructions), and prints one CSV line per ROM. ROM packs (.c8pk) stand for
+// every ROM in them, each run with its own settings.
+
+namespace {
+struct BatchResult {
+  std::string status = "ok";
+  uint64_t cycles = 0;
+  double wallSeconds = 0.0;
+  uint64_t framebufferHash = 0;
+#ifdef PCHIP8_INSTRUMENTATION
+  PChip8::Profile profile;
+#endif
+};
+
+void printUsage(const char *program) {
+  std::cerr << "usage: " << program
+            << " [-j workers] [-c cycles] [-f instructions_per_frame] "
+               "[-e engine] [-q quirks] [-v] [-n lanes] [-s seed] "
+               "[-i input_log] [-p profile] [-C capture_dir] [-A audio_dir] "
+               "[-l rom_list] [rom ...]\n"
+            << "engines: switch, table, threaded, predecoded, jit, aot\n"
+            << "quirks: vip (default), chip48, schip, xochip\n"
+            << "-v runs the engine in lockstep with the switch engine and "
+               "reports the first divergence\n"
+            << "-n runs each ROM as that many lanes of the lockstep engine, "
+               "cycles count every lane\n"
+            << "-s seeds the random generator of every ROM (default 0, or the "
+               "seed of the input log)\n"
+            << "a .c8pk rom is a pack (see pchip8-pack), each ROM in it runs "
+               "at its own instructions per frame and quirks unless -f or -q "
+               "is given\n"
+            << "-i replays the key events of an input log (as written by "
+               "pchip8 --record) into every ROM\n"
+            << "-p writes the execution profile of all ROMs (.csv or .json), "
+               "needs a PCHIP8_INSTRUMENTATION build\n"
+            << "-C writes the frames of every ROM to capture_dir/<rom>.p8cap "
+               "(see pchip8-play), not with -v or -n\n"
+            << "-A writes the buzzer of every ROM to audio_dir/<rom>.wav, one "
+               "frame of sound per frame run, not with -v or -n\n";
+}
+
+// The value of a numeric option, throws std::invalid_argument naming the
+// option unless text is a whole number from min to max
+uint64_t parseNumber(const std::string &option, const std::string &text,
+                     uint64_t min = 0,
+                     uint64_t max = std::numeric_limits<uint64_t>::max()) {
+  std::size_t end = 0;
+  uint64_t value = 0;
+  try {
+    // stoull would take a sign and wrap a negative number around
+    if (!text.empty() && std::isdigit(static_cast<unsigned char>(text[0])))
+      value = std::stoull(text, &end);
+  } catch (std::exception &) {
+  }
+  if (end == 0 || end != text.size() || value < min || value > max)
+    throw std::invalid_argument("bad value " + text + " for " + option);
+  return value;
+}
+
+// A CSV field, quoted when it holds a comma, quote or line break
+std::string csvField(const std::string &text) {
+  if (text.find_first_of(",\"\r\n") == std::string::npos)
+    return text;
+  std::string quoted = "\"";
+  for (char c : text) {
+    if (c == '"')
+      quoted += '"';
+    quoted += c;
+  }
+  return quoted + '"';
+}
+
+// A ROM to run, a file or one entry of a pack
+struct BatchRom {
+  std::string name;
+  std::shared_ptr<const PChip8::RomPack> pack;
+  std::size_t packIndex = 0;
+};
+
+struct BatchConfig {
+  uint64_t cycleBudget = 1'000'000;
+  PChip8::Engine engine = PChip8::DEFAULT_ENGINE;
+  PChip8::SchedulerConfig scheduler{.turbo = true};
+  // -f given, which overrides the instructions per frame of pack ROMs
+  bool instructionsPerFrameGiven = false;
+  // -q, which overrides the quirks of pack ROMs
+  std::optional<PChip8::QuirkProfile> quirks;
+  int lanes = 0;
+  uint64_t seed = 0;
+  PChip8::InputLog inputLog;
+  // -C, where to write a capture file per ROM
+  std::string captureDir;
+  // -A, where to write a WAV file per ROM
+  std::string audioDir;
+};
+
+// throws std::runtime_error like RomCache::load
+std::shared_ptr<const PChip8::RomImage> loadImage(const BatchRom &rom) {
+  if (rom.pack)
+    return rom.pack->getImage(rom.packIndex);
+  return PChip8::RomCache::shared().load(rom.name);
+}
+
+PChip8::SchedulerConfig schedulerConfig(const BatchRom &rom,
+                                        const BatchConfig &config) {
+  auto scheduler = config.scheduler;
+  if (rom.pack && !config.instructionsPerFrameGiven) {
+    uint32_t instructionsPerFrame =
+        rom.pack->getSettings(rom.packIndex).instructionsPerFrame;
+    if (instructionsPerFrame != 0)
+      scheduler.instructionsPerFrame = instructionsPerFrame;
+  }
+  return scheduler;
+}
+
+PChip8::QuirkProfile quirkProfile(const BatchRom &rom,
+                                  const BatchConfig &config) {
+  if (config.quirks)
+    return *config.quirks;
+  if (rom.pack)
+    return rom.pack->getSettings(rom.packIndex).quirks;
+  return PChip8::DEFAULT_QUIRKS;
+}
+
+void queueInput(PChip8::Scheduler &scheduler, const BatchConfig &config) {
+  for (const auto &event : config.inputLog.events) {
+    scheduler.getInput().push(event);
+  }
+}
+
+BatchResult runROM(const BatchRom &rom, const BatchConfig &config) {
+  BatchResult result;
+  auto chip8 = std::make_unique<PChip8::Chip8>();
+  chip8->setEngine(config.engine);
+  chip8->setQuirks(quirkProfile(rom, config));
+  chip8->seedRandom(config.seed);
+  PChip8::Scheduler scheduler{*chip8, schedulerConfig(rom, config)};
+  queueInput(scheduler, config);
+
+  std::unique_ptr<PChip8::FrameCapture> capture;
+  std::unique_ptr<PChip8::Buzzer> audio;
+  auto start = std::chrono::steady_clock::now();
+  try {
+    chip8->loadROM(loadImage(rom));
+    if (!config.captureDir.empty()) {
+      auto fileName = std::filesystem::path(config.captureDir) /
+                      std::filesystem::path(rom.name).stem();
+      capture = std::make_unique<PChip8::FrameCapture>(
+          fileName.string() + ".p8cap",
+          scheduler.getConfig().instructionsPerFrame);
+      scheduler.setCapture(capture.get());
+    }
+    if (!config.audioDir.empty()) {
+      auto fileName = std::filesystem::path(config.audioDir) /
+                      std::filesystem::path(rom.name).stem();
+      audio = std::make_unique<PChip8::Buzzer>(fileName.string() + ".wav");
+      scheduler.setAudio(audio.get());
+    }
+    scheduler.runCycles(config.cycleBudget);
+  } catch (std::exception &e) {
+    result.status = e.what();
+  }
+  try {
+    if (capture) {
+      // the frame the run ended in
+      capture->capture(*chip8);
+      capture->finish();
+    }
+    if (audio)
+      audio->finish();
+  } catch (std::exception &e) {
+    if (result.status == "ok")
+      result.status = e.what();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  result.cycles = chip8->getCycleCount();
+  result.wallSeconds = std::chrono::duration<double>(end - start).count();
+  result.framebufferHash = chip8->display.hash();
+#ifdef PCHIP8_INSTRUMENTATION
+  result.profile = chip8->getProfile();
+#endif
+  return result;
+}
+
+// Run the ROM on `engine` and on the reference switch engine side by side,
+// comparing the full machine state every VERIFY_STEP instructions
+constexpr uint64_t VERIFY_STEP = 100;
+
+BatchResult verifyROM(const BatchRom &rom, const BatchConfig &config) {
+  BatchResult result;
+  auto reference = std::make_unique<PChip8::Chip8>();
+  auto candidate = std::make_unique<PChip8::Chip8>();
+  reference->setEngine(PChip8::Engine::Switch);
+  candidate->setEngine(config.engine);
+  reference->setQuirks(quirkProfile(rom, config));
+  candidate->setQuirks(quirkProfile(rom, config));
+  reference->seedRandom(config.seed);
+  candidate->seedRandom(config.seed);
+  auto scheduler = schedulerConfig(rom, config);
+  PChip8::Scheduler referenceScheduler{*reference, scheduler};
+  PChip8::Scheduler candidateScheduler{*candidate, scheduler};
+  queueInput(referenceScheduler, config);
+  queueInput(candidateScheduler, config);
+
+  auto runChecked = [](PChip8::Scheduler &scheduler, uint64_t cycles) {
+    try {
+      scheduler.runCycles(cycles);
+    } catch (std::exception &e) {
+      return std::string(e.what());
+    }
+    return std::string();
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  try {
+    auto image = loadImage(rom);
+    reference->loadROM(image);
+    candidate->loadROM(image);
+  } catch (std::exception &e) {
+    result.status = e.what();
+    return result;
+  }
+
+  while (reference->getCycleCount() < config.cycleBudget) {
+    uint64_t step =
+        std::min(VERIFY_STEP, config.cycleBudget - reference->getCycleCount());
+
+    uint64_t cycle = reference->getCycleCount();
+    std::string candidateError = runChecked(candidateScheduler, step);
+    std::string referenceError = runChecked(referenceScheduler, step);
+
+    if (candidateError != referenceError ||
+        candidate->stateHash() != reference->stateHash()) {
+      result.status =
+          "diverged between cycle " + std::to_string(cycle) + " and " +
+          std::to_string(std::max(reference->getCycleCount(),
+                                  candidate->getCycleCount()));
+      break;
+    }
+    if (!referenceError.empty()) {
+      result.status = referenceError;
+      break;
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  result.cycles = candidate->getCycleCount();
+  result.wallSeconds = std::chrono::duration<double>(end - start).count();
+  result.framebufferHash = candidate->display.hash();
+#ifdef PCHIP8_INSTRUMENTATION
+  result.profile = candidate->getProfile();
+#endif
+  return result;
+}
+// Run `config.lanes` copies of the ROM on the lockstep engine, each for the
+// cycle budget. Reports the first lane to stop and the display of lane 0.
+BatchResult runLockstep(const BatchRom &rom, const BatchConfig &config) {
+  BatchResult result;
+  auto start = std::chrono::steady_clock::now();
+  std::unique_ptr<PChip8::Lockstep> lockstep;
+  try {
+    auto image = loadImage(rom);
+    lockstep = std::make_unique<PChip8::Lockstep>(
+        image->getBytes(), config.lanes, config.seed, quirkProfile(rom, config));
+  } catch (std::exception &e) {
+    result.status = e.what();
+    return result;
+  }
+
+  // every lane starts together, so the input log applies to all of them at
+  // the same step
+  const auto &inputLog = config.inputLog.events;
+  std::size_t nextEvent = 0;
+  uint16_t keyMask = 0;
+  uint64_t frame =
+      std::max(schedulerConfig(rom, config).instructionsPerFrame, 1u);
+  uint64_t intoFrame = 0;
+  for (uint64_t cycle = 0; cycle < config.cycleBudget;) {
+    if (nextEvent < inputLog.size() && inputLog[nextEvent].cycle <= cycle) {
+      for (; nextEvent < inputLog.size() && inputLog[nextEvent].cycle <= cycle;
+           ++nextEvent) {
+        uint16_t bit = 1u << (inputLog[nextEvent].key % PChip8::KEY_COUNT);
+        keyMask = inputLog[nextEvent].pressed ? keyMask | bit : keyMask & ~bit;
+      }
+      for (int lane = 0; lane < lockstep->getLaneCount(); ++lane) {
+        lockstep->setKeys(lane, keyMask);
+      }
+    }
+
+    uint64_t chunk = std::min(frame - intoFrame, config.cycleBudget - cycle);
+    if (nextEvent < inputLog.size())
+      chunk = std::min(chunk, inputLog[nextEvent].cycle - cycle);
+    if (lockstep->run(chunk) == 0)
+      break;
+    cycle += chunk;
+    intoFrame += chunk;
+    if (intoFrame == frame) {
+      lockstep->tickTimers();
+      intoFrame = 0;
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  for (int lane = 0; lane < lockstep->getLaneCount(); ++lane) {
+    result.cycles += lockstep->getCycleCount(lane);
+    auto status = lockstep->getStatus(lane);
+    if (status != PChip8::LaneStatus::Running && result.status == "ok")
+      result.status = "lane " + std::to_string(lane) + ": " +
+                      std::string(PChip8::laneStatusName(status));
+  }
+  result.wallSeconds = std::chrono::duration<double>(end - start).count();
+  result.framebufferHash = lockstep->displayHash(0);
+  return result;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  unsigned int workerCount = std::thread::hardware_concurrency();
+  BatchConfig config;
+  bool verify = false;
+  bool seedGiven = false;
+  std::string profileFile;
+  std::vector<BatchRom> roms;
+  auto addROM = [&roms](const std::string &fileName) {
+    if (!PChip8::isRomPack(fileName)) {
+      roms.push_back({.name = fileName, .pack = nullptr, .packIndex = 0});
+      return;
+    }
+    auto pack = PChip8::RomPack::open(fileName);
+    for (std::size_t i = 0; i < pack->size(); ++i) {
+      roms.push_back(
+          {.name = std::string(pack->getName(i)), .pack = pack, .packIndex = i});
+    }
+  };
+
+  try {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      if ((arg == "-j" || arg == "-c" || arg == "-f" || arg == "-e" ||
+           arg == "-q" || arg == "-l" || arg == "-n" || arg == "-s" ||
+           arg == "-i" || arg == "-p" || arg == "-C" || arg == "-A") &&
+          i + 1 >= argc) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      if (arg == "-j") {
+        workerCount = parseNumber(arg, argv[++i], 1,
+                                    std::numeric_limits<unsigned int>::max());
+      } else if (arg == "-c") {
+        config.cycleBudget = parseNumber(arg, argv[++i]);
+      } else if (arg == "-f") {
+        config.scheduler.instructionsPerFrame = parseNumber(
+            arg, argv[++i], 0, std::numeric_limits<uint32_t>::max());
+        config.instructionsPerFrameGiven = true;
+      } else if (arg == "-e") {
+        try {
+          config.engine = PChip8::parseEngine(argv[++i]);
+        } catch (std::exception &e) {
+          std::cerr << "error: " << e.what() << '\n';
+          return EXIT_FAILURE;
+        }
+      } else if (arg == "-q") {
+        try {
+          config.quirks = PChip8::parseQuirkProfile(argv[++i]);
+        } catch (std::exception &e) {
+          std::cerr << "error: " << e.what() << '\n';
+          return EXIT_FAILURE;
+        }
+      } else if (arg == "-l") {
+        std::ifstream romList{argv[++i]};
+        if (!romList) {
+          std::cerr << "error: could not open " << argv[i] << '\n';
+          return EXIT_FAILURE;
+        }
+        try {
+          for (std::string line; std::getline(romList, line);) {
+            if (!line.empty())
+              addROM(line);
+          }
+        } catch (std::exception &e) {
+          std::cerr << "error: " << e.what() << '\n';
+          return EXIT_FAILURE;
+        }
+      } else if (arg == "-n") {
+        config.lanes = parseNumber(arg, argv[++i], 0,
+                                   std::numeric_limits<int>::max());
+      } else if (arg == "-s") {
+        config.seed = parseNumber(arg, argv[++i]);
+        seedGiven = true;
+      } else if (arg == "-i") {
+        try {
+          config.inputLog = PChip8::loadInputLog(argv[++i]);
+        } catch (std::exception &e) {
+          std::cerr << "error: " << e.what() << '\n';
+          return EXIT_FAILURE;
+        }
+      } else if (arg == "-v") {
+        verify = true;
+      } else if (arg == "-p") {
+  #ifdef PCHIP8_INSTRUMENTATION
+        profileFile = argv[++i];
+  #else
+        std::cerr << "error: -p needs a build with PCHIP8_INSTRUMENTATION\n";
+        return EXIT_FAILURE;
+  #endif
+      } else if (arg == "-C") {
+        config.captureDir = argv[++i];
+      } else if (arg == "-A") {
+        config.audioDir = argv[++i];
+      } else if (arg == "-h" || arg == "--help") {
+        printUsage(argv[0]);
+        return EXIT_SUCCESS;
+      } else {
+        try {
+          addROM(arg);
+        } catch (std::exception &e) {
+          std::cerr << "error: " << e.what() << '\n';
+          return EXIT_FAILURE;
+        }
+      }
+    }
+  } catch (std::exception &e) {
+    std::cerr << "error: " << e.what() << '\n';
+    printUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (roms.empty()) {
+    printUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  for (const auto &[flag, dir] : {std::pair{"-C", config.captureDir},
+                                   std::pair{"-A", config.audioDir}}) {
+    if (dir.empty())
+      continue;
+    if (verify || config.lanes > 0) {
+      std::cerr << "error: " << flag << " cannot be combined with -v or -n\n";
+      return EXIT_FAILURE;
+    }
+    std::error_code error;
+    std::filesystem::create_directories(dir, error);
+    if (error) {
+      std::cerr << "error: could not create " << dir << ": "
+                << error.message() << '\n';
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (config.inputLog.seed && !seedGiven)
+    config.seed = *config.inputLog.seed;
+
+  std::vector<BatchResult> results(roms.size());
+  auto start = std::chrono::steady_clock::now();
+  {
+    PChip8::ThreadPool pool{workerCount};
+    for (size_t i = 0; i < roms.size(); ++i) {
+      pool.submit([&, i] {
+        if (verify)
+          results[i] = verifyROM(roms[i], config);
+        else if (config.lanes > 0)
+          results[i] = runLockstep(roms[i], config);
+        else
+          results[i] = runROM(roms[i], config);
+      });
+    }
+    pool.wait();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  std::cout << "rom,status,cycles,wall_ms,ips,framebuffer_hash\n";
+  uint64_t totalCycles = 0;
+  for (size_t i = 0; i < roms.size(); ++i) {
+    const auto &result = results[i];
+    double ips = result.wallSeconds > 0 ? result.cycles / result.wallSeconds : 0;
+    totalCycles += result.cycles;
+
+    std::cout << csvField(roms[i].name) << ',' << csvField(result.status)
+              << ',' << result.cycles
+              << ',' << std::fixed << std::setprecision(3)
+              << result.wallSeconds * 1000.0 << ',' << std::setprecision(0)
+              << ips << ',' << std::hex << std::setw(16) << std::setfill('0')
+              << result.framebufferHash << std::dec << std::setfill(' ')
+              << '\n';
+  }
+
+  double wallSeconds = std::chrono::duration<double>(end - start).count();
+  std::cerr << roms.size() << " roms, " << totalCycles << " cycles in "
+            << std::fixed << std::setprecision(3) << wallSeconds << "s ("
+            << std::setprecision(0) << totalCycles / wallSeconds
+            << " aggregate ips)\n";
+
+#ifdef PCHIP8_INSTRUMENTATION
+  if (!profileFile.empty()) {
+    PChip8::Profile total;
+    for (const auto &result : results) {
+      total.merge(result.profile);
+    }
+    try {
+      total.save(profileFile);
+    } catch (std::exception &e) {
+      std::cerr << "error: " << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+  }
+#endif
+  return EXIT_SUCCESS;
+}
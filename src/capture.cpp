@@ -0,0 +1,377 @@
+#include "capture.h"
+#include "delta_codec.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+namespace PChip8 {
+namespace {
+// frame record in a batch: u64 cycle, u8 flags, u64 dirty rows, then the
+// words of every dirty row of plane 0, and of plane 1 with two planes
+constexpr std::size_t RECORD_HEADER_SIZE = 8 + 1 + 8;
+constexpr uint8_t FLAG_HIRES = 1;
+constexpr uint8_t FLAG_TWO_PLANES = 2;
+constexpr uint8_t FLAG_KEYFRAME = 4;
+
+constexpr std::array<uint8_t, PLANE_COUNT * PlanarDisplay::MAX_WORDS * 8>
+    ZERO_IMAGE{};
+
+uint64_t allRows(int height) {
+  return height == 64 ? ~uint64_t{0} : (uint64_t{1} << height) - 1;
+}
+
+// f(first, count) for every run of consecutive rows set in `rows`, so rows
+// are copied a run at a time
+template <typename Function> void forEachRun(uint64_t rows, Function &&f) {
+  while (rows != 0) {
+    int first = std::countr_zero(rows);
+    int count = std::countr_one(rows >> first);
+    f(first, count);
+    rows = first + count == 64 ? 0 : rows & ~uint64_t{0} << (first + count);
+  }
+}
+
+// `words` packed display words as little-endian bytes
+void packWords(const uint8_t *words, std::size_t count, uint8_t *out) {
+  if constexpr (std::endian::native == std::endian::little) {
+    std::memcpy(out, words, count * 8);
+    return;
+  }
+  for (std::size_t word = 0; word < count; ++word) {
+    uint64_t value;
+    std::memcpy(&value, words + word * 8, 8);
+    for (int i = 0; i < 8; ++i) {
+      *out++ = (value >> (8 * i)) & 0xFF;
+    }
+  }
+}
+} // namespace
+
+FrameCapture::FrameCapture(const std::string &fileName,
+                           uint32_t instructionsPerFrame, CaptureConfig config)
+    : fileName(fileName), config(config),
+      out(fileName, std::ios::binary | std::ios::trunc) {
+  if (!out)
+    throw std::runtime_error("Could not create " + fileName);
+  this->config.keyframeInterval =
+      std::max<uint32_t>(1, config.keyframeInterval);
+  framesSinceKeyframe = this->config.keyframeInterval;
+
+  std::array<uint8_t, CAPTURE_HEADER_SIZE> fileHeader{};
+  for (int i = 0; i < 4; ++i) {
+    fileHeader[i] = (CAPTURE_MAGIC >> (8 * i)) & 0xFF;
+    fileHeader[8 + i] = (instructionsPerFrame >> (8 * i)) & 0xFF;
+  }
+  fileHeader[4] = CAPTURE_VERSION & 0xFF;
+  fileHeader[5] = CAPTURE_VERSION >> 8;
+  out.write(reinterpret_cast<const char *>(fileHeader.data()),
+            fileHeader.size());
+
+  for (auto &batch : batches) {
+    batch.reserve(BATCH_BYTES);
+    empty.push(&batch);
+  }
+  empty.pop(current);
+  // whatever the display showed before is unknown to the writer
+  resend = true;
+  writer = std::thread(&FrameCapture::writeLoop, this);
+}
+
+FrameCapture::~FrameCapture() {
+  try {
+    finish();
+  } catch (std::exception &) {
+    // nowhere to report it, finish() throws for callers who care
+  }
+}
+
+void FrameCapture::capture(Chip8 &chip8) {
+  if (!chip8.drawFlag && !resend)
+    return;
+  chip8.drawFlag = false;
+
+  const auto &display = chip8.display;
+  uint64_t rows = chip8.display.takeDirtyRows();
+  bool twoPlanes = display.isPlaneUsed(1);
+  // the writer starts a frame of another layout from scratch
+  if (resend || display.isHires() != sentHires || twoPlanes != sentTwoPlanes)
+    rows = allRows(display.getHeight());
+  if (rows == 0)
+    return;
+
+  std::size_t rowBytes = display.getWordsPerRow() * 8;
+  std::size_t size = RECORD_HEADER_SIZE +
+                     std::popcount(rows) * rowBytes * (twoPlanes ? 2 : 1);
+  if (!reserve(size)) {
+    // the writer is behind by every batch, drop this frame
+    ++droppedFrames;
+    resend = true;
+    return;
+  }
+  resend = false;
+  sentHires = display.isHires();
+  sentTwoPlanes = twoPlanes;
+
+  std::size_t offset = current->size();
+  current->resize(offset + size);
+  uint8_t *record = current->data() + offset;
+  uint64_t cycle = chip8.getCycleCount();
+  uint8_t flags = (display.isHires() ? FLAG_HIRES : 0) |
+                  (twoPlanes ? FLAG_TWO_PLANES : 0);
+  std::memcpy(record, &cycle, 8);
+  record[8] = flags;
+  std::memcpy(record + 9, &rows, 8);
+  record += RECORD_HEADER_SIZE;
+
+  for (int plane = 0; plane < (twoPlanes ? 2 : 1); ++plane) {
+    const uint8_t *words =
+        reinterpret_cast<const uint8_t *>(display.getRows(plane).data());
+    forEachRun(rows, [&](int first, int count) {
+      std::memcpy(record, words + first * rowBytes, count * rowBytes);
+      record += count * rowBytes;
+    });
+  }
+  ++frameCount;
+}
+
+bool FrameCapture::reserve(std::size_t size) {
+  if (current != nullptr && current->size() + size <= BATCH_BYTES)
+    return true;
+  if (current != nullptr) {
+    filled.push(current);
+    current = nullptr;
+    wake();
+  }
+  while (!empty.pop(current)) {
+    if (config.dropFrames)
+      return false;
+    uint32_t seen = freed.load(std::memory_order_acquire);
+    if (empty.pop(current))
+      break;
+    freed.wait(seen, std::memory_order_acquire);
+  }
+  return true;
+}
+
+void FrameCapture::wake() {
+  wakeups.fetch_add(1, std::memory_order_release);
+  wakeups.notify_one();
+}
+
+void FrameCapture::finish() {
+  if (!writer.joinable())
+    return;
+
+  if (current != nullptr && !current->empty()) {
+    filled.push(current);
+    current = nullptr;
+  }
+  stopping.store(true, std::memory_order_release);
+  wake();
+  writer.join();
+
+  out.close();
+  if (failed.load(std::memory_order_relaxed) || !out)
+    throw std::runtime_error(fileName + " write failed");
+}
+
+uint64_t FrameCapture::getFrameCount() const { return frameCount; }
+
+uint64_t FrameCapture::getDroppedFrameCount() const { return droppedFrames; }
+
+void FrameCapture::writeLoop() {
+  Batch *batch;
+  while (true) {
+    uint32_t seen = wakeups.load(std::memory_order_acquire);
+    if (filled.pop(batch)) {
+      writeBatch(*batch);
+      batch->clear();
+      empty.push(batch);
+      freed.fetch_add(1, std::memory_order_release);
+      freed.notify_one();
+      continue;
+    }
+    // everything pushed before stopping was set is visible by now
+    if (stopping.load(std::memory_order_acquire) && filled.empty())
+      break;
+    wakeups.wait(seen, std::memory_order_acquire);
+  }
+
+  out.flush();
+  if (!out)
+    failed.store(true, std::memory_order_relaxed);
+}
+
+void FrameCapture::writeBatch(const Batch &batch) {
+  const uint8_t *in = batch.data();
+  const uint8_t *end = in + batch.size();
+  output.clear();
+
+  while (in < end) {
+    uint64_t cycle;
+    uint64_t rows;
+    std::memcpy(&cycle, in, 8);
+    uint8_t flags = in[8];
+    std::memcpy(&rows, in + 9, 8);
+    in += RECORD_HEADER_SIZE;
+
+    bool frameHires = flags & FLAG_HIRES;
+    bool frameTwoPlanes = flags & FLAG_TWO_PLANES;
+    bool keyframe = frameHires != hires || frameTwoPlanes != twoPlanes ||
+                    framesSinceKeyframe >= config.keyframeInterval;
+    hires = frameHires;
+    twoPlanes = frameTwoPlanes;
+
+    // the rows that came with the frame go into its image, a frame of a new
+    // layout comes with all of them
+    std::size_t rowBytes = (hires ? HIRES_WIDTH : DISPLAY_WIDTH) / 8;
+    std::size_t planeBytes =
+        (hires ? HIRES_HEIGHT : DISPLAY_HEIGHT) * rowBytes;
+    image.resize(planeBytes * (twoPlanes ? 2 : 1));
+    previousImage.resize(image.size());
+    ranges.clear();
+    for (int plane = 0; plane < (twoPlanes ? 2 : 1); ++plane) {
+      forEachRun(rows, [&](int first, int count) {
+        std::size_t offset = plane * planeBytes + first * rowBytes;
+        std::size_t size = count * rowBytes;
+        packWords(in, size / 8, &image[offset]);
+        in += size;
+        // the last row of plane 0 and the first of plane 1 are one range too
+        if (!ranges.empty() && ranges.back().end == offset)
+          ranges.back().end += size;
+        else
+          ranges.push_back({offset, offset + size});
+      });
+    }
+
+    // only the rows that came with the frame can differ from the last one
+    if (keyframe)
+      encodeDelta(image, std::span(ZERO_IMAGE).first(image.size()), encoded);
+    else
+      encodeDelta(image, previousImage, ranges, encoded);
+    // rows were drawn to but the picture is the same, its cycles go to the
+    // next frame that changes
+    if (!keyframe && encoded.empty())
+      continue;
+    for (const auto &range : ranges) {
+      std::copy(image.begin() + range.begin, image.begin() + range.end,
+                previousImage.begin() + range.begin);
+    }
+
+    output.push_back(flags | (keyframe ? FLAG_KEYFRAME : 0));
+    putVarint(output, cycle - lastCycle);
+    putVarint(output, encoded.size());
+    output.insert(output.end(), encoded.begin(), encoded.end());
+
+    lastCycle = cycle;
+    framesSinceKeyframe = keyframe ? 1 : framesSinceKeyframe + 1;
+  }
+
+  out.write(reinterpret_cast<const char *>(output.data()), output.size());
+  if (!out)
+    failed.store(true, std::memory_order_relaxed);
+}
+
+// ---- READER ----
+
+int CaptureFrame::getWidth() const {
+  return hires ? HIRES_WIDTH : DISPLAY_WIDTH;
+}
+
+int CaptureFrame::getHeight() const {
+  return hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+}
+
+std::span<const uint64_t> CaptureFrame::getRows(int plane) const {
+  return {planes[plane].data(),
+          static_cast<std::size_t>(getWidth() / 64 * getHeight())};
+}
+
+CaptureReader::CaptureReader(const std::string &fileName)
+    : in(fileName, std::ios::binary) {
+  if (!in)
+    throw std::runtime_error("Could not open " + fileName);
+
+  std::array<uint8_t, CAPTURE_HEADER_SIZE> fileHeader{};
+  in.read(reinterpret_cast<char *>(fileHeader.data()), fileHeader.size());
+  uint32_t magic = 0;
+  for (int i = 0; i < 4; ++i) {
+    magic |= uint32_t{fileHeader[i]} << (8 * i);
+    instructionsPerFrame |= uint32_t{fileHeader[8 + i]} << (8 * i);
+  }
+  if (!in || magic != CAPTURE_MAGIC)
+    throw std::runtime_error(fileName + " is not a capture");
+  uint16_t version = fileHeader[4] | fileHeader[5] << 8;
+  if (version != CAPTURE_VERSION)
+    throw std::runtime_error("unsupported capture version " +
+                             std::to_string(version));
+  bytesRead = CAPTURE_HEADER_SIZE;
+}
+
+uint32_t CaptureReader::getInstructionsPerFrame() const {
+  return instructionsPerFrame;
+}
+
+bool CaptureReader::next() {
+  int flags = in.get();
+  if (flags == std::ifstream::traits_type::eof())
+    return false;
+
+  // the two varints, read a byte at a time up to the last one
+  std::array<uint8_t, 20> varints;
+  std::size_t varintBytes = 0;
+  for (int count = 0; count < 2 && varintBytes < varints.size();) {
+    int byte = in.get();
+    if (byte == std::ifstream::traits_type::eof())
+      throw std::runtime_error("truncated capture");
+    varints[varintBytes++] = byte;
+    count += (byte & 0x80) == 0;
+  }
+  const uint8_t *varint = varints.data();
+  const uint8_t *varintEnd = varint + varintBytes;
+  uint64_t cycles = getVarint(varint, varintEnd);
+  uint64_t deltaSize = getVarint(varint, varintEnd);
+  if (deltaSize > ZERO_IMAGE.size() * 2)
+    throw std::runtime_error("corrupt capture");
+
+  delta.resize(deltaSize);
+  in.read(reinterpret_cast<char *>(delta.data()), deltaSize);
+  if (!in)
+    throw std::runtime_error("truncated capture");
+  bytesRead += 1 + varintBytes + deltaSize;
+
+  bool keyframe = flags & FLAG_KEYFRAME;
+  bool hires = flags & FLAG_HIRES;
+  bool twoPlanes = flags & FLAG_TWO_PLANES;
+  if (!keyframe && (hires != frame.hires || twoPlanes != frame.twoPlanes))
+    throw std::runtime_error("corrupt capture");
+
+  frame.cycle += cycles;
+  frame.hires = hires;
+  frame.twoPlanes = twoPlanes;
+  frame.keyframe = keyframe;
+  std::size_t wordCount = frame.getWidth() / 64 * frame.getHeight();
+  if (keyframe)
+    image.assign((twoPlanes ? 2 : 1) * wordCount * 8, 0);
+  applyDelta(delta, image);
+
+  const uint8_t *bytes = image.data();
+  for (int plane = 0; plane < PLANE_COUNT; ++plane) {
+    for (std::size_t word = 0; word < wordCount; ++word) {
+      uint64_t value = 0;
+      if (plane == 0 || twoPlanes) {
+        for (int i = 0; i < 8; ++i) {
+          value |= uint64_t{*bytes++} << (8 * i);
+        }
+      }
+      frame.planes[plane][word] = value;
+    }
+  }
+  return true;
+}
+
+const CaptureFrame &CaptureReader::getFrame() const { return frame; }
+
+uint64_t CaptureReader::getBytesRead() const { return bytesRead; }
+} // namespace PChip8
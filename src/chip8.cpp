@@ -1,11 +1,17 @@
 #include "chip8.h"
+#include "aot_runtime.h"
+#include "rom_cache.h"
 #include <algorithm>
 #include <cstdlib>
-#include <filesystem>
-#include <fstream>
+#include <cstring>
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
 
+#ifdef PCHIP8_HAS_JIT
+#include "jit.h"
+#endif
+
 namespace PChip8 {
 Chip8::Chip8() {
   // Copy builtin font to memory
@@ -13,159 +19,212 @@ Chip8::Chip8() {
 
   std::copy(BUILTIN_FONT.begin(), BUILTIN_FONT.end(),
             memory.begin() + FONT_LOCATION);
-
-  // Seed random function
-  srand(time(nullptr));
+  invalidateDecodeCache();
 }
 
 Chip8::~Chip8() = default;
 
-void Chip8::cpuCycle() {
-  currentOpCode = (memory[pc] << 8) | memory[pc + 1];
-
-  // next instruction
-  // skip 2 bc instructions are 16 bits
-  // while memory is stored in 8 bit blocks
-  pc += 2;
-
-  // parse first nibble first
-  switch (currentOpCode & 0xF000) {
-  case 0x0000:
-    switch (currentOpCode & 0x000F) {
-    case 0x0000:
-      return opCode_CLS();
-    case 0x000E:
-      return opCode_RET();
-    default:
-      std::cerr << std::hex << currentOpCode; 
-      exit(1);
-    }
-    break;
-  case 0x1000:
-    return opCode_JP();
-  case 0x2000:
-    return opCode_CALL();
-  case 0x3000:
-    return opCode_SE_VX_KK();
-  case 0x4000:
-    return opCode_SNE_VX_KK();
-  case 0x5000:
-    return opCode_SE_VX_VY();
-  case 0x6000:
-    return opCode_LD_VX_KK();
-  case 0x7000:
-    return opCode_ADD_VX_KK();
-  case 0x8000:
-    switch (currentOpCode & 0x000F) {
-    case 0x0000:
-      return opCode_LD_VX_VY();
-    case 0x0001:
-      return opCode_OR_VX_VY();
-    case 0x0002:
-      return opCode_AND_VX_VY();
-    case 0x0003:
-      return opCode_XOR_VX_VY();
-    case 0x0004:
-      return opCode_ADD_VX_VY();
-    case 0x0005:
-      return opCode_SUB_VX_VY();
-    case 0x0006:
-      return opCode_SHR_VX();
-    case 0x0007:
-      return opCode_SUBN_VX_VY();
-    case 0x000E:
-      return opCode_SHL_VX();
-    default:
-      std::cerr << std::hex << currentOpCode; 
-      exit(1);
-    }
-    break;
-  case 0x9000:
-    return opCode_SNE_VX_VY();
-  case 0xA000:
-    return opCode_LD_I();
-  case 0xB000:
-    return opCode_JP_V0();
-  case 0xC000:
-    return opCode_RND_VX();
-  case 0xD000:
-    return opCode_DRW_VX_VY();
-  case 0xE000:
-    switch (currentOpCode & 0x00FF) {
-      case 0x009E:
-        return opCode_SKP_VX();
-      case 0x00A1:
-        return opCode_SKNP_VX();
-      default:
-        std::cerr << std::hex << currentOpCode; 
-        exit(1);
-    }
-  case 0xF000:
-    switch (currentOpCode & 0x00FF) {
-      case 0x0007:
-        return opCode_LD_VX_DT();
-      case 0x000A:
-        return opCode_LD_VX_K();
-      case 0x0015:
-        return opCode_LD_DT_VX();
-      case 0x0018:
-        return opCode_LD_ST_VX();
-      case 0x001E:
-        return opCode_ADD_I_VX();
-      case 0x0029:
-        return opCode_LD_F_VX();
-      case 0x0033:
-        return opCode_LD_B_VX();
-      case 0x0055:
-        return opCode_LD_I_VX();
-      case 0x0065:
-        return opCode_LD_VX_I();
-      default:
-        std::cerr << std::hex << currentOpCode; 
-        exit(1);
-    }
-  default:
-    std::cerr << std::hex << currentOpCode; 
-    exit(1);
-  }
+void Chip8::cpuCycle() { run(1); }
+
+void Chip8::throwUnknownOpCode() const {
+  std::ostringstream message;
+  message << "unknown opcode " << std::hex << current.opCode << " at "
+          << (pc - 2);
+  throw std::runtime_error(message.str());
 }
 
 void Chip8::loadROM(std::string fileName) {
+  loadROM(RomCache::shared().load(fileName));
+}
 
-  if (!std::filesystem::exists(fileName))
-    throw std::runtime_error(fileName + " does not exist");
-  if (std::filesystem::file_size(fileName) > MEMORY_SIZE - START_EXEC_LOCATION)
-    throw std::runtime_error(fileName + " is too large");
+void Chip8::loadROM(std::span<const uint8_t> romData) {
+  loadROM(RomImage::fromBytes(romData));
+}
 
-  std::ifstream romData{fileName, std::ios::binary};
-  if (!romData)
-    throw std::runtime_error("Could not open " + fileName);
+void Chip8::loadROM(std::shared_ptr<const RomImage> image) {
+  rom = std::move(image);
+  memory = rom->getMemory();
+  invalidateDecodeCache();
+}
 
-  romData.read(reinterpret_cast<char *>(memory.data() + START_EXEC_LOCATION),
-               std::filesystem::file_size(fileName));
-  // if read failed
-  if (!romData) {
-    throw std::runtime_error(fileName + " read failed");
+void Chip8::restoreMemory(const std::array<uint8_t, MEMORY_SIZE> &image) {
+  // write only the bytes that differ, so whatever the engines decoded or
+  // compiled from the rest stays valid
+  constexpr int CHUNK = 64;
+  for (int chunk = 0; chunk < MEMORY_SIZE; chunk += CHUNK) {
+    if (std::memcmp(&memory[chunk], &image[chunk], CHUNK) == 0)
+      continue;
+    for (int address = chunk; address < chunk + CHUNK; ++address) {
+      if (memory[address] != image[address])
+        writeMemory(address, image[address]);
+    }
   }
 }
 
 void Chip8::reset() {
-  std::fill(memory.begin(), memory.end(), 0);
+  if (rom) {
+    restoreMemory(rom->getMemory());
+  } else {
+    std::fill(memory.begin(), memory.end(), 0);
+    std::copy(BUILTIN_FONT.begin(), BUILTIN_FONT.end(),
+              memory.begin() + FONT_LOCATION);
+    invalidateDecodeCache();
+  }
   std::fill(V.begin(), V.end(), 0);
   I = 0;
   delayTimer = 0;
   soundTimer = 0;
-  display.clear();
-  currentOpCode = 0;
+  buzzerChangeCount = 0;
+  display.reset();
+  current = Instruction{};
+  cycleCount = 0;
   pc = START_EXEC_LOCATION;
-  while (!stack.empty()) {
-    stack.pop();
+  std::fill(stack.begin(), stack.end(), 0);
+  sp = 0;
+
+  drawFlag = true;
+}
+
+void Chip8::tickTimers() {
+  if (delayTimer > 0)
+    --delayTimer;
+  if (soundTimer > 0)
+    setSoundTimer(soundTimer - 1, cycleCount);
+}
+
+void Chip8::logBuzzer(uint64_t cycle, bool on) {
+  // changes alternate, so dropping the newest pair keeps the last state
+  if (buzzerChangeCount == BUZZER_LOG_SIZE) {
+    --buzzerChangeCount;
+    return;
   }
+  buzzerChanges[buzzerChangeCount++] = {cycle, on};
+}
 
-  std::copy(BUILTIN_FONT.begin(), BUILTIN_FONT.end(),
-            memory.begin() + FONT_LOCATION);
+std::span<const BuzzerChange> Chip8::getBuzzerChanges() const {
+  return {buzzerChanges.data(), buzzerChangeCount};
+}
 
-  drawFlag = true;
+void Chip8::clearBuzzerChanges() { buzzerChangeCount = 0; }
+
+// --- IDLE LOOPS ---
+
+uint16_t Chip8::opCodeAt(uint16_t address) const {
+  return (memory[address & MEMORY_MASK] << 8) |
+         memory[(address + 1) & MEMORY_MASK];
+}
+
+bool Chip8::findTimerLoop(TimerLoop &loop) const {
+  // which of the three instructions pc is on follows from the one there
+  int position;
+  switch (decodeOp(opCodeAt(pc))) {
+  case Op::LD_VX_DT:
+    position = 0;
+    break;
+  case Op::SE_VX_KK:
+  case Op::SNE_VX_KK:
+    position = 1;
+    break;
+  case Op::JP:
+    position = 2;
+    break;
+  default:
+    return false;
+  }
+
+  uint16_t start = pc - 2 * position;
+  if (pc < 2 * position || start + 4 > MEMORY_MASK)
+    return false;
+
+  auto load = decodeInstruction(opCodeAt(start));
+  auto skip = decodeInstruction(opCodeAt(start + 2));
+  auto jump = decodeInstruction(opCodeAt(start + 4));
+  bool skipsIfEqual = decodeOp(skip.opCode) == Op::SE_VX_KK;
+  if (decodeOp(load.opCode) != Op::LD_VX_DT ||
+      (!skipsIfEqual && decodeOp(skip.opCode) != Op::SNE_VX_KK) ||
+      skip.x != load.x || decodeOp(jump.opCode) != Op::JP ||
+      jump.nnn != start)
+    return false;
+
+  // the loop goes on while the skip does not skip the jump back
+  auto loops = [&](uint8_t value) { return (value == skip.kk) != skipsIfEqual; };
+  // on the skip itself VX still holds the value loaded last time around
+  if (!loops(delayTimer) || (position == 1 && !loops(V[load.x])))
+    return false;
+
+  loop = {start, position, load.x};
+  return true;
+}
+
+bool Chip8::waitingForKey() const {
+  return decodeOp(opCodeAt(pc)) == Op::LD_VX_K &&
+         std::none_of(keyPress.begin(), keyPress.end(),
+                      [](bool pressed) { return pressed; });
+}
+
+bool Chip8::halted() const {
+  auto instruction = decodeInstruction(opCodeAt(pc));
+  switch (decodeOp(instruction.opCode)) {
+  case Op::JP:
+    return instruction.nnn == pc;
+  case Op::EXIT:
+    return quirksOf(quirks).superChip;
+  default:
+    return false;
+  }
+}
+
+IdleState Chip8::idleState() const {
+  // called at every frame start, so first rule out anything that is not
+  // 00FD, 1NNN, 3XKK, 4XKK or FXKK by its top nibble
+  constexpr uint16_t candidates =
+      1 << 0x0 | 1 << 0x1 | 1 << 0x3 | 1 << 0x4 | 1 << 0xF;
+  if (((candidates >> (memory[pc & MEMORY_MASK] >> 4)) & 1) == 0)
+    return IdleState::Running;
+
+  TimerLoop loop;
+  if (waitingForKey())
+    return IdleState::WaitingForKey;
+  if (halted())
+    return IdleState::Halted;
+  if (findTimerLoop(loop))
+    return IdleState::WaitingForTimer;
+  return IdleState::Running;
+}
+
+uint64_t Chip8::fastForward(uint64_t cycles) {
+  // a debug hook sees every instruction spun
+  if (debugHook)
+    return run(cycles);
+#ifdef PCHIP8_INSTRUMENTATION
+  // the profile should show the time spent spinning
+  return run(cycles);
+#else
+  TimerLoop loop;
+  if (cycles == 0)
+    return 0;
+
+  if (waitingForKey() || halted()) {
+    // FX0A keeps moving pc back onto itself, as does the jump
+    current = decodeInstruction(opCodeAt(pc));
+    cycleCount += cycles;
+    return cycles;
+  }
+
+  if (!findTimerLoop(loop))
+    return run(cycles);
+
+  // instructions of the loop are numbered from its start, and the one at
+  // index i is instruction i % 3
+  uint64_t end = loop.position + cycles;
+  pc = loop.start + 2 * (end % 3);
+  current = decodeInstruction(opCodeAt(loop.start + 2 * ((end - 1) % 3)));
+  // FX07 ran at least once
+  if (loop.position == 0 || end > 3)
+    V[loop.x] = delayTimer;
+  cycleCount += cycles;
+  return cycles;
+#endif
 }
 
 void Chip8::printMemory() const {
@@ -189,7 +248,89 @@ void Chip8::printMemory() const {
   std::cout << std::dec;
 }
 
-const bool Chip8::getDrawFlag() const { return drawFlag; }
+bool Chip8::getDrawFlag() const { return drawFlag; }
+
+uint16_t Chip8::getPC() const { return pc; }
+
+uint64_t Chip8::getCycleCount() const { return cycleCount; }
+
+uint8_t Chip8::getDelayTimer() const { return delayTimer; }
+
+uint8_t Chip8::getSoundTimer() const { return soundTimer; }
+
+uint64_t Chip8::stateHash() const {
+  // 64-bit FNV-1a over every piece of architectural state
+  uint64_t result = 0xCBF29CE484222325;
+  auto mix = [&result](uint64_t value, int byteCount) {
+    for (int i = 0; i < byteCount; ++i) {
+      result = (result ^ ((value >> (8 * i)) & 0xFF)) * 0x100000001B3;
+    }
+  };
+
+  for (auto byte : memory) {
+    mix(byte, 1);
+  }
+  for (auto reg : V) {
+    mix(reg, 1);
+  }
+  mix(I, 2);
+  mix(pc, 2);
+  mix(delayTimer, 1);
+  mix(soundTimer, 1);
+
+  mix(sp, 1);
+  for (int i = sp - 1; i >= 0; --i) {
+    mix(stack[i], 2);
+  }
+
+  mix(rng.getState(), 8);
+  mix(display.isHires() | display.getPlaneMask() << 1, 1);
+  mix(display.hash(), 8);
+  return result;
+}
+
+uint64_t Chip8::registerHash() const {
+  // 64-bit FNV-1a like stateHash
+  uint64_t result = 0xCBF29CE484222325;
+  auto mix = [&result](uint8_t byte) {
+    result = (result ^ byte) * 0x100000001B3;
+  };
+
+  for (auto reg : V) {
+    mix(reg);
+  }
+  mix(I & 0xFF);
+  mix(I >> 8);
+  mix(pc & 0xFF);
+  mix(pc >> 8);
+  return result;
+}
+
+void Chip8::setEngine(Engine newEngine) { engine = newEngine; }
+
+Engine Chip8::getEngine() const { return engine; }
+
+void Chip8::setQuirks(QuirkProfile profile) {
+  if (profile == quirks)
+    return;
+  quirks = profile;
+  // decoded handlers and compiled blocks carry the old quirks
+  invalidateDecodeCache();
+}
+
+QuirkProfile Chip8::getQuirks() const { return quirks; }
+
+const std::shared_ptr<const RomImage> &Chip8::getROM() const { return rom; }
+
+void Chip8::setDebugHook(DebugHook *hook) { debugHook = hook; }
+
+void Chip8::seedRandom(uint64_t seed) { rng.setSeed(seed); }
+
+#ifdef PCHIP8_INSTRUMENTATION
+const Profile &Chip8::getProfile() const { return profile; }
+
+void Chip8::clearProfile() { profile.clear(); }
+#endif
 
 void Chip8::debug() {
   std::cout << std::hex;
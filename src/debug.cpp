@@ -0,0 +1,373 @@
+#include "chip8.h"
+#include "debugger.h"
+#include "scheduler.h"
+#include <cctype>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Interactive debugger
+//
+// Loads a ROM into a headless machine and reads commands from stdin:
+// breakpoints, memory watchpoints, register watches, stepping and
+// inspection. Ctrl-C stops a running `c`.
+
+namespace {
+void printUsage(const char *program) {
+  std::cerr << "usage: " << program
+            << " [-f instructions_per_frame] [-q quirks] [-e engine] "
+               "[-s seed] rom\n"
+            << "engines: switch, table, threaded, predecoded, jit, aot\n"
+            << "quirks: vip (default), chip48, schip, xochip\n";
+}
+
+void printHelp() {
+  std::cout
+      << "addresses and register values are hex, counts decimal\n"
+      << "  b ADDR          break before the instruction at ADDR\n"
+      << "  w ADDR [LEN]    stop after a write to LEN bytes (default 1) at "
+         "ADDR\n"
+      << "  r REG [VALUE]   stop when REG (v0-vf or i) changes, or changes "
+         "to VALUE\n"
+      << "  d ADDR | REG    delete the breakpoint and watchpoint at ADDR, or "
+         "the watch on REG\n"
+      << "  l               list breakpoints and watches\n"
+      << "  c [N]           continue until something stops it, or for at "
+         "most N instructions\n"
+      << "  s [N]           execute N instructions (default 1)\n"
+      << "  p               registers, timers, stack and the next "
+         "instruction\n"
+      << "  x ADDR [LEN]    dump LEN bytes (default 16) of memory\n"
+      << "  dis [ADDR] [N]  disassemble N instructions (default 8) from ADDR "
+         "(default pc)\n"
+      << "  set REG VALUE   set a register\n"
+      << "  key K 1|0       press or release key K\n"
+      << "  screen          print the display\n"
+      << "  reset           reset the machine\n"
+      << "  q               quit\n"
+      << "an empty line repeats the last command\n";
+}
+
+PChip8::Debugger *activeDebugger = nullptr;
+
+void onInterrupt(int) {
+  if (activeDebugger)
+    activeDebugger->interrupt();
+}
+
+uint16_t parseHex(const std::string &text) {
+  std::size_t end = 0;
+  unsigned long value = 0;
+  try {
+    value = std::stoul(text, &end, 16);
+  } catch (std::exception &) {
+  }
+  if (end == 0 || end != text.size() || value > 0xFFFF)
+    throw std::invalid_argument("bad number " + text);
+  return value;
+}
+
+uint64_t parseCount(const std::string &text) {
+  std::size_t end = 0;
+  uint64_t value = 0;
+  try {
+    value = std::stoull(text, &end);
+  } catch (std::exception &) {
+  }
+  if (end == 0 || end != text.size())
+    throw std::invalid_argument("bad count " + text);
+  return value;
+}
+
+// v0-vf or i, throws std::invalid_argument otherwise
+int parseRegister(const std::string &text) {
+  if (text == "i" || text == "I")
+    return PChip8::REGISTER_I;
+  if (text.size() == 2 && (text[0] == 'v' || text[0] == 'V')) {
+    std::size_t digit = std::string_view{"0123456789abcdef"}.find(
+        std::tolower(static_cast<unsigned char>(text[1])));
+    if (digit < PChip8::VREG_COUNT)
+      return digit;
+  }
+  throw std::invalid_argument("bad register " + text);
+}
+
+bool isRegister(const std::string &text) {
+  try {
+    parseRegister(text);
+    return true;
+  } catch (std::exception &) {
+    return false;
+  }
+}
+
+std::string registerName(int reg) {
+  if (reg == PChip8::REGISTER_I)
+    return "I";
+  std::ostringstream name;
+  name << 'V' << std::hex << std::uppercase << reg;
+  return name.str();
+}
+
+std::string hex(unsigned int value, int width) {
+  std::ostringstream text;
+  text << std::hex << std::uppercase << std::setw(width) << std::setfill('0')
+       << value;
+  return text.str();
+}
+
+void printInstruction(const PChip8::Debugger &debugger, uint16_t address) {
+  std::cout << hex(address, 3) << "  "
+            << PChip8::Debugger::disassemble(debugger.opCodeAt(address))
+            << '\n';
+}
+
+void printState(const PChip8::Chip8 &chip8,
+                const PChip8::Debugger &debugger) {
+  std::cout << "pc=" << hex(chip8.getPC(), 3)
+            << " I=" << hex(debugger.getRegister(PChip8::REGISTER_I), 3)
+            << " dt=" << hex(chip8.getDelayTimer(), 2)
+            << " st=" << hex(chip8.getSoundTimer(), 2)
+            << " cycle=" << chip8.getCycleCount() << '\n'
+            << "V0-VF";
+  for (int reg = 0; reg < PChip8::VREG_COUNT; ++reg) {
+    std::cout << ' ' << hex(debugger.getRegister(reg), 2);
+  }
+  std::cout << "\nstack";
+  for (uint16_t address : debugger.getCallStack()) {
+    std::cout << ' ' << hex(address, 3);
+  }
+  std::cout << '\n';
+  printInstruction(debugger, chip8.getPC());
+}
+
+void printStop(const PChip8::DebugStop &stop, const PChip8::Chip8 &chip8,
+               const PChip8::Debugger &debugger) {
+  using PChip8::StopReason;
+  switch (stop.reason) {
+  case StopReason::Finished:
+    break;
+  case StopReason::Watchpoint:
+    std::cout << "watchpoint: " << hex(stop.pc, 3) << " wrote "
+              << hex(stop.address, 3) << '\n';
+    break;
+  case StopReason::RegisterChange: {
+    int width = stop.reg == PChip8::REGISTER_I ? 3 : 2;
+    std::cout << "register change: " << hex(stop.pc, 3) << " changed "
+              << registerName(stop.reg) << " from "
+              << hex(stop.oldValue, width) << " to "
+              << hex(stop.newValue, width) << '\n';
+    break;
+  }
+  default:
+    std::cout << PChip8::stopReasonName(stop.reason) << " at "
+              << hex(stop.pc, 3) << '\n';
+    break;
+  }
+  printState(chip8, debugger);
+}
+
+void printScreen(const PChip8::Chip8 &chip8) {
+  static constexpr const char *BLOCKS[] = {" ", "▀", "▄", "█"};
+  const auto &display = chip8.display;
+  auto lit = [&display](int x, int y) {
+    int index = y * display.getWordsPerRow() + x / 64;
+    int bit = 63 - x % 64;
+    return ((display.getRows(0)[index] | display.getRows(1)[index]) >> bit) &
+           1;
+  };
+  for (int y = 0; y < display.getHeight(); y += 2) {
+    for (int x = 0; x < display.getWidth(); ++x) {
+      std::cout << BLOCKS[lit(x, y) | lit(x, y + 1) << 1];
+    }
+    std::cout << '\n';
+  }
+}
+
+// Execute one command line, false to quit. Throws std::exception on bad
+// arguments or when the machine stops with an error.
+bool execute(const std::vector<std::string> &args, PChip8::Chip8 &chip8,
+             PChip8::Scheduler &scheduler, PChip8::Debugger &debugger) {
+  const std::string &command = args[0];
+  auto arg = [&args](std::size_t i) -> const std::string & {
+    if (i >= args.size())
+      throw std::invalid_argument("missing argument");
+    return args[i];
+  };
+
+  if (command == "b") {
+    debugger.addBreakpoint(parseHex(arg(1)));
+  } else if (command == "w") {
+    uint16_t length = args.size() > 2 ? parseCount(args[2]) : 1;
+    debugger.addWatchpoint(parseHex(arg(1)), length);
+  } else if (command == "r") {
+    PChip8::RegisterWatch watch{.reg = parseRegister(arg(1)),
+                                .value = std::nullopt};
+    if (args.size() > 2)
+      watch.value = parseHex(args[2]);
+    debugger.addRegisterWatch(watch);
+  } else if (command == "d") {
+    bool found = isRegister(arg(1))
+                     ? debugger.removeRegisterWatch(parseRegister(args[1]))
+                     : debugger.removeBreakpoint(parseHex(args[1])) |
+                           debugger.removeWatchpoint(parseHex(args[1]));
+    if (!found)
+      std::cout << "nothing at " << args[1] << '\n';
+  } else if (command == "l") {
+    for (uint16_t address : debugger.getBreakpoints()) {
+      std::cout << "break " << hex(address, 3) << '\n';
+    }
+    for (const auto &[address, length] : debugger.getWatchpoints()) {
+      std::cout << "watch " << hex(address, 3) << ' ' << length << '\n';
+    }
+    for (const auto &watch : debugger.getRegisterWatches()) {
+      std::cout << "register " << registerName(watch.reg);
+      if (watch.value)
+        std::cout << " = " << hex(*watch.value, 2);
+      std::cout << '\n';
+    }
+  } else if (command == "c") {
+    auto stop = args.size() > 1 ? debugger.run(parseCount(args[1]))
+                                : debugger.resume();
+    printStop(stop, chip8, debugger);
+  } else if (command == "s") {
+    uint64_t count = args.size() > 1 ? parseCount(args[1]) : 1;
+    PChip8::DebugStop stop;
+    for (uint64_t i = 0; i < count && stop.reason ==
+                                          PChip8::StopReason::Finished;
+         ++i) {
+      stop = debugger.step();
+    }
+    printStop(stop, chip8, debugger);
+  } else if (command == "p") {
+    printState(chip8, debugger);
+  } else if (command == "x") {
+    uint16_t address = parseHex(arg(1));
+    uint64_t length = args.size() > 2 ? parseCount(args[2]) : 16;
+    for (uint64_t i = 0; i < length; ++i) {
+      if (i % 16 == 0)
+        std::cout << (i > 0 ? "\n" : "") << hex(address + i, 3) << ':';
+      std::cout << ' ' << hex(debugger.peek(address + i), 2);
+    }
+    std::cout << '\n';
+  } else if (command == "dis") {
+    uint16_t address = args.size() > 1 ? parseHex(args[1]) : chip8.getPC();
+    uint64_t count = args.size() > 2 ? parseCount(args[2]) : 8;
+    for (uint64_t i = 0; i < count; ++i) {
+      printInstruction(debugger, address + 2 * i);
+    }
+  } else if (command == "set") {
+    debugger.setRegister(parseRegister(arg(1)), parseHex(arg(2)));
+  } else if (command == "key") {
+    uint16_t key = parseHex(arg(1));
+    if (key >= PChip8::KEY_COUNT)
+      throw std::invalid_argument("bad key " + args[1]);
+    // before the next instruction, through the scheduler like any key
+    scheduler.getInput().push({.cycle = chip8.getCycleCount(),
+                               .key = static_cast<uint8_t>(key),
+                               .pressed = arg(2) != "0"});
+  } else if (command == "screen") {
+    printScreen(chip8);
+  } else if (command == "reset") {
+    scheduler.getInput().flush(chip8);
+    chip8.reset();
+  } else if (command == "q") {
+    return false;
+  } else if (command == "h" || command == "help") {
+    printHelp();
+  } else {
+    std::cout << "unknown command " << command << ", h for help\n";
+  }
+  return true;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  uint32_t instructionsPerFrame = 12;
+  PChip8::Engine engine = PChip8::DEFAULT_ENGINE;
+  PChip8::QuirkProfile quirks = PChip8::DEFAULT_QUIRKS;
+  uint64_t seed = 0;
+  std::string romFile;
+
+  try {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      if ((arg == "-f" || arg == "-q" || arg == "-e" || arg == "-s") &&
+          i + 1 >= argc) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      if (arg == "-f") {
+        instructionsPerFrame = std::stoul(argv[++i]);
+      } else if (arg == "-q") {
+        quirks = PChip8::parseQuirkProfile(argv[++i]);
+      } else if (arg == "-e") {
+        engine = PChip8::parseEngine(argv[++i]);
+      } else if (arg == "-s") {
+        seed = std::stoull(argv[++i]);
+      } else if (arg == "-h" || arg == "--help") {
+        printUsage(argv[0]);
+        return EXIT_SUCCESS;
+      } else {
+        romFile = arg;
+      }
+    }
+  } catch (std::exception &e) {
+    std::cerr << "error: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+
+  if (romFile.empty()) {
+    printUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  PChip8::Chip8 chip8;
+  chip8.setEngine(engine);
+  chip8.setQuirks(quirks);
+  chip8.seedRandom(seed);
+  try {
+    chip8.loadROM(romFile);
+  } catch (std::exception &e) {
+    std::cerr << "error: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+
+  PChip8::Scheduler scheduler{
+      chip8, {.instructionsPerFrame = instructionsPerFrame, .turbo = true}};
+  PChip8::Debugger debugger{chip8, scheduler};
+  activeDebugger = &debugger;
+  std::signal(SIGINT, onInterrupt);
+
+  printState(chip8, debugger);
+  std::vector<std::string> lastArgs;
+  std::string line;
+  while (std::cout << "(pchip8) " << std::flush && std::getline(std::cin, line)) {
+    std::istringstream words{line};
+    std::vector<std::string> args;
+    for (std::string word; words >> word;) {
+      args.push_back(word);
+    }
+    if (args.empty())
+      args = lastArgs;
+    if (args.empty())
+      continue;
+    lastArgs = args;
+
+    try {
+      if (!execute(args, chip8, scheduler, debugger))
+        break;
+    } catch (std::exception &e) {
+      std::cout << "error: " << e.what() << '\n';
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,265 @@
+#include "debugger.h"
+#include "opcodes.h"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace PChip8 {
+std::string_view stopReasonName(StopReason reason) {
+  switch (reason) {
+  case StopReason::Finished:
+    return "finished";
+  case StopReason::Breakpoint:
+    return "breakpoint";
+  case StopReason::Watchpoint:
+    return "watchpoint";
+  case StopReason::RegisterChange:
+    return "register change";
+  case StopReason::WaitingForKey:
+    return "waiting for a key";
+  case StopReason::Halted:
+    return "halted";
+  case StopReason::Interrupted:
+    return "interrupted";
+  }
+  return "unknown";
+}
+
+Debugger::Debugger(Chip8 &chip8, Scheduler &scheduler)
+    : chip8(chip8), scheduler(scheduler) {}
+
+Debugger::~Debugger() { chip8.setDebugHook(nullptr); }
+
+// ---- BREAKPOINTS AND WATCHES ----
+
+void Debugger::addBreakpoint(uint16_t address) {
+  if (!breakpoints.test(address & MEMORY_MASK))
+    ++breakpointCount;
+  breakpoints.set(address & MEMORY_MASK);
+  updateHook();
+}
+
+bool Debugger::removeBreakpoint(uint16_t address) {
+  bool found = breakpoints.test(address & MEMORY_MASK);
+  breakpointCount -= found;
+  breakpoints.reset(address & MEMORY_MASK);
+  updateHook();
+  return found;
+}
+
+void Debugger::addWatchpoint(uint16_t address, uint16_t length) {
+  removeWatchpoint(address);
+  watchpoints.emplace_back(address & MEMORY_MASK,
+                           std::clamp<uint16_t>(length, 1, MEMORY_SIZE));
+  updateHook();
+}
+
+bool Debugger::removeWatchpoint(uint16_t address) {
+  bool found = std::erase_if(watchpoints, [address](const auto &watchpoint) {
+                 return watchpoint.first == (address & MEMORY_MASK);
+               }) > 0;
+  updateHook();
+  return found;
+}
+
+void Debugger::addRegisterWatch(RegisterWatch watch) {
+  removeRegisterWatch(watch.reg);
+  registerWatches.push_back(watch);
+  updateHook();
+}
+
+bool Debugger::removeRegisterWatch(int reg) {
+  bool found =
+      std::erase_if(registerWatches, [reg](const RegisterWatch &watch) {
+        return watch.reg == reg;
+      }) > 0;
+  updateHook();
+  return found;
+}
+
+void Debugger::clearAll() {
+  breakpoints.reset();
+  breakpointCount = 0;
+  watchpoints.clear();
+  registerWatches.clear();
+  updateHook();
+}
+
+bool Debugger::isArmed() const {
+  return breakpointCount > 0 || !watchpoints.empty() ||
+         !registerWatches.empty();
+}
+
+std::vector<uint16_t> Debugger::getBreakpoints() const {
+  std::vector<uint16_t> addresses;
+  for (int address = 0; address < MEMORY_SIZE; ++address) {
+    if (breakpoints.test(address))
+      addresses.push_back(address);
+  }
+  return addresses;
+}
+
+const std::vector<std::pair<uint16_t, uint16_t>> &
+Debugger::getWatchpoints() const {
+  return watchpoints;
+}
+
+const std::vector<RegisterWatch> &Debugger::getRegisterWatches() const {
+  return registerWatches;
+}
+
+// ---- RUNNING ----
+
+DebugStop Debugger::run(uint64_t cycles) {
+  stop = {};
+  // unarmed, the scheduler runs without stopping anywhere
+  if (!isArmed() && cycles > 0)
+    stoppedAt.reset();
+  scheduler.runCycles(cycles);
+  return stop;
+}
+
+DebugStop Debugger::resume() {
+  interrupted.store(false, std::memory_order_relaxed);
+  while (true) {
+    // between frames nothing changes while the machine waits for a key or
+    // spins on a jump to itself, unless a queued key event changes it
+    if (scheduler.getCyclesIntoFrame() == 0 &&
+        scheduler.getInput().empty()) {
+      IdleState idle = chip8.idleState();
+      if (idle == IdleState::WaitingForKey)
+        return {.reason = StopReason::WaitingForKey, .pc = chip8.pc};
+      if (idle == IdleState::Halted)
+        return {.reason = StopReason::Halted, .pc = chip8.pc};
+    }
+    if (interrupted.exchange(false, std::memory_order_relaxed))
+      return {.reason = StopReason::Interrupted, .pc = chip8.pc};
+
+    DebugStop frameStop = run(scheduler.getConfig().instructionsPerFrame -
+                              scheduler.getCyclesIntoFrame());
+    if (frameStop.reason != StopReason::Finished)
+      return frameStop;
+  }
+}
+
+DebugStop Debugger::step() {
+  // stepping is how to get past a breakpoint
+  stoppedAt = chip8.pc & MEMORY_MASK;
+  return run(1);
+}
+
+void Debugger::interrupt() {
+  interrupted.store(true, std::memory_order_relaxed);
+}
+
+void Debugger::updateHook() { chip8.setDebugHook(isArmed() ? this : nullptr); }
+
+bool Debugger::beforeInstruction(uint16_t pc) {
+  // a stop after the last instruction of a frame ends the next one at once
+  if (stop.reason != StopReason::Finished)
+    return false;
+  if (breakpoints.test(pc) && stoppedAt != pc) {
+    stoppedAt = pc;
+    stop = {.reason = StopReason::Breakpoint, .pc = pc};
+    return false;
+  }
+  stoppedAt.reset();
+
+  instructionPC = pc;
+  watchedWrite.reset();
+  for (const auto &watch : registerWatches) {
+    registersBefore[watch.reg] = getRegister(watch.reg);
+  }
+  return true;
+}
+
+bool Debugger::afterInstruction() {
+  if (watchedWrite) {
+    stop = {.reason = StopReason::Watchpoint,
+            .pc = instructionPC,
+            .address = *watchedWrite};
+    return false;
+  }
+  for (const auto &watch : registerWatches) {
+    uint16_t value = getRegister(watch.reg);
+    uint16_t before = registersBefore[watch.reg];
+    if (value != before && (!watch.value || value == watch.value)) {
+      stop = {.reason = StopReason::RegisterChange,
+              .pc = instructionPC,
+              .reg = watch.reg,
+              .oldValue = before,
+              .newValue = value};
+      return false;
+    }
+  }
+  return true;
+}
+
+void Debugger::memoryWritten(uint16_t address) {
+  if (watchedWrite)
+    return;
+  for (const auto &[begin, length] : watchpoints) {
+    // the distance past begin, wrapping around the end of memory
+    if (((address - begin) & MEMORY_MASK) < length) {
+      watchedWrite = address;
+      return;
+    }
+  }
+}
+
+// ---- INSPECTION ----
+
+uint16_t Debugger::getRegister(int reg) const {
+  return reg == REGISTER_I ? chip8.I : chip8.V[reg];
+}
+
+void Debugger::setRegister(int reg, uint16_t value) {
+  if (reg == REGISTER_I)
+    chip8.I = value;
+  else
+    chip8.V[reg] = value & 0xFF;
+}
+
+uint8_t Debugger::peek(uint16_t address) const {
+  return chip8.memory[address & MEMORY_MASK];
+}
+
+std::span<const uint16_t> Debugger::getCallStack() const {
+  return {chip8.stack.data(), chip8.sp};
+}
+
+uint16_t Debugger::opCodeAt(uint16_t address) const {
+  return peek(address) << 8 | peek(address + 1);
+}
+
+std::string Debugger::disassemble(uint16_t opCode) {
+  Op op = decodeOp(opCode);
+  std::string_view pattern = OP_PATTERNS[static_cast<int>(op)];
+
+  std::ostringstream text;
+  text << std::hex << std::uppercase << std::setfill('0') << std::setw(4)
+       << opCode << ' ' << OP_NAMES[static_cast<int>(op)];
+  if (op == Op::UNKNOWN)
+    return text.str();
+
+  // every run of operand letters in the pattern names the nibbles under it
+  for (std::size_t i = 0; i < pattern.size();) {
+    char letter = pattern[i];
+    std::size_t end = pattern.find_first_not_of(letter, i);
+    end = end == std::string_view::npos ? pattern.size() : end;
+    if (letter == 'X' || letter == 'Y' || letter == 'N' || letter == 'K') {
+      int width = end - i;
+      int value = (opCode >> (4 * (pattern.size() - end))) &
+                  ((1 << (4 * width)) - 1);
+      text << ' ' << std::nouppercase;
+      for (std::size_t j = i; j < end; ++j) {
+        text << static_cast<char>(letter - 'A' + 'a');
+      }
+      text << '=' << (width > 1 ? "0x" : "") << std::uppercase
+           << std::setw(width) << value;
+    }
+    i = end;
+  }
+  return text.str();
+}
+} // namespace PChip8
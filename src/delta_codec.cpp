@@ -0,0 +1,93 @@
+#include "delta_codec.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace PChip8 {
+void encodeDelta(std::span<const uint8_t> data,
+                 std::span<const uint8_t> reference,
+                 std::vector<uint8_t> &out) {
+  const DeltaRange whole{0, data.size()};
+  encodeDelta(data, reference, std::span{&whole, 1}, out);
+}
+
+void encodeDelta(std::span<const uint8_t> data,
+                 std::span<const uint8_t> reference,
+                 std::span<const DeltaRange> ranges,
+                 std::vector<uint8_t> &out) {
+  out.clear();
+  // end of the last literal, where the next unchanged run starts
+  std::size_t zeroStart = 0;
+
+  for (auto [begin, end] : ranges) {
+    std::size_t pos = begin;
+    while (pos < end) {
+      // most of the data is unchanged, skip it a word at a time
+      while (pos + 8 <= end &&
+             std::memcmp(&data[pos], &reference[pos], 8) == 0) {
+        pos += 8;
+      }
+      while (pos < end && data[pos] == reference[pos]) {
+        ++pos;
+      }
+      if (pos == end)
+        break;
+
+      // a literal reaching the end of the range ends there, the bytes after
+      // it are unchanged
+      std::size_t literalStart = pos;
+      std::size_t zeros = 0;
+      while (pos < end && zeros < DELTA_MIN_ZERO_RUN) {
+        zeros = data[pos] == reference[pos] ? zeros + 1 : 0;
+        ++pos;
+      }
+      std::size_t literalEnd = pos - zeros;
+
+      putVarint(out, literalStart - zeroStart);
+      putVarint(out, literalEnd - literalStart);
+      for (std::size_t i = literalStart; i < literalEnd; ++i) {
+        out.push_back(data[i] ^ reference[i]);
+      }
+      pos = literalEnd;
+      zeroStart = literalEnd;
+    }
+  }
+}
+
+void applyDelta(std::span<const uint8_t> delta, std::span<uint8_t> data) {
+  const uint8_t *in = delta.data();
+  const uint8_t *end = in + delta.size();
+  std::size_t pos = 0;
+
+  while (in < end) {
+    pos += getVarint(in, end);
+    uint64_t literalLength = getVarint(in, end);
+    if (literalLength > static_cast<uint64_t>(end - in) ||
+        pos + literalLength > data.size())
+      throw std::runtime_error("corrupt delta");
+    for (uint64_t i = 0; i < literalLength; ++i) {
+      data[pos++] ^= *in++;
+    }
+  }
+}
+
+void putVarint(std::vector<uint8_t> &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  out.push_back(value);
+}
+
+uint64_t getVarint(const uint8_t *&in, const uint8_t *end) {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (in == end)
+      break;
+    uint8_t byte = *in++;
+    value |= uint64_t{byte & 0x7Fu} << shift;
+    if ((byte & 0x80) == 0)
+      return value;
+  }
+  throw std::runtime_error("corrupt varint");
+}
+} // namespace PChip8
@@ -0,0 +1,419 @@
+#include "chip8.h"
+#include "aot_runtime.h"
+#include <stdexcept>
+
+#ifdef PCHIP8_HAS_JIT
+#include "jit.h"
+#endif
+
+namespace PChip8 {
+std::string_view engineName(Engine engine) {
+  switch (engine) {
+  case Engine::Switch:
+    return "switch";
+  case Engine::Table:
+    return "table";
+  case Engine::Threaded:
+    return "threaded";
+  case Engine::Predecoded:
+    return "predecoded";
+  case Engine::Jit:
+    return "jit";
+  case Engine::Aot:
+    return "aot";
+  }
+  return "unknown";
+}
+
+Engine parseEngine(std::string_view name) {
+  for (auto engine : {Engine::Switch, Engine::Table, Engine::Threaded,
+                      Engine::Predecoded, Engine::Jit, Engine::Aot}) {
+    if (engineName(engine) == name)
+      return engine;
+  }
+  throw std::invalid_argument("unknown engine " + std::string(name));
+}
+
+std::string_view quirkProfileName(QuirkProfile profile) {
+  switch (profile) {
+#define PCHIP8_QUIRK_NAME(profile, name)                                       \
+  case QuirkProfile::profile:                                                  \
+    return name;
+    PCHIP8_QUIRK_PROFILES(PCHIP8_QUIRK_NAME)
+#undef PCHIP8_QUIRK_NAME
+  }
+  return "unknown";
+}
+
+QuirkProfile parseQuirkProfile(std::string_view name) {
+  for (int profile = 0; profile < QUIRK_PROFILE_COUNT; ++profile) {
+    if (quirkProfileName(static_cast<QuirkProfile>(profile)) == name)
+      return static_cast<QuirkProfile>(profile);
+  }
+  throw std::invalid_argument("unknown quirk profile " + std::string(name));
+}
+
+// The engine and quirk profile are picked once per run, every loop below is
+// compiled once for each profile with the quirks folded in
+uint64_t Chip8::run(uint64_t cycles) {
+  return debugHook ? runHooked(cycles) : runEngine(cycles);
+}
+
+uint64_t Chip8::runEngine(uint64_t cycles) {
+  switch (quirks) {
+#define PCHIP8_QUIRK_RUN(profile, name)                                        \
+  case QuirkProfile::profile:                                                  \
+    return runWithQuirks<QuirkProfile::profile>(cycles);
+    PCHIP8_QUIRK_PROFILES(PCHIP8_QUIRK_RUN)
+#undef PCHIP8_QUIRK_RUN
+  }
+  return 0;
+}
+
+uint64_t Chip8::runHooked(uint64_t cycles) {
+  uint64_t executed = 0;
+  while (executed < cycles && debugHook->beforeInstruction(pc & MEMORY_MASK)) {
+    runEngine(1);
+    ++executed;
+    if (!debugHook->afterInstruction())
+      break;
+  }
+  return executed;
+}
+
+template <QuirkProfile Profile>
+uint64_t Chip8::runWithQuirks(uint64_t cycles) {
+  switch (engine) {
+  case Engine::Switch:
+    return runSwitch<Profile>(cycles);
+  case Engine::Table:
+    return runTable<Profile>(cycles);
+  case Engine::Threaded:
+    return runThreaded<Profile>(cycles);
+  case Engine::Predecoded:
+    // the decode cache holds handlers of the current profile already
+    return runPredecoded(cycles);
+  case Engine::Jit:
+    return runJit(cycles);
+  case Engine::Aot:
+    return runAot(cycles);
+  }
+  return 0;
+}
+
+// ---- SWITCH ----
+
+template <QuirkProfile Profile> void Chip8::executeSwitch() {
+  // parse first nibble first
+  switch (current.opCode & 0xF000) {
+  case 0x0000:
+    switch (current.opCode & 0x0FF0) {
+    case 0x00C0:
+      return opCode_SCD<Profile>();
+    case 0x00D0:
+      return opCode_SCU<Profile>();
+    case 0x00E0:
+      switch (current.opCode & 0x000F) {
+      case 0x0000:
+        return opCode_CLS<Profile>();
+      case 0x000E:
+        return opCode_RET<Profile>();
+      default:
+        throwUnknownOpCode();
+      }
+      break;
+    case 0x00F0:
+      switch (current.opCode & 0x000F) {
+      case 0x000B:
+        return opCode_SCR<Profile>();
+      case 0x000C:
+        return opCode_SCL<Profile>();
+      case 0x000D:
+        return opCode_EXIT<Profile>();
+      case 0x000E:
+        return opCode_LOW<Profile>();
+      case 0x000F:
+        return opCode_HIGH<Profile>();
+      default:
+        throwUnknownOpCode();
+      }
+      break;
+    default:
+      throwUnknownOpCode();
+    }
+    break;
+  case 0x1000:
+    return opCode_JP<Profile>();
+  case 0x2000:
+    return opCode_CALL<Profile>();
+  case 0x3000:
+    return opCode_SE_VX_KK<Profile>();
+  case 0x4000:
+    return opCode_SNE_VX_KK<Profile>();
+  case 0x5000:
+    return opCode_SE_VX_VY<Profile>();
+  case 0x6000:
+    return opCode_LD_VX_KK<Profile>();
+  case 0x7000:
+    return opCode_ADD_VX_KK<Profile>();
+  case 0x8000:
+    switch (current.opCode & 0x000F) {
+    case 0x0000:
+      return opCode_LD_VX_VY<Profile>();
+    case 0x0001:
+      return opCode_OR_VX_VY<Profile>();
+    case 0x0002:
+      return opCode_AND_VX_VY<Profile>();
+    case 0x0003:
+      return opCode_XOR_VX_VY<Profile>();
+    case 0x0004:
+      return opCode_ADD_VX_VY<Profile>();
+    case 0x0005:
+      return opCode_SUB_VX_VY<Profile>();
+    case 0x0006:
+      return opCode_SHR_VX<Profile>();
+    case 0x0007:
+      return opCode_SUBN_VX_VY<Profile>();
+    case 0x000E:
+      return opCode_SHL_VX<Profile>();
+    default:
+      throwUnknownOpCode();
+    }
+    break;
+  case 0x9000:
+    return opCode_SNE_VX_VY<Profile>();
+  case 0xA000:
+    return opCode_LD_I<Profile>();
+  case 0xB000:
+    return opCode_JP_V0<Profile>();
+  case 0xC000:
+    return opCode_RND_VX<Profile>();
+  case 0xD000:
+    return opCode_DRW_VX_VY<Profile>();
+  case 0xE000:
+    switch (current.opCode & 0x00FF) {
+      case 0x009E:
+        return opCode_SKP_VX<Profile>();
+      case 0x00A1:
+        return opCode_SKNP_VX<Profile>();
+      default:
+        throwUnknownOpCode();
+    }
+  case 0xF000:
+    switch (current.opCode & 0x00FF) {
+      case 0x0001:
+        return opCode_PLANE<Profile>();
+      case 0x0007:
+        return opCode_LD_VX_DT<Profile>();
+      case 0x000A:
+        return opCode_LD_VX_K<Profile>();
+      case 0x0015:
+        return opCode_LD_DT_VX<Profile>();
+      case 0x0018:
+        return opCode_LD_ST_VX<Profile>();
+      case 0x001E:
+        return opCode_ADD_I_VX<Profile>();
+      case 0x0029:
+        return opCode_LD_F_VX<Profile>();
+      case 0x0033:
+        return opCode_LD_B_VX<Profile>();
+      case 0x0055:
+        return opCode_LD_I_VX<Profile>();
+      case 0x0065:
+        return opCode_LD_VX_I<Profile>();
+      default:
+        throwUnknownOpCode();
+    }
+  default:
+    throwUnknownOpCode();
+  }
+}
+
+template <QuirkProfile Profile> uint64_t Chip8::runSwitch(uint64_t cycles) {
+  for (uint64_t executed = 0; executed < cycles; ++executed) {
+    uint16_t address = pc;
+    fetch();
+    executeSwitch<Profile>();
+    profileStep(address);
+  }
+  return cycles;
+}
+
+// ---- TABLE -----
+
+template <QuirkProfile Profile> Chip8::OpHandler Chip8::handlerFor(Op op) {
+  static constexpr std::array<OpHandler, OP_COUNT> handlers = {
+#define PCHIP8_OP_HANDLER(name, pattern) &invoke<&Chip8::opCode_##name<Profile>>,
+      PCHIP8_OPCODES(PCHIP8_OP_HANDLER)
+#undef PCHIP8_OP_HANDLER
+  };
+  return handlers[static_cast<int>(op)];
+}
+
+Chip8::OpHandler Chip8::handlerFor(QuirkProfile profile, Op op) {
+  switch (profile) {
+#define PCHIP8_QUIRK_HANDLER(profile, name)                                    \
+  case QuirkProfile::profile:                                                  \
+    return handlerFor<QuirkProfile::profile>(op);
+    PCHIP8_QUIRK_PROFILES(PCHIP8_QUIRK_HANDLER)
+#undef PCHIP8_QUIRK_HANDLER
+  }
+  return nullptr;
+}
+
+const std::array<Op, 0x10000> &Chip8::opTable() {
+  static const auto table = [] {
+    std::array<Op, 0x10000> ops;
+    for (int opCode = 0; opCode < 0x10000; ++opCode) {
+      ops[opCode] = decodeOp(opCode);
+    }
+    return ops;
+  }();
+  return table;
+}
+
+template <QuirkProfile Profile>
+const std::array<Chip8::OpHandler, 0x10000> &Chip8::handlerTable() {
+  static const auto table = [] {
+    std::array<OpHandler, 0x10000> handlers;
+    for (int opCode = 0; opCode < 0x10000; ++opCode) {
+      handlers[opCode] = handlerFor<Profile>(opTable()[opCode]);
+    }
+    return handlers;
+  }();
+  return table;
+}
+
+template <QuirkProfile Profile> uint64_t Chip8::runTable(uint64_t cycles) {
+  const auto &handlers = handlerTable<Profile>();
+
+  for (uint64_t executed = 0; executed < cycles; ++executed) {
+    uint16_t address = pc;
+    fetch();
+    handlers[current.opCode](*this);
+    profileStep(address);
+  }
+  return cycles;
+}
+
+// --- THREADED ---
+
+template <QuirkProfile Profile> uint64_t Chip8::runThreaded(uint64_t cycles) {
+#if defined(__GNUC__) || defined(__clang__)
+  // every handler jumps straight to the next one
+  // instead of returning to a shared dispatch loop
+  static const void *const labels[OP_COUNT] = {
+#define PCHIP8_OP_LABEL(name, pattern) &&op_##name,
+      PCHIP8_OPCODES(PCHIP8_OP_LABEL)
+#undef PCHIP8_OP_LABEL
+  };
+  const auto &ops = opTable();
+  uint64_t executed = 0;
+  uint16_t address = pc;
+
+#define PCHIP8_DISPATCH()                                                      \
+  if (executed == cycles)                                                      \
+    return executed;                                                           \
+  ++executed;                                                                  \
+  address = pc;                                                                \
+  fetch();                                                                     \
+  goto *labels[static_cast<int>(ops[current.opCode])]
+
+  PCHIP8_DISPATCH();
+
+#define PCHIP8_OP_CASE(name, pattern)                                          \
+  op_##name:                                                                   \
+  opCode_##name<Profile>();                                                    \
+  profileStep(address);                                                        \
+  PCHIP8_DISPATCH();
+  PCHIP8_OPCODES(PCHIP8_OP_CASE)
+#undef PCHIP8_OP_CASE
+#undef PCHIP8_DISPATCH
+#else
+  return runTable<Profile>(cycles);
+#endif
+}
+
+// -- PREDECODED --
+
+template <QuirkProfile Profile> void Chip8::decodeAndExecute(Chip8 &chip8) {
+  // pc already points past this instruction,
+  // and current holds whatever the stale entry had in it
+  uint16_t address = (chip8.pc - 2) & MEMORY_MASK;
+  chip8.current = decodeInstruction((chip8.memory[address] << 8) |
+                                    chip8.memory[(address + 1) & MEMORY_MASK]);
+
+  auto &entry = chip8.decodeCache[address];
+  entry.instruction = chip8.current;
+  entry.handler = handlerTable<Profile>()[chip8.current.opCode];
+  entry.handler(chip8);
+}
+
+void Chip8::invalidateDecodeCache() {
+  switch (quirks) {
+#define PCHIP8_QUIRK_STUB(profile, name)                                       \
+  case QuirkProfile::profile:                                                  \
+    decodeStub = &decodeAndExecute<QuirkProfile::profile>;                     \
+    break;
+    PCHIP8_QUIRK_PROFILES(PCHIP8_QUIRK_STUB)
+#undef PCHIP8_QUIRK_STUB
+  }
+  for (auto &entry : decodeCache) {
+    entry.handler = decodeStub;
+  }
+#ifdef PCHIP8_HAS_JIT
+  if (jit)
+    jit->flush();
+#endif
+  // memory may hold a different ROM now, pick the program again on next run
+  aot.reset();
+}
+
+uint64_t Chip8::runPredecoded(uint64_t cycles) {
+  for (uint64_t executed = 0; executed < cycles; ++executed) {
+    uint16_t address = pc & MEMORY_MASK;
+    const auto &entry = decodeCache[address];
+    current = entry.instruction;
+    pc += 2;
+    ++cycleCount;
+    entry.handler(*this);
+    profileStep(address);
+  }
+  return cycles;
+}
+
+// ----- JIT ------
+
+void Chip8::invalidateJit(uint16_t address) {
+#ifdef PCHIP8_HAS_JIT
+  jit->invalidate(address);
+#endif
+}
+
+uint64_t Chip8::runJit(uint64_t cycles) {
+  // compiled blocks run many instructions without coming back to the
+  // interpreter, so instrumented builds interpret everything
+#if defined(PCHIP8_HAS_JIT) && !defined(PCHIP8_INSTRUMENTATION)
+  if (!jit)
+    jit = std::make_unique<Jit>();
+  return jit->run(*this, cycles);
+#else
+  return runPredecoded(cycles);
+#endif
+}
+
+// ----- AOT ------
+
+void Chip8::invalidateAot(uint16_t address) { aot->invalidate(address); }
+
+uint64_t Chip8::runAot(uint64_t cycles) {
+  // like the JIT, compiled blocks would hide instructions from the profile
+#ifndef PCHIP8_INSTRUMENTATION
+  if (!aot)
+    aot = std::make_unique<AotRuntime>(*this);
+  return aot->run(*this, cycles);
+#else
+  return runPredecoded(cycles);
+#endif
+}
+} // namespace PChip8
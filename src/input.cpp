@@ -0,0 +1,81 @@
+#include "input.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace PChip8 {
+void InputQueue::push(KeyEvent event) {
+  // events almost always arrive in order, so this is an append
+  auto position = std::upper_bound(
+      pending.begin(), pending.end(), event.cycle,
+      [](uint64_t cycle, const KeyEvent &queued) { return cycle < queued.cycle; });
+  pending.insert(position, event);
+}
+
+void InputQueue::applyDue(Chip8 &chip8, uint64_t cycle) {
+  while (!pending.empty() && pending.front().cycle <= cycle) {
+    const KeyEvent &event = pending.front();
+    chip8.keyPress[event.key % KEY_COUNT] = event.pressed;
+    pending.pop_front();
+  }
+}
+
+void InputQueue::flush(Chip8 &chip8) {
+  apply(chip8, std::numeric_limits<uint64_t>::max());
+}
+
+void InputQueue::clear() { pending.clear(); }
+
+void saveInputLog(const std::string &fileName, const InputLog &log) {
+  std::ofstream logData{fileName};
+  if (!logData)
+    throw std::runtime_error("Could not open " + fileName);
+
+  if (log.seed)
+    logData << "seed " << *log.seed << '\n';
+  for (const auto &event : log.events) {
+    logData << event.cycle << ' ' << std::hex << std::uppercase
+            << int{event.key} << std::dec << ' '
+            << (event.pressed ? "down" : "up") << '\n';
+  }
+  if (!logData)
+    throw std::runtime_error(fileName + " write failed");
+}
+
+InputLog loadInputLog(const std::string &fileName) {
+  std::ifstream logData{fileName};
+  if (!logData)
+    throw std::runtime_error("Could not open " + fileName);
+
+  InputLog log;
+  auto &events = log.events;
+  int lineNumber = 0;
+  for (std::string line; std::getline(logData, line);) {
+    ++lineNumber;
+    if (line.empty())
+      continue;
+
+    std::istringstream fields{line};
+    if (lineNumber == 1 && line.starts_with("seed ")) {
+      uint64_t seed = 0;
+      fields.ignore(5);
+      if (!(fields >> seed))
+        throw std::runtime_error(fileName + ":1: bad seed");
+      log.seed = seed;
+      continue;
+    }
+
+    uint64_t cycle = 0;
+    unsigned int key = 0;
+    std::string state;
+    fields >> cycle >> std::hex >> key >> state;
+    if (!fields || key > 0xF || (state != "down" && state != "up") ||
+        (!events.empty() && cycle < events.back().cycle))
+      throw std::runtime_error(fileName + ":" + std::to_string(lineNumber) +
+                               ": bad input event");
+    events.push_back({cycle, static_cast<uint8_t>(key), state == "down"});
+  }
+  return log;
+}
+} // namespace PChip8
@@ -0,0 +1,612 @@
+#include "jit.h"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+namespace PChip8 {
+namespace {
+// Register use inside generated code:
+//   rdi      base of V[], also addresses sp and the stack
+//   rsi      &I
+//   dx       I
+//   r10      the entry table
+//   r11      cycle budget left
+//   rbx, rbp, r8, r9, r12-r15  V registers cached by the running block
+//   al, cl, eax, ecx scratch, eax holds the next pc when a block exits
+constexpr std::array<uint8_t, 8> CACHE_REGISTERS = {3,  5,  8,  9,
+                                                    12, 13, 14, 15};
+constexpr uint8_t AL = 0;
+constexpr uint8_t VF = 0xF;
+
+constexpr uint8_t CMOVE = 0x44;
+constexpr uint8_t CMOVNE = 0x45;
+constexpr uint8_t SETC = 0x92;
+constexpr uint8_t SETAE = 0x93;
+
+// Where a V register lives while a block runs
+struct Location {
+  bool cached = false;
+  uint8_t code = 0; // host register when cached, V index otherwise
+};
+
+class Emitter {
+public:
+  std::vector<uint8_t> code;
+  std::array<Location, VREG_COUNT> locations{};
+  std::bitset<VREG_COUNT> dirty;
+  // rel32 fields of the jumps to the exit back to run(), patched once the
+  // block's place in the code buffer is known
+  std::vector<std::size_t> exitJumps;
+  // rel32 fields of the jumps taken when a call or return would overflow
+  // the stack
+  std::vector<std::size_t> bailJumps;
+  // sp and stack, relative to V
+  int32_t spOffset = 0;
+  int32_t stackOffset = 0;
+
+  void bytes(std::initializer_list<uint8_t> data) {
+    code.insert(code.end(), data.begin(), data.end());
+  }
+  void imm16(uint16_t value) {
+    code.push_back(value & 0xFF);
+    code.push_back(value >> 8);
+  }
+  void imm32(uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+      code.push_back((value >> (8 * i)) & 0xFF);
+    }
+  }
+
+  Location at(uint8_t v) const { return locations[v]; }
+  static Location inMemory(uint8_t v) { return Location{false, v}; }
+
+  // opcode with byte register reg in ModRM.reg and rm in ModRM.rm, always
+  // with a REX prefix so that register 5 is bpl rather than ch
+  void byteOp(std::initializer_list<uint8_t> opcode, uint8_t reg,
+              Location rm) {
+    code.push_back(0x40 | (reg >= 8 ? 0x04 : 0) |
+                   (rm.cached && rm.code >= 8 ? 0x01 : 0));
+    bytes(opcode);
+    if (rm.cached) {
+      code.push_back(0xC0 | (reg & 7) << 3 | (rm.code & 7));
+    } else {
+      // [rdi+disp8]
+      code.push_back(0x40 | (reg & 7) << 3 | 7);
+      code.push_back(rm.code);
+    }
+  }
+
+  // op V[x], V[y] for an instruction with both an r/m8, r8 form (toRM) and
+  // an r8, r/m8 form (fromRM), so that it takes a single instruction
+  // whenever one of the two is cached
+  void aluVV(uint8_t toRM, uint8_t fromRM, uint8_t x, uint8_t y) {
+    if (at(y).cached) {
+      byteOp({toRM}, at(y).code, at(x));
+    } else if (at(x).cached) {
+      byteOp({fromRM}, at(x).code, at(y));
+    } else {
+      loadAL(y);
+      byteOp({toRM}, AL, at(x));
+    }
+  }
+
+  // mov al, V[v]
+  void loadAL(uint8_t v) { byteOp({0x8A}, AL, at(v)); }
+  // mov V[v], al
+  void storeAL(uint8_t v) { byteOp({0x88}, AL, at(v)); }
+  // setcc VF from the flags of the last arithmetic instruction
+  void setVF(uint8_t setcc) { byteOp({0x0F, setcc}, 0, at(VF)); }
+  // mov VF, 0 for the profiles where logic instructions do
+  void resetVF(const Quirks &quirks) {
+    if (quirks.logicResetsVF) {
+      byteOp({0xC6}, 0, at(VF));
+      bytes({0x00});
+    }
+  }
+
+  // mov eax, imm32
+  void movEAX(uint32_t value) {
+    bytes({0xB8});
+    imm32(value);
+  }
+  // mov ecx, imm32
+  void movECX(uint32_t value) {
+    bytes({0xB9});
+    imm32(value);
+  }
+
+  // eax = condition ? skipTarget : nextTarget, with the flags already set
+  // by a compare; cmovCode is the second byte of the cmovcc opcode
+  void selectNextPC(uint8_t cmovCode, uint16_t nextTarget,
+                    uint16_t skipTarget) {
+    movEAX(nextTarget);
+    movECX(skipTarget);
+    bytes({0x0F, cmovCode, 0xC1});
+  }
+
+  // Emit opcode with a rel32 operand to be bound later, returns where the
+  // operand is
+  std::size_t jump(std::initializer_list<uint8_t> opcode) {
+    bytes(opcode);
+    imm32(0);
+    return code.size() - 4;
+  }
+  // Point the rel32 operand at `operand` to the current end of the code
+  void bind(std::size_t operand) {
+    int32_t rel = static_cast<int32_t>(code.size() - (operand + 4));
+    std::memcpy(code.data() + operand, &rel, sizeof(rel));
+  }
+  void jumpToExit(std::initializer_list<uint8_t> opcode) {
+    exitJumps.push_back(jump(opcode));
+  }
+
+  void loadCached() {
+    for (uint8_t v = 0; v < VREG_COUNT; ++v) {
+      if (at(v).cached)
+        byteOp({0x8A}, at(v).code, inMemory(v));
+    }
+  }
+  void writeBack() {
+    for (uint8_t v = 0; v < VREG_COUNT; ++v) {
+      if (at(v).cached && dirty[v])
+        byteOp({0x88}, at(v).code, inMemory(v));
+    }
+  }
+  // continue at entries[eax], the next block or the exit back to run()
+  void chain() { bytes({0x41, 0xFF, 0x24, 0xC2}); } // jmp [r10+rax*8]
+};
+
+enum class Translation { Compiled, Terminator, NotCompiled };
+
+Translation classify(Op op) {
+  switch (op) {
+  case Op::LD_VX_KK:
+  case Op::ADD_VX_KK:
+  case Op::LD_VX_VY:
+  case Op::OR_VX_VY:
+  case Op::AND_VX_VY:
+  case Op::XOR_VX_VY:
+  case Op::ADD_VX_VY:
+  case Op::SUB_VX_VY:
+  case Op::SUBN_VX_VY:
+  case Op::SHR_VX:
+  case Op::SHL_VX:
+  case Op::LD_I:
+  case Op::ADD_I_VX:
+    return Translation::Compiled;
+  case Op::JP:
+  case Op::CALL:
+  case Op::RET:
+  case Op::SE_VX_KK:
+  case Op::SNE_VX_KK:
+  case Op::SE_VX_VY:
+  case Op::SNE_VX_VY:
+    return Translation::Terminator;
+  default:
+    return Translation::NotCompiled;
+  }
+}
+
+// How often a block mentions each V register, and which ones it writes
+struct RegisterUse {
+  std::array<int, VREG_COUNT> count{};
+  std::bitset<VREG_COUNT> written;
+
+  void read(uint8_t v) { ++count[v]; }
+  void write(uint8_t v) {
+    ++count[v];
+    written.set(v);
+  }
+};
+
+void recordUse(RegisterUse &use, const Instruction &ins, Op op,
+               const Quirks &quirks) {
+  switch (op) {
+  case Op::LD_VX_KK:
+  case Op::ADD_VX_KK:
+    use.write(ins.x);
+    break;
+  case Op::LD_VX_VY:
+    use.write(ins.x);
+    use.read(ins.y);
+    break;
+  case Op::OR_VX_VY:
+  case Op::AND_VX_VY:
+  case Op::XOR_VX_VY:
+    use.write(ins.x);
+    use.read(ins.y);
+    if (quirks.logicResetsVF)
+      use.write(VF);
+    break;
+  case Op::ADD_VX_VY:
+  case Op::SUB_VX_VY:
+  case Op::SUBN_VX_VY:
+    use.write(ins.x);
+    use.read(ins.y);
+    use.write(VF);
+    break;
+  case Op::SHR_VX:
+  case Op::SHL_VX:
+    use.read(quirks.shiftReadsVY ? ins.y : ins.x);
+    use.write(ins.x);
+    use.write(VF);
+    break;
+  case Op::ADD_I_VX:
+  case Op::SE_VX_KK:
+  case Op::SNE_VX_KK:
+    use.read(ins.x);
+    break;
+  case Op::SE_VX_VY:
+  case Op::SNE_VX_VY:
+    use.read(ins.x);
+    use.read(ins.y);
+    break;
+  default:
+    break;
+  }
+}
+
+// Append the code for one instruction at address with the given quirks,
+// terminators leave the next pc in eax
+void translate(Emitter &emit, const Instruction &ins, Op op,
+               uint16_t address, const Quirks &quirks) {
+  uint16_t next = address + 2;
+
+  switch (op) {
+  case Op::LD_VX_KK:
+    emit.byteOp({0xC6}, 0, emit.at(ins.x)); // mov Vx, kk
+    emit.bytes({ins.kk});
+    break;
+  case Op::ADD_VX_KK:
+    emit.byteOp({0x80}, 0, emit.at(ins.x)); // add Vx, kk
+    emit.bytes({ins.kk});
+    break;
+  case Op::LD_VX_VY:
+    emit.aluVV(0x88, 0x8A, ins.x, ins.y);
+    break;
+  case Op::OR_VX_VY:
+    emit.aluVV(0x08, 0x0A, ins.x, ins.y);
+    emit.resetVF(quirks);
+    break;
+  case Op::AND_VX_VY:
+    emit.aluVV(0x20, 0x22, ins.x, ins.y);
+    emit.resetVF(quirks);
+    break;
+  case Op::XOR_VX_VY:
+    emit.aluVV(0x30, 0x32, ins.x, ins.y);
+    emit.resetVF(quirks);
+    break;
+  case Op::ADD_VX_VY:
+    emit.aluVV(0x00, 0x02, ins.x, ins.y);
+    emit.setVF(SETC);
+    break;
+  case Op::SUB_VX_VY:
+    // VF is set when there is no borrow
+    emit.aluVV(0x28, 0x2A, ins.x, ins.y);
+    emit.setVF(SETAE);
+    break;
+  case Op::SUBN_VX_VY:
+    emit.loadAL(ins.y);
+    emit.byteOp({0x2A}, AL, emit.at(ins.x)); // sub al, Vx
+    emit.storeAL(ins.x);
+    emit.setVF(SETAE);
+    break;
+  case Op::SHR_VX:
+    emit.loadAL(quirks.shiftReadsVY ? ins.y : ins.x);
+    emit.bytes({0xD0, 0xE8}); // shr al, 1
+    emit.storeAL(ins.x);
+    emit.setVF(SETC);
+    break;
+  case Op::SHL_VX:
+    emit.loadAL(quirks.shiftReadsVY ? ins.y : ins.x);
+    emit.bytes({0x00, 0xC0}); // add al, al
+    emit.storeAL(ins.x);
+    emit.setVF(SETC);
+    break;
+  case Op::LD_I:
+    // mov edx, nnn
+    emit.bytes({0xBA});
+    emit.imm32(ins.nnn);
+    break;
+  case Op::ADD_I_VX:
+    emit.byteOp({0x0F, 0xB6}, AL, emit.at(ins.x)); // movzx eax, Vx
+    emit.bytes({0x66, 0x01, 0xC2});                 // add dx, ax
+    break;
+  case Op::JP:
+    emit.movEAX(ins.nnn);
+    break;
+  case Op::CALL:
+    // movzx ecx, byte [rdi+sp]
+    emit.bytes({0x0F, 0xB6, 0x8F});
+    emit.imm32(emit.spOffset);
+    emit.bytes({0x83, 0xF9, STACK_DEPTH}); // cmp ecx, STACK_DEPTH
+    emit.bailJumps.push_back(emit.jump({0x0F, 0x84}));
+    // mov word [rdi+rcx*2+stack], next
+    emit.bytes({0x66, 0xC7, 0x84, 0x4F});
+    emit.imm32(emit.stackOffset);
+    emit.imm16(next);
+    // inc byte [rdi+sp]
+    emit.bytes({0xFE, 0x87});
+    emit.imm32(emit.spOffset);
+    emit.movEAX(ins.nnn);
+    break;
+  case Op::RET:
+    emit.bytes({0x0F, 0xB6, 0x8F});
+    emit.imm32(emit.spOffset);
+    emit.bytes({0x85, 0xC9}); // test ecx, ecx
+    emit.bailJumps.push_back(emit.jump({0x0F, 0x84}));
+    emit.bytes({0xFF, 0xC9}); // dec ecx
+    // mov [rdi+sp], cl
+    emit.bytes({0x88, 0x8F});
+    emit.imm32(emit.spOffset);
+    // movzx eax, word [rdi+rcx*2+stack]
+    emit.bytes({0x0F, 0xB7, 0x84, 0x4F});
+    emit.imm32(emit.stackOffset);
+    break;
+  case Op::SE_VX_KK:
+  case Op::SNE_VX_KK:
+    emit.byteOp({0x80}, 7, emit.at(ins.x)); // cmp Vx, kk
+    emit.bytes({ins.kk});
+    emit.selectNextPC(op == Op::SE_VX_KK ? CMOVE : CMOVNE, next, next + 2);
+    break;
+  case Op::SE_VX_VY:
+  case Op::SNE_VX_VY:
+    emit.aluVV(0x38, 0x3A, ins.x, ins.y); // cmp Vx, Vy
+    emit.selectNextPC(op == Op::SE_VX_VY ? CMOVE : CMOVNE, next, next + 2);
+    break;
+  default:
+    break;
+  }
+}
+} // namespace
+
+Jit::Jit() {
+  void *buffer = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffer == MAP_FAILED)
+    throw std::runtime_error("could not allocate JIT code buffer");
+
+  codeBuffer = static_cast<uint8_t *>(buffer);
+  pageSize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+
+  Emitter emit;
+  // push rbx, rbp, r12-r15
+  emit.bytes({0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+  emit.bytes({0x49, 0x89, 0xD3}); // mov r11, rdx
+  emit.bytes({0x49, 0x89, 0xCA}); // mov r10, rcx
+  emit.bytes({0x44, 0x89, 0xC0}); // mov eax, r8d
+  emit.bytes({0x0F, 0xB7, 0x16}); // movzx edx, word [rsi]
+  emit.chain();
+  std::size_t exitOffset = emit.code.size();
+  emit.bytes({0x66, 0x89, 0x16}); // mov [rsi], dx
+  emit.bytes({0x4C, 0x89, 0xDA}); // mov rdx, r11
+  // pop r15-r12, rbp, rbx
+  emit.bytes({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B});
+  emit.bytes({0xC3}); // ret
+
+  setWritable(0, emit.code.size(), true);
+  std::memcpy(codeBuffer, emit.code.data(), emit.code.size());
+  setWritable(0, emit.code.size(), false);
+
+  enter = reinterpret_cast<EnterFn>(codeBuffer);
+  exitCode = codeBuffer + exitOffset;
+  trampolineSize = emit.code.size();
+  flush();
+}
+
+Jit::~Jit() { munmap(codeBuffer, CODE_BUFFER_SIZE); }
+
+void Jit::setWritable(std::size_t offset, std::size_t size, bool writable) {
+  // keep the buffer W^X, only the pages a block is being emitted into are
+  // writable, and only meanwhile
+  std::size_t begin = offset & ~(pageSize - 1);
+  std::size_t end = (offset + size + pageSize - 1) & ~(pageSize - 1);
+  int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC;
+  if (mprotect(codeBuffer + begin, end - begin, protection) != 0)
+    throw std::runtime_error("could not change JIT code buffer protection");
+}
+
+void Jit::flush() {
+  blocks.fill(Block{});
+  entries.fill(exitCode);
+  codeMap.reset();
+  codeUsed = trampolineSize;
+}
+
+void Jit::invalidate(uint16_t address) {
+  address &= MEMORY_MASK;
+  if (!codeMap[address])
+    return;
+
+  // a block covering address starts at most MAX_BLOCK_LENGTH
+  // instructions before it, generated code is leaked until the next flush
+  int first = std::max(0, address - 2 * MAX_BLOCK_LENGTH + 1);
+  for (int start = first; start <= address; ++start) {
+    Block &block = blocks[start];
+    if (block.compiled && block.length != 0 &&
+        address < start + 2 * block.length) {
+      block.compiled = false;
+      entries[start] = exitCode;
+      if (block.invalidations < MAX_INVALIDATIONS)
+        ++block.invalidations;
+    }
+  }
+  // nothing covers address anymore, later stores can skip the scan
+  codeMap[address] = false;
+}
+
+const Jit::Block &Jit::compile(const Chip8 &chip8, uint16_t address) {
+  Block &block = blocks[address];
+  block.compiled = true;
+  block.length = 0;
+  if (block.invalidations == MAX_INVALIDATIONS)
+    return block;
+
+  // generated code is specialized for the machine's quirks, changing them
+  // flushes every block
+  const Quirks quirks = quirksOf(chip8.quirks);
+
+  // find the block's instructions first, the registers worth caching
+  // depend on all of them
+  std::array<Instruction, MAX_BLOCK_LENGTH> instructions;
+  std::array<Op, MAX_BLOCK_LENGTH> ops;
+  RegisterUse use;
+  uint16_t length = 0;
+  uint16_t end = address;
+  bool terminated = false;
+
+  // never wrap around the end of memory inside a block
+  while (length < MAX_BLOCK_LENGTH && end + 1 <= MEMORY_MASK) {
+    uint16_t opCode = (chip8.memory[end] << 8) | chip8.memory[end + 1];
+    Op op = decodeOp(opCode);
+    Translation kind = classify(op);
+    if (kind == Translation::NotCompiled)
+      break;
+
+    instructions[length] = decodeInstruction(opCode);
+    ops[length] = op;
+    recordUse(use, instructions[length], op, quirks);
+    ++length;
+    end += 2;
+    if (kind == Translation::Terminator) {
+      terminated = true;
+      break;
+    }
+  }
+
+  block.length = length;
+  if (length == 0)
+    return block;
+
+  Emitter emit;
+  const uint8_t *base = chip8.V.data();
+  emit.spOffset = static_cast<int32_t>(&chip8.sp - base);
+  emit.stackOffset = static_cast<int32_t>(
+      reinterpret_cast<const uint8_t *>(chip8.stack.data()) - base);
+  emit.dirty = use.written;
+
+  // cache the registers mentioned at least twice, most used first, a
+  // single use is as cheap straight from memory
+  std::array<uint8_t, VREG_COUNT> byUse;
+  std::iota(byUse.begin(), byUse.end(), 0);
+  std::stable_sort(byUse.begin(), byUse.end(), [&](uint8_t a, uint8_t b) {
+    return use.count[a] > use.count[b];
+  });
+  for (uint8_t v = 0; v < VREG_COUNT; ++v) {
+    emit.locations[v] = Emitter::inMemory(v);
+  }
+  for (std::size_t i = 0; i < CACHE_REGISTERS.size(); ++i) {
+    if (use.count[byUse[i]] < 2)
+      break;
+    emit.locations[byUse[i]] = Location{true, CACHE_REGISTERS[i]};
+  }
+
+  // enough budget left for the whole block, take it all up front
+  emit.bytes({0x49, 0x83, 0xFB, static_cast<uint8_t>(length)}); // cmp r11
+  std::size_t budgeted = emit.jump({0x0F, 0x82});                // jb
+  emit.bytes({0x49, 0x83, 0xEB, static_cast<uint8_t>(length)}); // sub r11
+  emit.loadCached();
+  for (uint16_t i = 0; i < length; ++i) {
+    translate(emit, instructions[i], ops[i], address + 2 * i, quirks);
+  }
+  if (!terminated)
+    emit.movEAX(end);
+  emit.writeBack();
+  if (ops[length - 1] == Op::RET) {
+    // a return address off the end of the entry table goes back to run()
+    emit.bytes({0x3D});
+    emit.imm32(ENTRY_COUNT);
+    emit.jumpToExit({0x0F, 0x83}); // jae
+  }
+  emit.chain();
+
+  if (!emit.bailJumps.empty()) {
+    // the call or return would overflow the stack, give the instruction
+    // back to the interpreter, which throws
+    for (std::size_t operand : emit.bailJumps) {
+      emit.bind(operand);
+    }
+    emit.bytes({0x49, 0x83, 0xC3, 0x01}); // add r11, 1
+    emit.movEAX(end - 2);
+    emit.writeBack();
+    emit.jumpToExit({0xE9});
+  }
+
+  // less budget than instructions: run them one by one and stop when it
+  // runs out, which is always before the terminator
+  emit.bind(budgeted);
+  emit.movEAX(address);
+  emit.bytes({0x4D, 0x85, 0xDB}); // test r11, r11
+  emit.jumpToExit({0x0F, 0x84});  // jz
+  emit.loadCached();
+  std::vector<std::size_t> budgetExits;
+  for (uint16_t i = 0; i + 1 < length; ++i) {
+    translate(emit, instructions[i], ops[i], address + 2 * i, quirks);
+    emit.movEAX(address + 2 * (i + 1));
+    emit.bytes({0x49, 0xFF, 0xCB}); // dec r11
+    budgetExits.push_back(emit.jump({0x0F, 0x84}));
+  }
+  emit.bytes({0x0F, 0x0B}); // ud2
+  for (std::size_t operand : budgetExits) {
+    emit.bind(operand);
+  }
+  emit.writeBack();
+  emit.jumpToExit({0xE9});
+
+  if (codeUsed + emit.code.size() > CODE_BUFFER_SIZE) {
+    flush();
+    return compile(chip8, address);
+  }
+
+  for (std::size_t operand : emit.exitJumps) {
+    auto rel = static_cast<int32_t>((exitCode - codeBuffer) -
+                                    static_cast<std::ptrdiff_t>(
+                                        codeUsed + operand + 4));
+    std::memcpy(emit.code.data() + operand, &rel, sizeof(rel));
+  }
+  setWritable(codeUsed, emit.code.size(), true);
+  std::memcpy(codeBuffer + codeUsed, emit.code.data(), emit.code.size());
+  setWritable(codeUsed, emit.code.size(), false);
+
+  entries[address] = codeBuffer + codeUsed;
+  codeUsed += emit.code.size();
+  for (uint16_t covered = address; covered < end; ++covered) {
+    codeMap[covered] = true;
+  }
+  return block;
+}
+
+uint64_t Jit::run(Chip8 &chip8, uint64_t cycles) {
+  uint64_t executed = 0;
+
+  while (executed < cycles) {
+    if (chip8.pc <= MEMORY_MASK) {
+      const Block *block = &blocks[chip8.pc];
+      if (!block->compiled)
+        block = &compile(chip8, chip8.pc);
+
+      if (block->length != 0) {
+        // runs on through every compiled block it reaches
+        uint64_t budget = cycles - executed;
+        BlockExit exit = enter(chip8.V.data(), &chip8.I, budget,
+                               entries.data(), chip8.pc);
+        uint64_t ran = budget - exit.remaining;
+        chip8.pc = static_cast<uint16_t>(exit.pc);
+        chip8.cycleCount += ran;
+        executed += ran;
+        if (ran != 0)
+          continue;
+        // a call or return that overflows the stack, the interpreter
+        // throws for it
+      }
+    }
+
+    executed += chip8.runPredecoded(1);
+  }
+  return executed;
+}
+} // namespace PChip8
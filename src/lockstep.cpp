@@ -0,0 +1,585 @@
+#include "lockstep.h"
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+
+namespace PChip8 {
+std::string_view laneStatusName(LaneStatus status) {
+  switch (status) {
+  case LaneStatus::Running:
+    return "ok";
+  case LaneStatus::UnknownOpcode:
+    return "unknown opcode";
+  case LaneStatus::StackOverflow:
+    return "stack overflow";
+  case LaneStatus::StackUnderflow:
+    return "stack underflow";
+  case LaneStatus::Unsupported:
+    return "unsupported display mode";
+  }
+  return "unknown";
+}
+
+Lockstep::Lockstep(std::span<const uint8_t> romData, int laneCount,
+                   uint64_t seed, QuirkProfile quirks)
+    : quirks(quirks), laneCount(laneCount), runningLanes(laneCount),
+      V(VREG_COUNT * laneCount), I(laneCount),
+      pc(laneCount, START_EXEC_LOCATION), delayTimer(laneCount),
+      soundTimer(laneCount), sp(laneCount), stack(STACK_DEPTH * laneCount),
+      cycleCount(laneCount), keys(laneCount), rng(laneCount),
+      status(laneCount),
+      running(laneCount, 0xFF), planeMask(laneCount, 1),
+      frames(DISPLAY_HEIGHT * laneCount),
+      pages(PAGE_COUNT * laneCount), privatePages(laneCount),
+      pending(laneCount), mask(laneCount) {
+  if (romData.size() > MEMORY_SIZE - START_EXEC_LOCATION)
+    throw std::runtime_error("ROM is too large");
+
+  std::copy(BUILTIN_FONT.begin(), BUILTIN_FONT.end(),
+            image.begin() + FONT_LOCATION);
+  std::copy(romData.begin(), romData.end(),
+            image.begin() + START_EXEC_LOCATION);
+
+  for (int lane = 0; lane < laneCount; ++lane) {
+    for (int page = 0; page < PAGE_COUNT; ++page) {
+      pages[lane * PAGE_COUNT + page] = &image[page * PAGE_SIZE];
+    }
+    rng[lane].setSeed(seed + lane);
+  }
+}
+
+Lockstep::~Lockstep() = default;
+
+uint64_t Lockstep::run(uint64_t cycles) {
+  switch (quirks) {
+#define PCHIP8_QUIRK_RUN(profile, name)                                        \
+  case QuirkProfile::profile:                                                  \
+    return runWithQuirks<QuirkProfile::profile>(cycles);
+    PCHIP8_QUIRK_PROFILES(PCHIP8_QUIRK_RUN)
+#undef PCHIP8_QUIRK_RUN
+  }
+  return 0;
+}
+
+template <QuirkProfile Profile>
+uint64_t Lockstep::runWithQuirks(uint64_t cycles) {
+  uint64_t steps = 0;
+  for (; steps < cycles && runningLanes > 0; ++steps) {
+    step<Profile>();
+  }
+  return steps;
+}
+
+template <QuirkProfile Profile> void Lockstep::step() {
+  std::copy(running.begin(), running.end(), pending.begin());
+  int groups = 0;
+
+  for (int lane = 0; lane < laneCount; ++lane) {
+    if (!pending[lane])
+      continue;
+
+    uint16_t address = pc[lane] & MEMORY_MASK;
+    int page = address / PAGE_SIZE;
+    Instruction instruction = decodeInstruction(
+        (read(lane, address) << 8) | read(lane, address + 1));
+
+    // a group has to share the code it executes, so the instruction must be
+    // on a page every member still shares with the ROM image
+    bool shared = (privatePages[lane] >> page & 1) == 0 &&
+                  address % PAGE_SIZE != PAGE_SIZE - 1;
+
+    if (groups < MAX_GROUPS && shared) {
+      ++groups;
+      const uint16_t *lanePC = pc.data();
+      const uint16_t *lanePrivate = privatePages.data();
+      uint8_t *lanePending = pending.data();
+      uint8_t *laneMask = mask.data();
+      for (int i = lane; i < laneCount; ++i) {
+        bool member = (lanePC[i] & MEMORY_MASK) == address &&
+                      (lanePrivate[i] >> page & 1) == 0;
+        laneMask[i] = lanePending[i] & (member ? 0xFF : 0);
+        lanePending[i] &= ~laneMask[i];
+      }
+      execute<Profile>(instruction, lane, laneCount);
+    } else {
+      // divergent lane, or code it has written over, run it on its own
+      pending[lane] = 0;
+      mask[lane] = 0xFF;
+      execute<Profile>(instruction, lane, lane + 1);
+    }
+  }
+}
+
+template <QuirkProfile Profile>
+void Lockstep::execute(const Instruction &instruction, int begin, int end) {
+  constexpr Quirks quirks = quirksOf(Profile);
+  const uint8_t *m = mask.data();
+  uint8_t *vx = reg(instruction.x);
+  uint8_t *vy = reg(instruction.y);
+  uint8_t *vf = reg(0xF);
+  const uint8_t *shifted = quirks.shiftReadsVY ? vy : vx;
+  const uint8_t kk = instruction.kk;
+  const uint16_t nnn = instruction.nnn;
+  // plain pointers, stores through uint8_t* would otherwise make the
+  // compiler reload every vector's data pointer and give up vectorizing
+  uint16_t *lanePC = pc.data();
+  uint16_t *laneI = I.data();
+  uint8_t *delay = delayTimer.data();
+  uint8_t *sound = soundTimer.data();
+  const uint16_t *laneKeys = keys.data();
+  uint64_t *cycles = cycleCount.data();
+
+  // fetch: skip past this instruction
+  for (int i = begin; i < end; ++i) {
+    lanePC[i] += m[i] & 2;
+    cycles[i] += m[i] & 1;
+  }
+
+  // the lane loops below mirror the opCode_* handlers one for one
+  switch (decodeOp(instruction.opCode)) {
+  case Op::SCD:
+    for (int i = begin; i < end; ++i) {
+      if (!m[i])
+        continue;
+      if (!quirks.superChip) {
+        halt(i, LaneStatus::UnknownOpcode);
+        continue;
+      }
+      if (!planeMask[i])
+        continue;
+      uint64_t *rows = &frames[i * DISPLAY_HEIGHT];
+      int n = std::min<int>(instruction.n, DISPLAY_HEIGHT);
+      std::copy_backward(rows, rows + DISPLAY_HEIGHT - n,
+                         rows + DISPLAY_HEIGHT);
+      std::fill_n(rows, n, 0);
+    }
+    break;
+  case Op::SCU:
+    for (int i = begin; i < end; ++i) {
+      if (!m[i])
+        continue;
+      if (!quirks.xoChip) {
+        halt(i, LaneStatus::UnknownOpcode);
+        continue;
+      }
+      if (!planeMask[i])
+        continue;
+      uint64_t *rows = &frames[i * DISPLAY_HEIGHT];
+      int n = std::min<int>(instruction.n, DISPLAY_HEIGHT);
+      std::copy(rows + n, rows + DISPLAY_HEIGHT, rows);
+      std::fill_n(rows + DISPLAY_HEIGHT - n, n, 0);
+    }
+    break;
+  case Op::CLS:
+    for (int i = begin; i < end; ++i) {
+      if (m[i] && planeMask[i])
+        std::fill_n(&frames[i * DISPLAY_HEIGHT], DISPLAY_HEIGHT, 0);
+    }
+    break;
+  case Op::RET:
+    for (int i = begin; i < end; ++i) {
+      if (!m[i])
+        continue;
+      if (sp[i] == 0) {
+        halt(i, LaneStatus::StackUnderflow);
+        continue;
+      }
+      lanePC[i] = stack[--sp[i] * laneCount + i];
+    }
+    break;
+  case Op::SCR:
+  case Op::SCL: {
+    bool right = decodeOp(instruction.opCode) == Op::SCR;
+    for (int i = begin; i < end; ++i) {
+      if (!m[i])
+        continue;
+      if (!quirks.superChip) {
+        halt(i, LaneStatus::UnknownOpcode);
+        continue;
+      }
+      if (!planeMask[i])
+        continue;
+      uint64_t *rows = &frames[i * DISPLAY_HEIGHT];
+      for (int y = 0; y < DISPLAY_HEIGHT; ++y) {
+        rows[y] = right ? rows[y] >> 4 : rows[y] << 4;
+      }
+    }
+    break;
+  }
+  case Op::EXIT:
+    for (int i = begin; i < end; ++i) {
+      if (!m[i])
+        continue;
+      if (!quirks.superChip)
+        halt(i, LaneStatus::UnknownOpcode);
+      else
+        lanePC[i] -= 2;
+    }
+    break;
+  case Op::LOW:
+    // lanes are always lo-res, so only the clear is left
+    for (int i = begin; i < end; ++i) {
+      if (!m[i])
+        continue;
+      if (!quirks.superChip)
+        halt(i, LaneStatus::UnknownOpcode);
+      else
+        std::fill_n(&frames[i * DISPLAY_HEIGHT], DISPLAY_HEIGHT, 0);
+    }
+    break;
+  case Op::HIGH:
+    for (int i = begin; i < end; ++i) {
+      if (m[i])
+        halt(i, quirks.superChip ? LaneStatus::Unsupported
+                                 : LaneStatus::UnknownOpcode);
+    }
+    break;
+  case Op::JP:
+    for (int i = begin; i < end; ++i) {
+      lanePC[i] = m[i] ? nnn : lanePC[i];
+    }
+    break;
+  case Op::CALL:
+    for (int i = begin; i < end; ++i) {
+      if (!m[i])
+        continue;
+      if (sp[i] == STACK_DEPTH) {
+        halt(i, LaneStatus::StackOverflow);
+        continue;
+      }
+      stack[sp[i]++ * laneCount + i] = lanePC[i];
+      lanePC[i] = nnn;
+    }
+    break;
+  case Op::SE_VX_KK:
+    for (int i = begin; i < end; ++i) {
+      lanePC[i] += m[i] & (vx[i] == kk ? 2 : 0);
+    }
+    break;
+  case Op::SNE_VX_KK:
+    for (int i = begin; i < end; ++i) {
+      lanePC[i] += m[i] & (vx[i] != kk ? 2 : 0);
+    }
+    break;
+  case Op::SE_VX_VY:
+    for (int i = begin; i < end; ++i) {
+      lanePC[i] += m[i] & (vx[i] == vy[i] ? 2 : 0);
+    }
+    break;
+  case Op::LD_VX_KK:
+    for (int i = begin; i < end; ++i) {
+      vx[i] = m[i] ? kk : vx[i];
+    }
+    break;
+  case Op::ADD_VX_KK:
+    for (int i = begin; i < end; ++i) {
+      vx[i] += m[i] & kk;
+    }
+    break;
+  case Op::LD_VX_VY:
+    for (int i = begin; i < end; ++i) {
+      vx[i] = m[i] ? vy[i] : vx[i];
+    }
+    break;
+  case Op::OR_VX_VY:
+    for (int i = begin; i < end; ++i) {
+      vx[i] |= m[i] & vy[i];
+      if constexpr (quirks.logicResetsVF)
+        vf[i] &= ~m[i];
+    }
+    break;
+  case Op::AND_VX_VY:
+    for (int i = begin; i < end; ++i) {
+      vx[i] &= ~m[i] | vy[i];
+      if constexpr (quirks.logicResetsVF)
+        vf[i] &= ~m[i];
+    }
+    break;
+  case Op::XOR_VX_VY:
+    for (int i = begin; i < end; ++i) {
+      vx[i] ^= m[i] & vy[i];
+      if constexpr (quirks.logicResetsVF)
+        vf[i] &= ~m[i];
+    }
+    break;
+  case Op::ADD_VX_VY:
+    for (int i = begin; i < end; ++i) {
+      uint16_t sum = vx[i] + vy[i];
+      vx[i] = m[i] ? static_cast<uint8_t>(sum) : vx[i];
+      vf[i] = m[i] ? (sum > UINT8_MAX) : vf[i];
+    }
+    break;
+  case Op::SUB_VX_VY:
+    for (int i = begin; i < end; ++i) {
+      int result = vx[i] - vy[i];
+      vx[i] = m[i] ? static_cast<uint8_t>(result) : vx[i];
+      vf[i] = m[i] ? (result >= 0) : vf[i];
+    }
+    break;
+  case Op::SHR_VX:
+    for (int i = begin; i < end; ++i) {
+      uint8_t value = shifted[i];
+      vx[i] = m[i] ? value >> 1 : vx[i];
+      vf[i] = m[i] ? value & 1 : vf[i];
+    }
+    break;
+  case Op::SUBN_VX_VY:
+    for (int i = begin; i < end; ++i) {
+      int result = vy[i] - vx[i];
+      vx[i] = m[i] ? static_cast<uint8_t>(result) : vx[i];
+      vf[i] = m[i] ? (result >= 0) : vf[i];
+    }
+    break;
+  case Op::SHL_VX:
+    for (int i = begin; i < end; ++i) {
+      uint8_t value = shifted[i];
+      vx[i] = m[i] ? static_cast<uint8_t>(value << 1) : vx[i];
+      vf[i] = m[i] ? value >> 7 : vf[i];
+    }
+    break;
+  case Op::SNE_VX_VY:
+    for (int i = begin; i < end; ++i) {
+      lanePC[i] += m[i] & (vx[i] != vy[i] ? 2 : 0);
+    }
+    break;
+  case Op::LD_I:
+    for (int i = begin; i < end; ++i) {
+      laneI[i] = m[i] ? nnn : laneI[i];
+    }
+    break;
+  case Op::JP_V0: {
+    const uint8_t *offset = quirks.jumpUsesVX ? vx : reg(0);
+    for (int i = begin; i < end; ++i) {
+      lanePC[i] = m[i] ? nnn + offset[i] : lanePC[i];
+    }
+    break;
+  }
+  case Op::RND_VX:
+    for (int i = begin; i < end; ++i) {
+      if (m[i])
+        vx[i] = rng[i].nextByte() & kk;
+    }
+    break;
+  case Op::DRW_VX_VY:
+    for (int i = begin; i < end; ++i) {
+      if (!m[i])
+        continue;
+      // with no plane selected nothing is drawn and nothing collides
+      if (planeMask[i])
+        drawSprite(i, instruction, quirks.spritesWrap,
+                   quirks.superChip && instruction.n == 0);
+      else
+        V[0xF * laneCount + i] = 0;
+    }
+    break;
+  case Op::SKP_VX:
+    for (int i = begin; i < end; ++i) {
+      bool down = laneKeys[i] >> (vx[i] & 0xF) & 1;
+      lanePC[i] += m[i] & (down ? 2 : 0);
+    }
+    break;
+  case Op::SKNP_VX:
+    for (int i = begin; i < end; ++i) {
+      bool down = laneKeys[i] >> (vx[i] & 0xF) & 1;
+      lanePC[i] += m[i] & (down ? 0 : 2);
+    }
+    break;
+  case Op::LD_VX_DT:
+    for (int i = begin; i < end; ++i) {
+      vx[i] = m[i] ? delay[i] : vx[i];
+    }
+    break;
+  case Op::LD_VX_K:
+    for (int i = begin; i < end; ++i) {
+      if (!m[i])
+        continue;
+      // the highest key held wins, as in opCode_LD_VX_K
+      if (laneKeys[i] != 0)
+        vx[i] = 31 - __builtin_clz(laneKeys[i]);
+      else
+        lanePC[i] -= 2;
+    }
+    break;
+  case Op::LD_DT_VX:
+    for (int i = begin; i < end; ++i) {
+      delay[i] = m[i] ? vx[i] : delay[i];
+    }
+    break;
+  case Op::LD_ST_VX:
+    for (int i = begin; i < end; ++i) {
+      sound[i] = m[i] ? vx[i] : sound[i];
+    }
+    break;
+  case Op::ADD_I_VX:
+    for (int i = begin; i < end; ++i) {
+      laneI[i] += m[i] & vx[i];
+    }
+    break;
+  case Op::LD_F_VX:
+    for (int i = begin; i < end; ++i) {
+      laneI[i] = m[i] ? FONT_LOCATION + (vx[i] & 0x0F) * 5 : laneI[i];
+    }
+    break;
+  case Op::LD_B_VX:
+    for (int i = begin; i < end; ++i) {
+      if (!m[i])
+        continue;
+      write(i, laneI[i], vx[i] / 100);
+      write(i, laneI[i] + 1, (vx[i] / 10) % 10);
+      write(i, laneI[i] + 2, vx[i] % 10);
+    }
+    break;
+  case Op::LD_I_VX:
+    for (int i = begin; i < end; ++i) {
+      if (!m[i])
+        continue;
+      for (int offset = 0; offset <= instruction.x; ++offset) {
+        write(i, laneI[i] + offset, V[offset * laneCount + i]);
+      }
+      if constexpr (quirks.indexIncrement == IndexIncrement::XPlusOne)
+        laneI[i] += instruction.x + 1;
+      else if constexpr (quirks.indexIncrement == IndexIncrement::X)
+        laneI[i] += instruction.x;
+    }
+    break;
+  case Op::LD_VX_I:
+    for (int i = begin; i < end; ++i) {
+      if (!m[i])
+        continue;
+      for (int offset = 0; offset <= instruction.x; ++offset) {
+        V[offset * laneCount + i] = read(i, laneI[i] + offset);
+      }
+      if constexpr (quirks.indexIncrement == IndexIncrement::XPlusOne)
+        laneI[i] += instruction.x + 1;
+      else if constexpr (quirks.indexIncrement == IndexIncrement::X)
+        laneI[i] += instruction.x;
+    }
+    break;
+  case Op::PLANE:
+    // lanes store plane 0 only, so they can select it or no plane at all
+    for (int i = begin; i < end; ++i) {
+      if (!m[i])
+        continue;
+      if (!quirks.xoChip)
+        halt(i, LaneStatus::UnknownOpcode);
+      else if (instruction.x & 2)
+        halt(i, LaneStatus::Unsupported);
+      else
+        planeMask[i] = instruction.x;
+    }
+    break;
+  case Op::UNKNOWN:
+    for (int i = begin; i < end; ++i) {
+      if (m[i])
+        halt(i, LaneStatus::UnknownOpcode);
+    }
+    break;
+  }
+}
+
+void Lockstep::halt(int lane, LaneStatus reason) {
+  status[lane] = reason;
+  running[lane] = 0;
+  --runningLanes;
+}
+
+void Lockstep::write(int lane, uint16_t address, uint8_t value) {
+  address &= MEMORY_MASK;
+  int page = address / PAGE_SIZE;
+
+  if ((privatePages[lane] >> page & 1) == 0) {
+    // first write to this page, stop sharing it
+    auto &copy = pagePool.emplace_back();
+    std::copy_n(pages[lane * PAGE_COUNT + page], PAGE_SIZE, copy.begin());
+    pages[lane * PAGE_COUNT + page] = copy.data();
+    privatePages[lane] |= 1 << page;
+  }
+  pages[lane * PAGE_COUNT + page][address % PAGE_SIZE] = value;
+}
+
+void Lockstep::drawSprite(int lane, const Instruction &instruction,
+                          bool wrap, bool wide) {
+  // PlanarDisplay::drawSpriteRow on a single word per row
+  unsigned int x = V[instruction.x * laneCount + lane] % DISPLAY_WIDTH;
+  unsigned int y = V[instruction.y * laneCount + lane] % DISPLAY_HEIGHT;
+  uint64_t *rows = &frames[lane * DISPLAY_HEIGHT];
+  int numRows = wide ? 16 : instruction.n;
+  bool collision = false;
+
+  for (int row = 0; row < numRows; ++row) {
+    unsigned int rowY = wrap ? (y + row) % DISPLAY_HEIGHT : y + row;
+    if (rowY >= DISPLAY_HEIGHT)
+      continue;
+    uint64_t sprite =
+        wide ? uint64_t{read(lane, I[lane] + 2 * row)} << 56 |
+                   uint64_t{read(lane, I[lane] + 2 * row + 1)} << 48
+             : uint64_t{read(lane, I[lane] + row)} << 56;
+    uint64_t bits = wrap ? std::rotr(sprite, x) : sprite >> x;
+    collision |= (rows[rowY] & bits) != 0;
+    rows[rowY] ^= bits;
+  }
+
+  V[0xF * laneCount + lane] = collision;
+}
+
+void Lockstep::tickTimers() {
+  for (int i = 0; i < laneCount; ++i) {
+    delayTimer[i] -= (delayTimer[i] != 0) & running[i] & 1;
+    soundTimer[i] -= (soundTimer[i] != 0) & running[i] & 1;
+  }
+}
+
+void Lockstep::setKeys(int lane, uint16_t keyMask) { keys[lane] = keyMask; }
+
+void Lockstep::seedRandom(int lane, uint64_t seed) { rng[lane].setSeed(seed); }
+
+int Lockstep::getLaneCount() const { return laneCount; }
+
+int Lockstep::getRunningLaneCount() const { return runningLanes; }
+
+LaneStatus Lockstep::getStatus(int lane) const { return status[lane]; }
+
+uint16_t Lockstep::getPC(int lane) const { return pc[lane]; }
+
+uint64_t Lockstep::getCycleCount(int lane) const { return cycleCount[lane]; }
+
+uint64_t Lockstep::displayHash(int lane) const {
+  PlanarDisplay display;
+  display.setRows(0, std::span{&frames[lane * DISPLAY_HEIGHT], DISPLAY_HEIGHT});
+  return display.hash();
+}
+
+std::size_t Lockstep::getPrivatePageCount() const { return pagePool.size(); }
+
+void Lockstep::exportLane(int lane, Chip8 &chip8) const {
+  for (int address = 0; address < MEMORY_SIZE; ++address) {
+    chip8.memory[address] = read(lane, address);
+  }
+  for (int index = 0; index < VREG_COUNT; ++index) {
+    chip8.V[index] = V[index * laneCount + lane];
+  }
+  chip8.I = I[lane];
+  chip8.pc = pc[lane];
+  chip8.sp = sp[lane];
+  for (int depth = 0; depth < STACK_DEPTH; ++depth) {
+    chip8.stack[depth] = stack[depth * laneCount + lane];
+  }
+  chip8.delayTimer = delayTimer[lane];
+  chip8.soundTimer = soundTimer[lane];
+  chip8.cycleCount = cycleCount[lane];
+  chip8.rng = rng[lane];
+  for (int key = 0; key < 16; ++key) {
+    chip8.keyPress[key] = keys[lane] >> key & 1;
+  }
+
+  chip8.display.reset();
+  chip8.display.setRows(
+      0, std::span{&frames[lane * DISPLAY_HEIGHT], DISPLAY_HEIGHT});
+  chip8.display.setPlaneMask(planeMask[lane]);
+
+  chip8.current = Instruction{};
+  chip8.quirks = quirks;
+  chip8.invalidateDecodeCache();
+  chip8.drawFlag = true;
+}
+} // namespace PChip8
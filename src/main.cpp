@@ -1,26 +1,555 @@
+#include "audio.h"
 #include "chip8.h"
+#include "input.h"
+#include "render_kernels.h"
+#include "rewind.h"
+#include "rom_pack.h"
+#include "scheduler.h"
+#include "spsc_queue.h"
+#include "triple_buffer.h"
 #include <SDL2/SDL.h>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <csignal>
 #include <cstdint>
+#include <deque>
+#include <iomanip>
 #include <iostream>
-#include <map>
+#include <optional>
+#include <random>
+#include <string>
 #include <thread>
+#include <vector>
 
-const std::map<int, int> CHIP8_KEYS = {
-    std::make_pair(SDLK_x, 0x0), std::make_pair(SDLK_1, 0x1),
-    std::make_pair(SDLK_2, 0x2), std::make_pair(SDLK_3, 0x3),
-    std::make_pair(SDLK_q, 0x4), std::make_pair(SDLK_w, 0x5),
-    std::make_pair(SDLK_e, 0x6), std::make_pair(SDLK_a, 0x7),
-    std::make_pair(SDLK_s, 0x8), std::make_pair(SDLK_d, 0x9),
-    std::make_pair(SDLK_z, 0xA), std::make_pair(SDLK_c, 0xB),
-    std::make_pair(SDLK_4, 0xC), std::make_pair(SDLK_r, 0xD),
-    std::make_pair(SDLK_f, 0xE), std::make_pair(SDLK_v, 0xF),
+using Clock = std::chrono::steady_clock;
+
+// CHIP-8 key for each SDL keycode below 128, which covers every keypad key,
+// -1 for the rest
+constexpr std::array<int8_t, 128> CHIP8_KEYS = [] {
+  std::array<int8_t, 128> keys{};
+  keys.fill(-1);
+  keys[SDLK_x] = 0x0, keys[SDLK_1] = 0x1, keys[SDLK_2] = 0x2;
+  keys[SDLK_3] = 0x3, keys[SDLK_q] = 0x4, keys[SDLK_w] = 0x5;
+  keys[SDLK_e] = 0x6, keys[SDLK_a] = 0x7, keys[SDLK_s] = 0x8;
+  keys[SDLK_d] = 0x9, keys[SDLK_z] = 0xA, keys[SDLK_c] = 0xB;
+  keys[SDLK_4] = 0xC, keys[SDLK_r] = 0xD, keys[SDLK_f] = 0xE;
+  keys[SDLK_v] = 0xF;
+  return keys;
+}();
+
+// CHIP-8 key for an SDL keycode, through the ROM's key map
+int chip8Key(SDL_Keycode sym, const PChip8::RomSettings &settings) {
+  int key = sym >= 0 && sym < static_cast<int>(CHIP8_KEYS.size())
+                ? CHIP8_KEYS[sym]
+                : -1;
+  return key >= 0 ? settings.keyMap[key] : -1;
+}
+
+// A finished frame handed from the emulation thread to the render thread
+struct Frame {
+  bool hires = false;
+  // plane 1 has lit pixels, so the frame needs the four colour expansion
+  bool twoPlanes = false;
+  // rows at the frame's resolution, the rest of each array is stale
+  std::array<std::array<uint64_t, PChip8::PlanarDisplay::MAX_WORDS>,
+             PChip8::PLANE_COUNT>
+      planes{};
+
+  [[nodiscard]] int width() const {
+    return hires ? PChip8::HIRES_WIDTH : PChip8::DISPLAY_WIDTH;
+  }
+  [[nodiscard]] int height() const {
+    return hires ? PChip8::HIRES_HEIGHT : PChip8::DISPLAY_HEIGHT;
+  }
+  // bit y set for every row y
+  [[nodiscard]] uint64_t allRows() const {
+    return hires ? ~uint64_t{0} : (uint64_t{1} << PChip8::DISPLAY_HEIGHT) - 1;
+  }
 };
 
+enum class InputType : uint8_t {
+  KeyDown,
+  KeyUp,
+  Reset,
+  SaveState,
+  LoadState,
+  RewindStart,
+  RewindStop
+};
+
+struct InputEvent {
+  InputType type;
+  uint8_t key;
+  // when the render thread saw a key event
+  Clock::time_point time{};
+};
+
+// Key events of the current timeline as the core applies them, so that
+// replaying them from a fresh load of the ROM gives the same run
+class InputRecorder {
+public:
+  void record(const PChip8::KeyEvent &event) { events.push_back(event); }
+  // Forget the events from the current cycle on (after rewinding or a reset)
+  // and record whatever keys are held now, so a replay continues with them
+  void rewindTo(const PChip8::Chip8 &chip8) {
+    uint64_t cycle = chip8.getCycleCount();
+    while (!events.empty() && events.back().cycle >= cycle)
+      events.pop_back();
+
+    std::array<bool, PChip8::KEY_COUNT> held{};
+    for (const auto &event : events) {
+      held[event.key] = event.pressed;
+    }
+    for (int key = 0; key < PChip8::KEY_COUNT; ++key) {
+      if (held[key] != chip8.keyPress[key])
+        events.push_back(
+            {cycle, static_cast<uint8_t>(key), chip8.keyPress[key]});
+    }
+  }
+  [[nodiscard]] const std::vector<PChip8::KeyEvent> &getEvents() const {
+    return events;
+  }
+
+private:
+  std::vector<PChip8::KeyEvent> events;
+};
+
+// Time from a key event to the end of the frame that applied it
+struct InputLatency {
+  uint64_t count = 0;
+  Clock::duration total{};
+  Clock::duration worst{};
+
+  void add(Clock::duration latency) {
+    ++count;
+    total += latency;
+    worst = std::max(worst, latency);
+  }
+};
+
+// State shared between the render (SDL) thread and the emulation thread,
+// everything crossing threads goes through the lock-free buffers below
+struct EmulatorLink {
+  TripleBuffer<Frame> frames;
+  SpscQueue<InputEvent, 256> input;
+  std::atomic<bool> running{true};
+  // bumped after every push and on stop, the emulation thread waits on it
+  // while the machine is idle until input arrives
+  std::atomic<uint32_t> wakeups{0};
+
+  // Waits for room when the queue is full rather than lose the event, a
+  // dropped key release would leave the key held down. The emulation thread
+  // drains the queue every frame, so this only waits while it is stalled.
+  void send(InputEvent event) {
+    while (!input.push(event)) {
+      if (!running.load(std::memory_order_relaxed))
+        return;
+      wake();
+      std::this_thread::yield();
+    }
+    wake();
+  }
+  void stop() {
+    running.store(false, std::memory_order_relaxed);
+    wake();
+  }
+  void wake() {
+    wakeups.fetch_add(1, std::memory_order_release);
+    wakeups.notify_one();
+  }
+  // Block until send() or stop(), unless either already happened
+  void waitForInput() {
+    uint32_t seen = wakeups.load(std::memory_order_acquire);
+    if (input.empty() && running.load(std::memory_order_relaxed))
+      wakeups.wait(seen, std::memory_order_acquire);
+  }
+  // set by the emulation thread before it stops, read after join
+  std::string error;
+  // where to write the execution profile, empty for none
+  std::string profileFile;
+  // key events to write out for --record, empty file name for none
+  std::string recordFile;
+  // key events loaded for --replay
+  std::vector<PChip8::KeyEvent> replay;
+  // the random generator restarts from it on every reset, so a recording
+  // replays from any of them
+  uint64_t seed = 0;
+  InputRecorder recorder;
+  InputLatency latency;
+};
+
+// SIGUSR1 asks for a profile dump at the end of the current frame. The
+// handler runs on whichever thread the signal lands on, the emulation thread
+// reads it, so it is a lock-free atomic rather than a volatile.
+std::atomic<bool> profileRequested{false};
+static_assert(std::atomic<bool>::is_always_lock_free);
+
+void saveProfile([[maybe_unused]] const PChip8::Chip8 &chip8,
+                 [[maybe_unused]] const std::string &fileName) {
+#ifdef PCHIP8_INSTRUMENTATION
+  try {
+    chip8.getProfile().save(fileName);
+  } catch (std::runtime_error &e) {
+    std::cerr << "error: " << e.what() << '\n';
+  }
+#endif
+}
+
+// Emulation thread: apply queued input, run one frame, publish the
+// framebuffer whenever its contents changed
+void emulate(PChip8::Chip8 &chip8, PChip8::Scheduler &scheduler,
+             const char *romFile, EmulatorLink &link) {
+  const std::string stateFile = std::string(romFile) + ".state";
+  PChip8::RewindBuffer rewindBuffer;
+  bool rewinding = false;
+  bool recording = !link.recordFile.empty();
+  PChip8::InputQueue &input = scheduler.getInput();
+  // cycle and time of key events not yet past, for the latency statistics
+  std::deque<std::pair<uint64_t, Clock::time_point>> inFlight;
+
+  const auto &replay = link.replay;
+  std::size_t replayNext = 0;
+
+  // apply queued keys at once, ahead of a jump in the cycle count
+  auto flushInput = [&] {
+    input.flush(chip8);
+    inFlight.clear();
+  };
+  // queue the replayed events that fall in the frame about to run
+  auto feedReplay = [&] {
+    uint64_t end =
+        chip8.getCycleCount() + scheduler.getConfig().instructionsPerFrame;
+    for (; replayNext < replay.size() && replay[replayNext].cycle < end;
+         ++replayNext) {
+      input.push(replay[replayNext]);
+      if (recording)
+        link.recorder.record(replay[replayNext]);
+    }
+  };
+  // after the cycle count jumped, carry on replaying from the new cycle with
+  // the keys the replay holds there
+  auto seekReplay = [&] {
+    if (replay.empty())
+      return;
+    chip8.keyPress.fill(false);
+    for (replayNext = 0; replayNext < replay.size() &&
+                         replay[replayNext].cycle < chip8.getCycleCount();
+         ++replayNext) {
+      chip8.keyPress[replay[replayNext].key] = replay[replayNext].pressed;
+    }
+  };
+
+  try {
+    while (link.running.load(std::memory_order_relaxed)) {
+      if (!rewinding && replayNext == replay.size() &&
+          scheduler.waitingForInput()) {
+        // nothing but a key can change the machine now, so sleep until one
+        // is pressed instead of running frames that all look the same
+        link.waitForInput();
+        scheduler.resumeAfterWait();
+      }
+
+      InputEvent event;
+      while (link.input.pop(event)) {
+        switch (event.type) {
+        case InputType::KeyDown:
+        case InputType::KeyUp: {
+          bool pressed = event.type == InputType::KeyDown;
+          if (rewinding) {
+            // nothing runs while rewinding, the recording catches up when
+            // it stops
+            chip8.keyPress[event.key] = pressed;
+            break;
+          }
+          PChip8::KeyEvent keyEvent{scheduler.cycleAt(event.time), event.key,
+                                    pressed};
+          input.push(keyEvent);
+          inFlight.emplace_back(keyEvent.cycle, event.time);
+          if (recording)
+            link.recorder.record(keyEvent);
+          break;
+        }
+        case InputType::Reset:
+          flushInput();
+          chip8.reset();
+          chip8.seedRandom(link.seed);
+          rewindBuffer.clear();
+          scheduler.resync();
+          seekReplay();
+          if (recording)
+            link.recorder.rewindTo(chip8);
+          break;
+        case InputType::SaveState:
+        case InputType::LoadState:
+          // a missing or stale state file should not stop the emulator
+          try {
+            if (event.type == InputType::SaveState) {
+              chip8.saveStateFile(stateFile);
+            } else {
+              flushInput();
+              chip8.loadStateFile(stateFile);
+              rewindBuffer.clear();
+              seekReplay();
+              if (recording) {
+                // the recording only replays from a fresh load of the ROM
+                recording = false;
+                std::cerr << "note: state loaded, input recording stopped\n";
+              }
+            }
+          } catch (std::runtime_error &e) {
+            std::cerr << "error: " << e.what() << '\n';
+          }
+          break;
+        case InputType::RewindStart:
+          flushInput();
+          rewinding = true;
+          break;
+        case InputType::RewindStop:
+          if (rewinding)
+            seekReplay();
+          if (rewinding && recording)
+            link.recorder.rewindTo(chip8);
+          rewinding = false;
+          break;
+        }
+      }
+
+      if (rewinding) {
+        // one captured frame back per frame of wall-clock time, holding at
+        // the oldest one
+        rewindBuffer.rewind(chip8);
+        scheduler.idleFrame();
+      } else {
+        // one 1/60 s frame of instructions and a timer tick, paced to real
+        // time
+        feedReplay();
+        scheduler.runFrame();
+        rewindBuffer.capture(chip8);
+
+        auto now = Clock::now();
+        while (!inFlight.empty() &&
+               inFlight.front().first < chip8.getCycleCount()) {
+          link.latency.add(now - inFlight.front().second);
+          inFlight.pop_front();
+        }
+      }
+
+      if (!link.profileFile.empty() &&
+          profileRequested.exchange(false, std::memory_order_relaxed)) {
+        saveProfile(chip8, link.profileFile);
+      }
+
+      if (chip8.drawFlag) {
+        chip8.drawFlag = false;
+        // the render thread compares against what it uploaded last
+        if (chip8.display.takeDirtyRows() != 0) {
+          Frame &frame = link.frames.back();
+          frame.hires = chip8.display.isHires();
+          frame.twoPlanes = chip8.display.isPlaneUsed(1);
+          for (int plane = 0; plane < (frame.twoPlanes ? 2 : 1); ++plane) {
+            auto rows = chip8.display.getRows(plane);
+            std::copy(rows.begin(), rows.end(), frame.planes[plane].begin());
+          }
+          link.frames.publish();
+        }
+      }
+    }
+  } catch (std::exception &e) {
+    link.error = e.what();
+    link.stop();
+  }
+}
+
+// Rows of next that differ from previous, bit y set for row y
+uint64_t changedRows(const Frame &previous, const Frame &next) {
+  if (previous.hires != next.hires || previous.twoPlanes != next.twoPlanes)
+    return next.allRows();
+
+  int height = next.height();
+  int wordsPerRow = next.width() / 64;
+  uint64_t changed = 0;
+  for (int plane = 0; plane < (next.twoPlanes ? 2 : 1); ++plane) {
+    for (int y = 0; y < height; ++y) {
+      auto row = next.planes[plane].begin() + y * wordsPerRow;
+      if (!std::equal(row, row + wordsPerRow,
+                      previous.planes[plane].begin() + y * wordsPerRow))
+        changed |= uint64_t{1} << y;
+    }
+  }
+  return changed;
+}
+
+// Expand and upload each run of consecutive rows set in rowMask,
+// locking only that band of the texture. Lo-res pixels are twice the size of
+// hi-res ones, so both fill the texture.
+void uploadRows(SDL_Texture *tex, const Frame &frame, uint64_t rowMask,
+                int scale, const PChip8::Palette &palette,
+                PChip8::ExpandKernel expandFrame,
+                PChip8::ExpandPlanesKernel expandPlanes) {
+  int width = frame.width();
+  int wordsPerRow = width / 64;
+  int pixelScale = frame.hires ? scale : 2 * scale;
+
+  while (rowMask != 0) {
+    int first = __builtin_ctzll(rowMask);
+    uint64_t run = ~(rowMask >> first);
+    int count = run == 0 ? 64 - first : __builtin_ctzll(run);
+
+    SDL_Rect band{0, first * pixelScale, width * pixelScale,
+                  count * pixelScale};
+    void *pixels = nullptr;
+    int pitch = 0;
+    if (SDL_LockTexture(tex, &band, &pixels, &pitch) == 0) {
+      const uint64_t *rows = frame.planes[0].data() + first * wordsPerRow;
+      if (frame.twoPlanes)
+        expandPlanes(rows, frame.planes[1].data() + first * wordsPerRow, width,
+                     count, static_cast<uint32_t *>(pixels), pitch, pixelScale,
+                     palette);
+      else
+        expandFrame(rows, width, count, static_cast<uint32_t *>(pixels), pitch,
+                    pixelScale, palette);
+      SDL_UnlockTexture(tex);
+    }
+
+    rowMask = first + count >= 64 ? 0 : rowMask & (~uint64_t{0} << (first + count));
+  }
+}
+
+// SDL audio thread: the buzzer fills the device buffer
+void fillAudio(void *buzzer, Uint8 *stream, int length) {
+  static_cast<PChip8::Buzzer *>(buzzer)->render(
+      {reinterpret_cast<int16_t *>(stream), length / sizeof(int16_t)});
+}
+
+// Open the default device for the buzzer, 0 without sound
+SDL_AudioDeviceID openAudio(PChip8::Buzzer &buzzer) {
+  SDL_AudioSpec wanted{};
+  wanted.freq = buzzer.getConfig().sampleRate;
+  wanted.format = AUDIO_S16SYS;
+  wanted.channels = 1;
+  // about 12 ms at 44.1 kHz, on top of the buzzer's one frame
+  wanted.samples = 512;
+  wanted.callback = fillAudio;
+  wanted.userdata = &buzzer;
+  SDL_AudioDeviceID device =
+      SDL_OpenAudioDevice(nullptr, 0, &wanted, nullptr, 0);
+  if (device == 0)
+    std::cerr << "note: no sound, " << SDL_GetError() << '\n';
+  return device;
+}
+
+void printUsage(const char *program) {
+  std::cerr << "usage: " << program
+            << " [--scale n] [--fg RRGGBB] [--bg RRGGBB] [--ipf n] [--turbo] "
+               "[--quirks name] [--profile file] [--seed n] [--record file] "
+               "[--replay file] [--latency] [--mute] [--pack file] rom\n"
+            << "quirks: vip (default), chip48, schip, xochip\n"
+            << "with --pack, rom is the name of a ROM in that pack, which "
+               "brings its own instructions per frame, quirks and key map\n";
+}
+
 int main(int argc, char *argv[]) {
-  if (argc != 2) {
+  // texture is scale times the hi-res resolution, so SDL never has to scale
+  int scale = 8;
+  PChip8::Palette palette;
+  PChip8::SchedulerConfig schedulerConfig;
+  const char *romFile = nullptr;
+  std::string profileFile;
+  std::string recordFile;
+  std::string replayFile;
+  std::string packFile;
+  bool instructionsPerFrameGiven = false;
+  std::optional<PChip8::QuirkProfile> quirks;
+  std::optional<uint64_t> seed;
+  bool showLatency = false;
+  bool mute = false;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if ((arg == "--scale" || arg == "--fg" || arg == "--bg" ||
+         arg == "--ipf" || arg == "--quirks" || arg == "--seed") &&
+        i + 1 < argc) {
+      try {
+        if (arg == "--scale")
+          scale = std::stoi(argv[++i]);
+        else if (arg == "--ipf") {
+          schedulerConfig.instructionsPerFrame = std::stoul(argv[++i]);
+          instructionsPerFrameGiven = true;
+        } else if (arg == "--quirks")
+          quirks = PChip8::parseQuirkProfile(argv[++i]);
+        else if (arg == "--seed")
+          seed = std::stoull(argv[++i]);
+        else if (arg == "--fg")
+          palette.on = 0xFF000000 | std::stoul(argv[++i], nullptr, 16);
+        else
+          palette.off = 0xFF000000 | std::stoul(argv[++i], nullptr, 16);
+      } catch (std::exception &e) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (arg == "--turbo") {
+      schedulerConfig.turbo = true;
+    } else if (arg == "--profile" && i + 1 < argc) {
+#ifdef PCHIP8_INSTRUMENTATION
+      profileFile = argv[++i];
+#else
+      std::cerr << "error: --profile needs a build with "
+                   "PCHIP8_INSTRUMENTATION\n";
+      return EXIT_FAILURE;
+#endif
+    } else if (arg == "--record" && i + 1 < argc) {
+      recordFile = argv[++i];
+    } else if (arg == "--replay" && i + 1 < argc) {
+      replayFile = argv[++i];
+    } else if (arg == "--pack" && i + 1 < argc) {
+      packFile = argv[++i];
+    } else if (arg == "--latency") {
+      showLatency = true;
+    } else if (arg == "--mute") {
+      mute = true;
+    } else if (romFile == nullptr && arg[0] != '-') {
+      romFile = argv[i];
+    } else {
+      printUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (romFile == nullptr || scale < 1) {
+    printUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  std::shared_ptr<const PChip8::RomImage> rom;
+  PChip8::RomSettings romSettings;
+  try {
+    if (packFile.empty()) {
+      rom = PChip8::RomCache::shared().load(romFile);
+    } else {
+      auto pack = PChip8::RomPack::open(packFile);
+      auto index = pack->find(romFile);
+      if (!index)
+        throw std::runtime_error(std::string(romFile) + " is not in " +
+                                 packFile);
+      rom = pack->getImage(*index);
+      romSettings = pack->getSettings(*index);
+    }
+  } catch (std::exception &e) {
+    std::cerr << "error: " << e.what() << '\n';
     return EXIT_FAILURE;
   }
+  if (romSettings.instructionsPerFrame != 0 && !instructionsPerFrameGiven)
+    schedulerConfig.instructionsPerFrame = romSettings.instructionsPerFrame;
+  if (!quirks)
+    quirks = romSettings.quirks;
+
+  const int textureWidth = PChip8::HIRES_WIDTH * scale;
+  const int textureHeight = PChip8::HIRES_HEIGHT * scale;
+  const PChip8::ExpandKernel expandFrame = PChip8::selectExpandKernel();
+  const PChip8::ExpandPlanesKernel expandPlanes =
+      PChip8::selectExpandPlanesKernel();
 
   SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
   SDL_Window *window = nullptr;
@@ -30,79 +559,173 @@ int main(int argc, char *argv[]) {
   SDL_SetWindowMinimumSize(window, PChip8::DISPLAY_WIDTH,
                            PChip8::DISPLAY_HEIGHT);
   SDL_SetWindowTitle(window, "CHIP-8 Emulator");
-  SDL_RenderSetLogicalSize(renderer, 1024, 512);
+  SDL_RenderSetLogicalSize(renderer, textureWidth, textureHeight);
 
   auto tex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
-                               SDL_TEXTUREACCESS_STREAMING, 64, 32);
+                               SDL_TEXTUREACCESS_STREAMING, textureWidth,
+                               textureHeight);
 
   PChip8::Chip8 chip8;
+  PChip8::Scheduler scheduler{chip8, schedulerConfig};
+  PChip8::InputLog replay;
 
+  chip8.setQuirks(*quirks);
   try {
-    chip8.loadROM(argv[1]);
+    chip8.loadROM(rom);
+    if (!replayFile.empty())
+      replay = PChip8::loadInputLog(replayFile);
   } catch (std::exception &e) {
     std::cerr << "error: " << e.what() << '\n';
     return EXIT_FAILURE;
   }
 
-  // begin emulation loop
-  while (true) {
+  // The core runs on its own thread so a slow present or a vsync stall never
+  // delays emulation, this thread only handles SDL events and drawing
+  EmulatorLink link;
+  link.profileFile = profileFile;
+  link.recordFile = recordFile;
+  link.replay = std::move(replay.events);
+  // a replay needs the seed it was recorded with, anything else a fresh one
+  if (!seed)
+    seed = replay.seed;
+  if (!seed) {
+    std::random_device entropy;
+    seed = uint64_t{entropy()} << 32 | entropy();
+  }
+  link.seed = *seed;
+  chip8.seedRandom(link.seed);
+#ifdef SIGUSR1
+  std::signal(SIGUSR1, [](int) {
+    profileRequested.store(true, std::memory_order_relaxed);
+  });
+#endif
+
+  // the emulation thread queues buzzer changes at every frame end, SDL's
+  // audio thread turns them into samples
+  PChip8::Buzzer buzzer{PChip8::AudioBackend::Device};
+  SDL_AudioDeviceID audioDevice = mute ? 0 : openAudio(buzzer);
+  if (audioDevice != 0) {
+    scheduler.setAudio(&buzzer);
+    SDL_PauseAudioDevice(audioDevice, 0);
+  }
+  std::thread emulator(emulate, std::ref(chip8), std::ref(scheduler), romFile,
+                       std::ref(link));
 
-    // Process SDL events
+  // last frame uploaded to the texture, which starts out undefined so every
+  // row is uploaded once
+  Frame presented;
+  bool fullUpload = true;
+  bool presentNeeded = true;
+
+  // begin render loop
+  while (link.running.load(std::memory_order_relaxed)) {
+
+    // Process SDL events, waking up at least every millisecond for frames
     SDL_Event e;
-    while (SDL_PollEvent(&e)) {
-      switch (e.type) {
-      case SDL_QUIT:
-        return EXIT_SUCCESS;
-      case SDL_WINDOWEVENT:
-        chip8.drawFlag = true;
-        break;
-      case SDL_KEYUP:
-      default:
-        if (CHIP8_KEYS.contains(e.key.keysym.sym)) {
-          chip8.keyPress[CHIP8_KEYS.at(e.key.keysym.sym)] = false;
-        }
-        break;
-      case SDL_KEYDOWN:
-        switch (e.key.keysym.sym) {
-        case SDLK_F1:
-          chip8.reset();
-          chip8.loadROM(argv[1]);
+    if (SDL_WaitEventTimeout(&e, 1)) {
+      do {
+        switch (e.type) {
+        case SDL_QUIT:
+          link.stop();
           break;
-        default:
-          if (CHIP8_KEYS.contains(e.key.keysym.sym)) {
-            chip8.keyPress[CHIP8_KEYS.at(e.key.keysym.sym)] = true;
+        case SDL_WINDOWEVENT:
+          // the texture is still valid, it only needs presenting again
+          presentNeeded = true;
+          break;
+        case SDL_KEYUP:
+          if (e.key.keysym.sym == SDLK_BACKSPACE) {
+            link.send({InputType::RewindStop, 0});
+          } else if (int key = chip8Key(e.key.keysym.sym, romSettings);
+                     key >= 0) {
+            link.send({InputType::KeyUp, static_cast<uint8_t>(key),
+                       Clock::now()});
+          }
+          break;
+        case SDL_KEYDOWN:
+          switch (e.key.keysym.sym) {
+          case SDLK_F1:
+            link.send({InputType::Reset, 0});
+            break;
+          case SDLK_F5:
+            link.send({InputType::SaveState, 0});
+            break;
+          case SDLK_F9:
+            link.send({InputType::LoadState, 0});
+            break;
+          case SDLK_BACKSPACE:
+            link.send({InputType::RewindStart, 0});
+            break;
+          default:
+            // auto-repeat changes nothing on the keypad
+            if (int key = chip8Key(e.key.keysym.sym, romSettings);
+                key >= 0 && !e.key.repeat) {
+              link.send({InputType::KeyDown, static_cast<uint8_t>(key),
+                         Clock::now()});
+            }
+            break;
           }
           break;
+        default:
+          break;
         }
-        break;
-      }
+      } while (SDL_PollEvent(&e));
     }
 
-    try {
-      chip8.cpuCycle();
-    } catch (std::exception &e) {
-      std::cerr << "error: " << e.what() << '\n';
-      return EXIT_FAILURE;
+    // Pick up the latest published frame, intermediate ones are dropped, and
+    // upload only the rows that differ from what the texture holds
+    if (link.frames.update() || fullUpload) {
+      const Frame &frame = link.frames.front();
+      uint64_t rowMask = changedRows(presented, frame);
+      if (fullUpload) {
+        rowMask = frame.allRows();
+        fullUpload = false;
+      }
+      if (rowMask != 0) {
+        uploadRows(tex, frame, rowMask, scale, palette, expandFrame,
+                   expandPlanes);
+        presented = frame;
+        presentNeeded = true;
+      }
     }
 
-    // If draw occurred, redraw SDL screen
-    if (chip8.drawFlag) {
-      chip8.drawFlag = false;
+    // Skip presenting when nothing changed since the last present
+    if (presentNeeded) {
+      presentNeeded = false;
 
-      // Update SDL texture
-      SDL_UpdateTexture(tex, nullptr, &chip8.display.getRawPixelGrid(),
-                        64 * sizeof(Uint32));
       // Clear screen and render
       SDL_RenderClear(renderer);
       SDL_RenderCopy(renderer, tex, nullptr, nullptr);
       SDL_RenderPresent(renderer);
     }
-    // Sleep to slow down emulation speed
-    std::this_thread::sleep_for(std::chrono::microseconds(1200));
   }
-  // end emulation loop
+  // end render loop
+
+  emulator.join();
+  if (audioDevice != 0)
+    SDL_CloseAudioDevice(audioDevice);
+  if (!profileFile.empty())
+    saveProfile(chip8, profileFile);
+  if (!recordFile.empty()) {
+    try {
+      PChip8::saveInputLog(recordFile,
+                           {link.seed, link.recorder.getEvents()});
+    } catch (std::runtime_error &e) {
+      std::cerr << "error: " << e.what() << '\n';
+    }
+  }
+  if (showLatency && link.latency.count > 0) {
+    using Milliseconds = std::chrono::duration<double, std::milli>;
+    std::cerr << "input latency over " << link.latency.count
+              << " key events: mean " << std::fixed << std::setprecision(2)
+              << Milliseconds(link.latency.total).count() / link.latency.count
+              << " ms, worst " << Milliseconds(link.latency.worst).count()
+              << " ms\n";
+  }
+  if (!link.error.empty()) {
+    std::cerr << "error: " << link.error << '\n';
+    return EXIT_FAILURE;
+  }
 
-  SDL_Delay(3000);
   SDL_DestroyTexture(tex);
   SDL_DestroyWindow(window);
   SDL_DestroyRenderer(renderer);
@@ -1,68 +1,153 @@
 #include "chip8.h"
-#include <bitset>
-#include <cstdlib>
+#include <stdexcept>
 
-#define VX (V[(currentOpCode & 0x0F00) >> 8])
-#define VY (V[(currentOpCode & 0x00F0) >> 4])
+#define VX (V[current.x])
+#define VY (V[current.y])
+#define KK (current.kk)
+#define NNN (current.nnn)
+// the quirks of the profile a handler is instantiated for
+#define QUIRKS (quirksOf(Profile))
 
 namespace PChip8 {
-void Chip8::opCode_CLS() {
+template <QuirkProfile Profile> void Chip8::opCode_SCD() {
+  // 00CN
+  // Scroll the display down N pixels (SUPER-CHIP).
+  //
+  // Rows scrolled in from the top are blank. N counts pixels of the current
+  // resolution, as in Octo.
+  if constexpr (!QUIRKS.superChip)
+    throwUnknownOpCode();
+
+  drawFlag = true;
+  display.scrollDown(current.n);
+}
+
+template <QuirkProfile Profile> void Chip8::opCode_SCU() {
+  // 00DN
+  // Scroll the display up N pixels (XO-CHIP).
+  if constexpr (!QUIRKS.xoChip)
+    throwUnknownOpCode();
+
+  drawFlag = true;
+  display.scrollUp(current.n);
+}
+
+template <QuirkProfile Profile> void Chip8::opCode_CLS() {
   // 00E0
   // Clear the display.
+  //
+  // On XO-CHIP only the planes selected by FN01.
 
   drawFlag = true;
   display.clear();
 }
 
-void Chip8::opCode_RET() {
+template <QuirkProfile Profile> void Chip8::opCode_RET() {
   // 00EE
   // Return from a subroutine.
   //
   // The interpreter sets the program counter to the address at the top of the
   // stack, then subtracts 1 from the stack pointer.
-  pc = stack.top();
-  stack.pop();
+  if (sp == 0)
+    throw std::runtime_error("stack underflow");
+
+  pc = stack[--sp];
 }
 
-void Chip8::opCode_JP() {
+template <QuirkProfile Profile> void Chip8::opCode_SCR() {
+  // 00FB
+  // Scroll the display right 4 pixels (SUPER-CHIP).
+  if constexpr (!QUIRKS.superChip)
+    throwUnknownOpCode();
+
+  drawFlag = true;
+  display.scrollRight(4);
+}
+
+template <QuirkProfile Profile> void Chip8::opCode_SCL() {
+  // 00FC
+  // Scroll the display left 4 pixels (SUPER-CHIP).
+  if constexpr (!QUIRKS.superChip)
+    throwUnknownOpCode();
+
+  drawFlag = true;
+  display.scrollLeft(4);
+}
+
+template <QuirkProfile Profile> void Chip8::opCode_EXIT() {
+  // 00FD
+  // Exit the interpreter (SUPER-CHIP).
+  //
+  // The machine stays on this instruction from then on, like a jump to self,
+  // and idleState() reports it halted.
+  if constexpr (!QUIRKS.superChip)
+    throwUnknownOpCode();
+
+  pc -= 2;
+}
+
+template <QuirkProfile Profile> void Chip8::opCode_LOW() {
+  // 00FE
+  // Switch to the 64x32 lo-res screen (SUPER-CHIP), which clears it.
+  if constexpr (!QUIRKS.superChip)
+    throwUnknownOpCode();
+
+  drawFlag = true;
+  display.setHires(false);
+}
+
+template <QuirkProfile Profile> void Chip8::opCode_HIGH() {
+  // 00FF
+  // Switch to the 128x64 hi-res screen (SUPER-CHIP), which clears it.
+  if constexpr (!QUIRKS.superChip)
+    throwUnknownOpCode();
+
+  drawFlag = true;
+  display.setHires(true);
+}
+
+template <QuirkProfile Profile> void Chip8::opCode_JP() {
   // 1NNN
   // Jump to location nnn.
   //
   // The interpreter sets the program counter to nnn.
 
-  pc = currentOpCode & 0x0FFF;
+  pc = NNN;
 }
 
-void Chip8::opCode_CALL() {
+template <QuirkProfile Profile> void Chip8::opCode_CALL() {
   // 2NNN
   // Call subroutine at nnn.
   //
   // The interpreter increments the stack pointer, then puts the current PC on
   // the top of the stack. The PC is then set to nnn.
-  stack.push(pc);
-  pc = currentOpCode & 0x0FFF;
+  if (sp == STACK_DEPTH)
+    throw std::runtime_error("stack overflow");
+
+  stack[sp++] = pc;
+  pc = NNN;
 }
-void Chip8::opCode_SE_VX_KK() {
+template <QuirkProfile Profile> void Chip8::opCode_SE_VX_KK() {
   // 3XKK
   // Skip next instruction if Vx = kk.
   //
   // The interpreter compares register Vx to kk, and if they are equal,
   // increments the program counter by 2.
-  if (VX == (currentOpCode & 0x00FF)) {
+  if (VX == KK) {
     pc += 2;
   }
 }
-void Chip8::opCode_SNE_VX_KK() {
+template <QuirkProfile Profile> void Chip8::opCode_SNE_VX_KK() {
   // 4XKK
   // Skip next instruction if Vx != kk.
   //
   //  The interpreter compares register Vx to kk, and if they are not equal,
   //  increments the program counter by 2.
-  if (VX != (currentOpCode & 0x00FF)) {
+  if (VX != KK) {
     pc += 2;
   }
 }
-void Chip8::opCode_SE_VX_VY() {
+template <QuirkProfile Profile> void Chip8::opCode_SE_VX_VY() {
   // 5XY0
   // Skip next instruction if Vx = Vy.
   //
@@ -74,26 +159,26 @@ void Chip8::opCode_SE_VX_VY() {
   }
 }
 
-void Chip8::opCode_LD_VX_KK() {
+template <QuirkProfile Profile> void Chip8::opCode_LD_VX_KK() {
   // 6XKK
   // Set Vx = kk.
   //
   // The interpreter puts the value kk into register Vx.
 
-  VX = currentOpCode & 0x00FF;
+  VX = KK;
 }
 
-void Chip8::opCode_ADD_VX_KK() {
+template <QuirkProfile Profile> void Chip8::opCode_ADD_VX_KK() {
   // 7XKK
   // Set Vx = Vx + kk.
   //
   // Adds the value kk to the value of register Vx, then stores the result in
   // Vx.
 
-  VX += currentOpCode & 0x00FF;
+  VX += KK;
 }
 
-void Chip8::opCode_LD_VX_VY() {
+template <QuirkProfile Profile> void Chip8::opCode_LD_VX_VY() {
   // 8XY0
   // Set Vx = Vy.
   //
@@ -101,7 +186,7 @@ void Chip8::opCode_LD_VX_VY() {
 
   VX = VY;
 }
-void Chip8::opCode_OR_VX_VY() {
+template <QuirkProfile Profile> void Chip8::opCode_OR_VX_VY() {
   // 8XY1
   // Set VX = VX OR VY
   //
@@ -111,9 +196,11 @@ void Chip8::opCode_OR_VX_VY() {
   // is 0.
 
   VX = VX | VY;
+  if constexpr (QUIRKS.logicResetsVF)
+    V[0xF] = 0;
 }
 
-void Chip8::opCode_AND_VX_VY() {
+template <QuirkProfile Profile> void Chip8::opCode_AND_VX_VY() {
   // 8XY2
   // Set VX = VX AND Vy
   //
@@ -123,8 +210,10 @@ void Chip8::opCode_AND_VX_VY() {
   // it is 0.
 
   VX = VX & VY;
+  if constexpr (QUIRKS.logicResetsVF)
+    V[0xF] = 0;
 }
-void Chip8::opCode_XOR_VX_VY() {
+template <QuirkProfile Profile> void Chip8::opCode_XOR_VX_VY() {
   // 8XY3
   // Set VX = VX XOR VY
   //
@@ -134,8 +223,10 @@ void Chip8::opCode_XOR_VX_VY() {
   //  in the result is set to 1. Otherwise, it is 0.
 
   VX = VX ^ VY;
+  if constexpr (QUIRKS.logicResetsVF)
+    V[0xF] = 0;
 }
-void Chip8::opCode_ADD_VX_VY() {
+template <QuirkProfile Profile> void Chip8::opCode_ADD_VX_VY() {
   // 8XY4
   // Set Vx = Vx + Vy, set VF = carry.
   //
@@ -152,77 +243,80 @@ void Chip8::opCode_ADD_VX_VY() {
     V[0xF] = 0;
   }
 }
-void Chip8::opCode_SUB_VX_VY() {
+template <QuirkProfile Profile> void Chip8::opCode_SUB_VX_VY() {
   // 8XY5
   // Set Vx = Vx - Vy, set VF = NOT borrow.
   //
-  // If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from
+  // If Vx >= Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from
   // Vx, and the results stored in Vx.
 
   int result = VX - VY;
   VX = result;
 
-  if (result > 0)
+  if (result >= 0)
     V[0xF] = 1;
   else {
     V[0xF] = 0;
   }
 }
-void Chip8::opCode_SHR_VX() {
+template <QuirkProfile Profile> void Chip8::opCode_SHR_VX() {
   // 8XY6
   // Set Vx = Vx SHR 1.
   //
   // If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0.
-  // Then Vx is divided by 2.
+  // Then Vx is divided by 2. The VIP and XO-CHIP shift Vy into Vx instead.
 
+  uint8_t source = QUIRKS.shiftReadsVY ? VY : VX;
   bool overflows = false;
 
-  if ((VX & 0b00000001) == 0b00000001)
+  if ((source & 0b00000001) == 0b00000001)
     overflows = true;
 
-  VX >>= 1;
+  VX = source >> 1;
 
   if (overflows)
     V[0xF] = 1;
   else
     V[0xF] = 0;
 }
-void Chip8::opCode_SUBN_VX_VY() {
+template <QuirkProfile Profile> void Chip8::opCode_SUBN_VX_VY() {
   // 8XY7
   // Set Vx = Vy - Vx, set VF = NOT borrow.
   //
-  // If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from
+  // If Vy >= Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from
   // Vy, and the results stored in Vx.
 
   int result = VY - VX;
   VX = result;
 
-  if (result > 0)
+  if (result >= 0)
     V[0xF] = 1;
   else {
     V[0xF] = 0;
   }
 }
-void Chip8::opCode_SHL_VX() {
+template <QuirkProfile Profile> void Chip8::opCode_SHL_VX() {
   // 8XYE
   // Set Vx = Vx SHL 1.
   //
   // If the most-significant bit of Vx is 1, then VF is set to 1, otherwise to
-  // 0. Then Vx is multiplied by 2.
+  // 0. Then Vx is multiplied by 2. The VIP and XO-CHIP shift Vy into Vx
+  // instead.
 
+  uint8_t source = QUIRKS.shiftReadsVY ? VY : VX;
   bool overflows = false;
 
-  if ((VY & 0b10000000) == 0b10000000)
+  if ((source & 0b10000000) == 0b10000000)
     overflows = true;
 
-  VX = (VY << 1);
+  VX = (source << 1);
 
   if (overflows)
     V[0xF] = 1;
   else
     V[0xF] = 0;
 }
-void Chip8::opCode_SNE_VX_VY() {
+template <QuirkProfile Profile> void Chip8::opCode_SNE_VX_VY() {
   // 9XY0
   // Skip next instruction if Vx != Vy.
   //
@@ -233,23 +327,24 @@ void Chip8::opCode_SNE_VX_VY() {
     pc += 2;
 }
 
-void Chip8::opCode_LD_I() {
+template <QuirkProfile Profile> void Chip8::opCode_LD_I() {
   // ANNN
   // Set I = nnn.
   //
   // The value of register I is set to nnn.
-  I = currentOpCode & 0x0FFF;
+  I = NNN;
 }
 
-void Chip8::opCode_JP_V0() {
+template <QuirkProfile Profile> void Chip8::opCode_JP_V0() {
   // BNNN
   // Jump to location nnn + V0.
   //
-  // The program counter is set to nnn plus the value of V0.
+  // The program counter is set to nnn plus the value of V0. CHIP-48 and
+  // SUPER-CHIP read it as BXNN instead, a jump to xnn plus Vx.
 
-  pc = (currentOpCode & 0x0FFF) + V[0x0];
+  pc = NNN + (QUIRKS.jumpUsesVX ? VX : V[0x0]);
 }
-void Chip8::opCode_RND_VX() {
+template <QuirkProfile Profile> void Chip8::opCode_RND_VX() {
   // CXKK
   // Set Vx = random byte AND kk.
   //
@@ -257,10 +352,10 @@ void Chip8::opCode_RND_VX() {
   // ANDed with the value kk. The results are stored in Vx. See instruction 8xy2
   // for more information on AND.
 
-  VX = (rand() % 256) & (currentOpCode & 0x00FF);
+  VX = rng.nextByte() & KK;
 }
 
-void Chip8::opCode_DRW_VX_VY() {
+template <QuirkProfile Profile> void Chip8::opCode_DRW_VX_VY() {
   // DXYN
   // Display n-byte sprite starting at memory location I at (Vx, Vy), set VF =
   // collision.
@@ -273,63 +368,73 @@ void Chip8::opCode_DRW_VX_VY() {
   // display, it wraps around to the opposite side of the screen. See
   // instruction 8xy3 for more information on XOR, and section 2.4, Display, for
   // more information on the Chip-8 screen and sprites.
+  //
+  // Only XO-CHIP wraps the sprite itself, the others clip it at the edges.
+  // SUPER-CHIP draws DXY0 as a 16x16 sprite of two bytes per row, and
+  // XO-CHIP draws to every plane selected by FN01, the sprite for plane 1
+  // following the one for plane 0 in memory.
 
   drawFlag = true;
 
-  int initialX = VX; // support wrapping for 1st pixel
-  int initialY = VY;
-  int numRows = currentOpCode & 0x000F;
-
-  V[0xF] = 0;
-
-  auto togglePixel = [this](int x, int y) {
-    if (display.getPixel(x, y) == 0x00000000) {
-      display.setPixel(x, y, 0xFFFFFFFF);
-    } else {
-      display.setPixel(x, y, 0xFF000000);
-      V[0xF] = 1;
-    }
-  };
-
-  for (int row = 0; row < numRows; ++row) {
-    std::bitset<8> bs = memory[I + row];
-    for (int col = 1; col <= bs.size(); ++col) {
-      int x = initialX + col - 1;
-      int y = initialY + row;
-      if (bs[bs.size() - col]) {
-        if (x < DISPLAY_WIDTH && y < DISPLAY_HEIGHT)
-          togglePixel(x, y);
+  // the resolution only changes where SUPER-CHIP is
+  int width = QUIRKS.superChip ? display.getWidth() : DISPLAY_WIDTH;
+  int height = QUIRKS.superChip ? display.getHeight() : DISPLAY_HEIGHT;
+  int initialX = VX % width; // support wrapping for 1st pixel
+  int initialY = VY % height;
+  bool wide = QUIRKS.superChip && current.n == 0;
+  int numRows = wide ? 16 : current.n;
+
+  // one shift + XOR per word a sprite row touches on the packed display,
+  // collision is any lit pixel under the sprite
+  bool collision = false;
+  uint16_t address = I;
+  constexpr int planeCount = QUIRKS.xoChip ? PLANE_COUNT : 1;
+  for (int plane = 0; plane < planeCount; ++plane) {
+    if ((display.getPlaneMask() >> plane & 1) == 0)
+      continue;
+    for (int row = 0; row < numRows; ++row) {
+      uint16_t spriteRow;
+      if (wide) {
+        spriteRow = memory[address & MEMORY_MASK] << 8 |
+                    memory[(address + 1) & MEMORY_MASK];
+        address += 2;
+      } else {
+        spriteRow = memory[address++ & MEMORY_MASK] << 8;
       }
+      collision |= display.drawSpriteRow(plane, initialX, initialY + row,
+                                         spriteRow, QUIRKS.spritesWrap);
     }
   }
+
+  V[0xF] = collision;
 }
 
-void Chip8::opCode_SKP_VX() {
+template <QuirkProfile Profile> void Chip8::opCode_SKP_VX() {
   // EX9E
   // Skip next instruction if key with the value of Vx is pressed.
   //
   // Checks the keyboard, and if the key corresponding to the value of Vx is
   // currently in the down position, PC is increased by 2.
 
-  if (keyPress[VX]) {
+  if (keyPress[VX & 0xF]) {
     // skip instruction
     pc += 2;
   }
 }
-void Chip8::opCode_SKNP_VX() {
+template <QuirkProfile Profile> void Chip8::opCode_SKNP_VX() {
   // EXA1
   // Skip next instruction if key with the value of Vx is not pressed.
   //
   //  Checks the keyboard, and if the key corresponding to the value of Vx is
   //  currently in the up position, PC is increased by 2.
 
-  if (!(keyPress[VX])) {
+  if (!(keyPress[VX & 0xF])) {
     // skip instruction
     pc += 2;
   }
 }
 
-void Chip8::opCode_LD_VX_DT() {
+template <QuirkProfile Profile> void Chip8::opCode_LD_VX_DT() {
   // FX07
   // Set Vx = delay timer value.
   //
@@ -338,7 +443,7 @@ void Chip8::opCode_LD_VX_DT() {
   VX = delayTimer;
 }
 
-void Chip8::opCode_LD_VX_K() {
+template <QuirkProfile Profile> void Chip8::opCode_LD_VX_K() {
   // FX0A
   // Wait for a key press, store the value of the key in VX
   //
@@ -363,7 +468,7 @@ void Chip8::opCode_LD_VX_K() {
   return;
 }
 
-void Chip8::opCode_LD_DT_VX() {
+template <QuirkProfile Profile> void Chip8::opCode_LD_DT_VX() {
   // FX15
   // Set delay timer = Vx.
   //
@@ -372,15 +477,15 @@ void Chip8::opCode_LD_DT_VX() {
   delayTimer = VX;
 }
 
-void Chip8::opCode_LD_ST_VX() {
+template <QuirkProfile Profile> void Chip8::opCode_LD_ST_VX() {
   // FX18
   // Set sound timer = Vx.
   //
   // ST is set equal to the value of Vx.
-  soundTimer = VX;
+  setSoundTimer(VX, cycleCount);
 }
 
-void Chip8::opCode_ADD_I_VX() {
+template <QuirkProfile Profile> void Chip8::opCode_ADD_I_VX() {
   // FX1E
   // Set I = I + Vx.
   //
@@ -388,7 +493,7 @@ void Chip8::opCode_ADD_I_VX() {
 
   I += VX;
 }
-void Chip8::opCode_LD_F_VX() {
+template <QuirkProfile Profile> void Chip8::opCode_LD_F_VX() {
   // FX29
   // Set I = location of sprite for digit Vx.
   //
@@ -403,7 +508,7 @@ void Chip8::opCode_LD_F_VX() {
 
   I = FONT_LOCATION + fontOffset;
 }
-void Chip8::opCode_LD_B_VX() {
+template <QuirkProfile Profile> void Chip8::opCode_LD_B_VX() {
   // FX33
   // Store BCD representation of Vx in memory locations I, I+1, and I+2.
   //
@@ -411,32 +516,75 @@ void Chip8::opCode_LD_B_VX() {
   // digit in memory at location in I, the tens digit at location I+1, and the
   // ones digit at location I+2.
 
-  memory[I] = (VX) / 100;
-  memory[I + 1] = (VX / 10) % 10;
-  memory[I + 2] = (VX) % 10;
+  writeMemory(I, (VX) / 100);
+  writeMemory(I + 1, (VX / 10) % 10);
+  writeMemory(I + 2, (VX) % 10);
 }
-void Chip8::opCode_LD_I_VX() {
+template <QuirkProfile Profile> void Chip8::opCode_LD_I_VX() {
   // FX55
   // Store registers V0 through Vx in memory starting at location I.
   //
   // The interpreter copies the values of registers V0 through Vx into memory,
-  // starting at the address in I.
+  // starting at the address in I. The VIP and XO-CHIP leave I past the last
+  // register written, CHIP-48 one short of that.
 
-  for (uint8_t offset = 0; offset <= ((currentOpCode & 0x0F00) >> 8);
+  for (uint8_t offset = 0; offset <= current.x;
        ++offset) {
-    memory[I + offset] = V[offset];
+    writeMemory(I + offset, V[offset]);
   }
+  if constexpr (QUIRKS.indexIncrement == IndexIncrement::XPlusOne)
+    I += current.x + 1;
+  else if constexpr (QUIRKS.indexIncrement == IndexIncrement::X)
+    I += current.x;
 }
-void Chip8::opCode_LD_VX_I() {
+template <QuirkProfile Profile> void Chip8::opCode_LD_VX_I() {
   // FX65
   // Read registers V0 through Vx from memory starting at location I.
   //
   // The interpreter reads values from memory starting at location I into
-  // registers V0 through Vx.
+  // registers V0 through Vx. I moves as in FX55.
 
-  for (int offset = 0; offset <= ((currentOpCode & 0x0F00) >> 8); ++offset) {
-    V[offset] = memory[I + offset];
+  for (int offset = 0; offset <= current.x; ++offset) {
+    V[offset] = memory[(I + offset) & MEMORY_MASK];
   }
-}
+  if constexpr (QUIRKS.indexIncrement == IndexIncrement::XPlusOne)
+    I += current.x + 1;
+  else if constexpr (QUIRKS.indexIncrement == IndexIncrement::X)
+    I += current.x;
+}
+
+template <QuirkProfile Profile> void Chip8::opCode_PLANE() {
+  // FN01
+  // Select the planes that drawing, clearing and scrolling apply to
+  // (XO-CHIP).
+  //
+  // N is a bit mask, bit 0 for plane 0 and bit 1 for plane 1.
+  if constexpr (!QUIRKS.xoChip)
+    throwUnknownOpCode();
+
+  display.setPlaneMask(current.x);
+}
+
+template <QuirkProfile Profile> void Chip8::opCode_UNKNOWN() {
+  throwUnknownOpCode();
+}
+
+// every handler for every profile, the dispatch engines pick theirs
+static_assert(QUIRK_PROFILE_COUNT == 4, "instantiate the new profile below");
+#define PCHIP8_INSTANTIATE_HANDLER(name, pattern)                              \
+  template void Chip8::opCode_##name<PCHIP8_PROFILE>();
+#define PCHIP8_PROFILE QuirkProfile::Vip
+PCHIP8_OPCODES(PCHIP8_INSTANTIATE_HANDLER)
+#undef PCHIP8_PROFILE
+#define PCHIP8_PROFILE QuirkProfile::Chip48
+PCHIP8_OPCODES(PCHIP8_INSTANTIATE_HANDLER)
+#undef PCHIP8_PROFILE
+#define PCHIP8_PROFILE QuirkProfile::SuperChip
+PCHIP8_OPCODES(PCHIP8_INSTANTIATE_HANDLER)
+#undef PCHIP8_PROFILE
+#define PCHIP8_PROFILE QuirkProfile::XoChip
+PCHIP8_OPCODES(PCHIP8_INSTANTIATE_HANDLER)
+#undef PCHIP8_PROFILE
+#undef PCHIP8_INSTANTIATE_HANDLER
 
 } // namespace PChip8
@@ -0,0 +1,181 @@
+#include "rom_pack.h"
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// ROM pack builder
+//
+// Packs ROM files into one .c8pk file for pchip8-batch and pchip8, each under
+// the path it was given as, with the settings from the command line or from
+// its line in the ROM list. Also lists the contents of a pack.
+
+namespace {
+void printUsage(const char *program) {
+  std::cerr << "usage: " << program
+            << " -o pack.c8pk [-f instructions_per_frame] [-q quirks] "
+               "[-k keymap] [-l rom_list] [rom ...]\n"
+            << "       " << program << " -t pack.c8pk\n"
+            << "-f, -q and -k set the defaults for every ROM, a rom_list line "
+               "can override them: path [ipf=n] [quirks=name] [keys=keymap]\n"
+            << "quirks: vip (default), chip48, schip, xochip\n"
+            << "keymap is 16 hex digits, the CHIP-8 key pressed by keypad "
+               "keys 0 to F\n"
+            << "-t lists the ROMs in a pack\n";
+}
+
+// throws std::invalid_argument if keys is not 16 hex digits
+std::array<uint8_t, PChip8::KEY_COUNT> parseKeyMap(const std::string &keys) {
+  std::array<uint8_t, PChip8::KEY_COUNT> keyMap{};
+  if (keys.size() != keyMap.size())
+    throw std::invalid_argument("key map needs 16 hex digits: " + keys);
+  for (std::size_t key = 0; key < keyMap.size(); ++key) {
+    keyMap[key] = std::stoi(keys.substr(key, 1), nullptr, 16);
+  }
+  return keyMap;
+}
+
+// A rom_list line, `path [ipf=n] [quirks=name] [keys=keymap]`
+// throws std::invalid_argument on an unknown or malformed setting
+std::pair<std::string, PChip8::RomSettings>
+parseListLine(const std::string &line, PChip8::RomSettings settings) {
+  std::istringstream fields{line};
+  std::string path;
+  fields >> path;
+  for (std::string field; fields >> field;) {
+    auto equals = field.find('=');
+    std::string key = field.substr(0, equals);
+    std::string value =
+        equals == std::string::npos ? "" : field.substr(equals + 1);
+    if (key == "ipf")
+      settings.instructionsPerFrame = std::stoul(value);
+    else if (key == "quirks")
+      settings.quirks = PChip8::parseQuirkProfile(value);
+    else if (key == "keys")
+      settings.keyMap = parseKeyMap(value);
+    else
+      throw std::invalid_argument("unknown setting " + field);
+  }
+  return {path, settings};
+}
+
+void listPack(const PChip8::RomPack &pack) {
+  std::cout << "name,size,hash,ipf,quirks,keys\n";
+  for (std::size_t i = 0; i < pack.size(); ++i) {
+    const auto &settings = pack.getSettings(i);
+    std::cout << pack.getName(i) << ',' << pack.getBytes(i).size() << ','
+              << std::hex << std::setw(16) << std::setfill('0')
+              << pack.getHash(i) << std::dec << std::setfill(' ') << ','
+              << settings.instructionsPerFrame << ','
+              << PChip8::quirkProfileName(settings.quirks) << ',' << std::hex
+              << std::uppercase;
+    for (auto key : settings.keyMap) {
+      std::cout << int{key};
+    }
+    std::cout << std::dec << std::nouppercase << '\n';
+  }
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::string outputFile;
+  std::string listFile;
+  PChip8::RomSettings defaults;
+  std::vector<std::pair<std::string, PChip8::RomSettings>> roms;
+  std::vector<std::string> romLists;
+
+  try {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg = argv[i];
+      if ((arg == "-o" || arg == "-t" || arg == "-f" || arg == "-q" ||
+           arg == "-k" || arg == "-l") &&
+          i + 1 >= argc) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+      }
+
+      if (arg == "-o") {
+        outputFile = argv[++i];
+      } else if (arg == "-t") {
+        listFile = argv[++i];
+      } else if (arg == "-f") {
+        defaults.instructionsPerFrame = std::stoul(argv[++i]);
+      } else if (arg == "-q") {
+        defaults.quirks = PChip8::parseQuirkProfile(argv[++i]);
+      } else if (arg == "-k") {
+        defaults.keyMap = parseKeyMap(argv[++i]);
+      } else if (arg == "-l") {
+        romLists.push_back(argv[++i]);
+      } else if (arg == "-h" || arg == "--help") {
+        printUsage(argv[0]);
+        return EXIT_SUCCESS;
+      } else {
+        roms.emplace_back(arg, PChip8::RomSettings{});
+      }
+    }
+  } catch (std::exception &e) {
+    std::cerr << "error: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+
+  if (!listFile.empty()) {
+    try {
+      listPack(*PChip8::RomPack::open(listFile));
+    } catch (std::exception &e) {
+      std::cerr << "error: " << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  // the defaults apply whatever their position on the command line
+  for (auto &[path, settings] : roms) {
+    settings = defaults;
+  }
+  for (const auto &romList : romLists) {
+    std::ifstream lines{romList};
+    if (!lines) {
+      std::cerr << "error: could not open " << romList << '\n';
+      return EXIT_FAILURE;
+    }
+    for (std::string line; std::getline(lines, line);) {
+      if (line.find_first_not_of(" \t") == std::string::npos)
+        continue;
+      try {
+        roms.push_back(parseListLine(line, defaults));
+      } catch (std::exception &e) {
+        std::cerr << "error: " << romList << ": " << e.what() << '\n';
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  if (outputFile.empty() || roms.empty()) {
+    printUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    std::vector<PChip8::RomPackEntry> entries;
+    entries.reserve(roms.size());
+    std::size_t bytes = 0;
+    for (const auto &[path, settings] : roms) {
+      auto image = PChip8::RomImage::fromFile(path);
+      auto romBytes = image->getBytes();
+      entries.push_back({path, {romBytes.begin(), romBytes.end()}, settings});
+      bytes += romBytes.size();
+    }
+    PChip8::RomPack::write(outputFile, std::move(entries));
+    std::cerr << roms.size() << " roms, " << bytes << " bytes packed into "
+              << outputFile << '\n';
+  } catch (std::exception &e) {
+    std::cerr << "error: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,150 @@
+#include "planar_display.h"
+#include <algorithm>
+#include <cstring>
+
+namespace PChip8 {
+void PlanarDisplay::setHires(bool enable) {
+  hires = enable;
+  width = enable ? HIRES_WIDTH : DISPLAY_WIDTH;
+  height = enable ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+  wordsPerRow = width / 64;
+  for (auto &plane : planes) {
+    std::fill(plane.begin(), plane.end(), 0);
+  }
+  dirtyRows = ~uint64_t{0};
+  usedPlanes = 0;
+}
+
+void PlanarDisplay::setPlaneMask(uint8_t mask) {
+  planeMask = mask & ((1 << PLANE_COUNT) - 1);
+}
+
+void PlanarDisplay::clear() {
+  for (int plane = 0; plane < PLANE_COUNT; ++plane) {
+    if (planeMask >> plane & 1)
+      std::fill_n(planes[plane].begin(), wordsPerRow * height, 0);
+  }
+  dirtyRows = ~uint64_t{0};
+  usedPlanes &= ~planeMask;
+}
+
+void PlanarDisplay::reset() {
+  planeMask = 1;
+  setHires(false);
+}
+
+void PlanarDisplay::scrollDown(int pixels) {
+  int rows = std::min(pixels, height);
+  std::size_t moved = (height - rows) * wordsPerRow;
+  for (int plane = 0; plane < PLANE_COUNT; ++plane) {
+    if ((planeMask >> plane & 1) == 0)
+      continue;
+    uint64_t *words = planes[plane].data();
+    std::memmove(words + rows * wordsPerRow, words, moved * sizeof(uint64_t));
+    std::fill_n(words, rows * wordsPerRow, 0);
+  }
+  dirtyRows = ~uint64_t{0};
+}
+
+void PlanarDisplay::scrollUp(int pixels) {
+  int rows = std::min(pixels, height);
+  std::size_t moved = (height - rows) * wordsPerRow;
+  for (int plane = 0; plane < PLANE_COUNT; ++plane) {
+    if ((planeMask >> plane & 1) == 0)
+      continue;
+    uint64_t *words = planes[plane].data();
+    std::memmove(words, words + rows * wordsPerRow, moved * sizeof(uint64_t));
+    std::fill_n(words + moved, rows * wordsPerRow, 0);
+  }
+  dirtyRows = ~uint64_t{0};
+}
+
+void PlanarDisplay::scrollRight(int pixels) {
+  if (pixels <= 0)
+    return;
+  for (int plane = 0; plane < PLANE_COUNT; ++plane) {
+    if ((planeMask >> plane & 1) == 0)
+      continue;
+    uint64_t *words = planes[plane].data();
+    if (pixels >= 64) {
+      // only reachable with wider scrolls than any opcode asks for
+      std::fill_n(words, wordsPerRow * height, 0);
+      continue;
+    }
+    // each word takes the low bits of the one to its left
+    for (int y = 0; y < height; ++y) {
+      uint64_t *row = words + y * wordsPerRow;
+      for (int word = wordsPerRow - 1; word > 0; --word) {
+        row[word] = row[word] >> pixels | row[word - 1] << (64 - pixels);
+      }
+      row[0] >>= pixels;
+    }
+  }
+  dirtyRows = ~uint64_t{0};
+}
+
+void PlanarDisplay::scrollLeft(int pixels) {
+  if (pixels <= 0)
+    return;
+  for (int plane = 0; plane < PLANE_COUNT; ++plane) {
+    if ((planeMask >> plane & 1) == 0)
+      continue;
+    uint64_t *words = planes[plane].data();
+    if (pixels >= 64) {
+      std::fill_n(words, wordsPerRow * height, 0);
+      continue;
+    }
+    // each word takes the high bits of the one to its right
+    for (int y = 0; y < height; ++y) {
+      uint64_t *row = words + y * wordsPerRow;
+      unsigned int last = wordsPerRow - 1;
+      for (unsigned int word = 0; word < last; ++word) {
+        row[word] = row[word] << pixels | row[word + 1] >> (64 - pixels);
+      }
+      row[last] <<= pixels;
+    }
+  }
+  dirtyRows = ~uint64_t{0};
+}
+
+std::span<const uint64_t> PlanarDisplay::getRows(int plane) const {
+  return {planes[plane].data(), wordsPerRow * height};
+}
+
+void PlanarDisplay::setRows(int plane, std::span<const uint64_t> rows) {
+  std::size_t size = std::min<std::size_t>(rows.size(), wordsPerRow * height);
+  std::copy_n(rows.begin(), size, planes[plane].begin());
+  std::fill(planes[plane].begin() + size, planes[plane].end(), 0);
+  dirtyRows = ~uint64_t{0};
+  usedPlanes &= ~(1 << plane);
+  usedPlanes |= isLit(plane) << plane;
+}
+
+bool PlanarDisplay::isLit(int plane) const {
+  auto rows = getRows(plane);
+  return std::any_of(rows.begin(), rows.end(),
+                     [](uint64_t word) { return word != 0; });
+}
+
+uint64_t PlanarDisplay::hash() const {
+  // 64-bit FNV-1a over the packed rows
+  uint64_t result = 0xCBF29CE484222325;
+  for (int plane = 0; plane < PLANE_COUNT; ++plane) {
+    if (plane > 0 && (!isPlaneUsed(plane) || !isLit(plane)))
+      continue;
+    for (uint64_t word : getRows(plane)) {
+      for (int i = 0; i < 8; ++i) {
+        result = (result ^ ((word >> (8 * i)) & 0xFF)) * 0x100000001B3;
+      }
+    }
+  }
+  return result;
+}
+
+uint64_t PlanarDisplay::takeDirtyRows() {
+  uint64_t rows = dirtyRows & (height == 64 ? ~uint64_t{0}
+                                            : (uint64_t{1} << height) - 1);
+  dirtyRows = 0;
+  return rows;
+}
+} // namespace PChip8
@@ -0,0 +1,185 @@
+#include "capture.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+// Capture file player
+//
+// Plays a capture written by pchip8-batch -C in the terminal at the speed it
+// was recorded, prints statistics about it, or converts its frames to PGM
+// images.
+
+namespace {
+void printUsage(const char *program) {
+  std::cerr << "usage: " << program
+            << " [-s speed] [-i] [-o prefix [-f frame]] capture.p8cap\n"
+            << "plays the capture in the terminal, -s scales its speed (0 "
+               "plays it as fast as possible)\n"
+            << "-i prints the frame count, duration and compression ratio "
+               "instead\n"
+            << "-o writes every frame to prefix-NNNNNN.pgm instead, or only "
+               "frame number -f\n";
+}
+
+bool isLit(const PChip8::CaptureFrame &frame, int plane, int x, int y) {
+  int wordsPerRow = frame.getWidth() / 64;
+  uint64_t word = frame.getRows(plane)[y * wordsPerRow + x / 64];
+  return (word >> (63 - x % 64)) & 1;
+}
+
+// Both planes of a pixel, bit p for plane p
+int pixel(const PChip8::CaptureFrame &frame, int x, int y) {
+  int value = isLit(frame, 0, x, y);
+  if (frame.twoPlanes)
+    value |= isLit(frame, 1, x, y) << 1;
+  return value;
+}
+
+// Two rows per line of half blocks, any plane lights a pixel
+void drawFrame(const PChip8::CaptureFrame &frame) {
+  static constexpr const char *BLOCKS[] = {" ", "▀", "▄", "█"};
+  std::string text = "\x1b[H";
+  for (int y = 0; y < frame.getHeight(); y += 2) {
+    for (int x = 0; x < frame.getWidth(); ++x) {
+      text += BLOCKS[(pixel(frame, x, y) != 0) |
+                     (pixel(frame, x, y + 1) != 0) << 1];
+    }
+    text += "\x1b[K\n";
+  }
+  text += "\x1b[J";
+  std::cout << text << std::flush;
+}
+
+// Binary PGM, plane 0 white, plane 1 light grey and both dark grey
+void writePGM(const std::string &fileName, const PChip8::CaptureFrame &frame) {
+  static constexpr uint8_t SHADES[] = {0, 255, 170, 85};
+  std::ofstream out(fileName, std::ios::binary);
+  out << "P5\n" << frame.getWidth() << ' ' << frame.getHeight() << "\n255\n";
+  for (int y = 0; y < frame.getHeight(); ++y) {
+    for (int x = 0; x < frame.getWidth(); ++x) {
+      out.put(static_cast<char>(SHADES[pixel(frame, x, y)]));
+    }
+  }
+  if (!out)
+    throw std::runtime_error("Could not write " + fileName);
+}
+
+std::string frameFileName(const std::string &prefix, uint64_t frameNumber) {
+  std::ostringstream name;
+  name << prefix << '-' << std::setw(6) << std::setfill('0') << frameNumber
+       << ".pgm";
+  return name.str();
+}
+
+double seconds(uint64_t cycle, uint32_t instructionsPerFrame) {
+  return static_cast<double>(cycle) / std::max(instructionsPerFrame, 1u) / 60.0;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::string captureFile;
+  std::string outputPrefix;
+  std::optional<uint64_t> onlyFrame;
+  double speed = 1.0;
+  bool info = false;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if ((arg == "-s" || arg == "-o" || arg == "-f") && i + 1 >= argc) {
+      printUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+
+    if (arg == "-s") {
+      speed = std::stod(argv[++i]);
+    } else if (arg == "-o") {
+      outputPrefix = argv[++i];
+    } else if (arg == "-f") {
+      onlyFrame = std::stoull(argv[++i]);
+    } else if (arg == "-i") {
+      info = true;
+    } else if (arg == "-h" || arg == "--help") {
+      printUsage(argv[0]);
+      return EXIT_SUCCESS;
+    } else {
+      captureFile = arg;
+    }
+  }
+
+  if (captureFile.empty() || (onlyFrame && outputPrefix.empty())) {
+    printUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  try {
+    PChip8::CaptureReader reader{captureFile};
+    uint32_t instructionsPerFrame = reader.getInstructionsPerFrame();
+    uint64_t frameCount = 0;
+    uint64_t keyframeCount = 0;
+    uint64_t rawBytes = 0;
+    bool found = false;
+    auto start = std::chrono::steady_clock::now();
+
+    for (; reader.next(); ++frameCount) {
+      const auto &frame = reader.getFrame();
+      keyframeCount += frame.keyframe;
+      rawBytes += frame.getWidth() * frame.getHeight() / 8 *
+                  (frame.twoPlanes ? 2 : 1);
+
+      if (info)
+        continue;
+      if (!outputPrefix.empty()) {
+        if (!onlyFrame || *onlyFrame == frameCount)
+          writePGM(frameFileName(outputPrefix, frameCount), frame);
+        if (onlyFrame && *onlyFrame == frameCount) {
+          found = true;
+          break;
+        }
+        continue;
+      }
+
+      if (speed > 0) {
+        auto due = start + std::chrono::duration_cast<
+                               std::chrono::steady_clock::duration>(
+                               std::chrono::duration<double>(
+                                   seconds(frame.cycle, instructionsPerFrame) /
+                                   speed));
+        std::this_thread::sleep_until(due);
+      }
+      drawFrame(frame);
+    }
+
+    if (info) {
+      uint64_t fileBytes = reader.getBytesRead();
+      std::cout << "frames: " << frameCount << " (" << keyframeCount
+                << " keyframes)\n"
+                << "duration: " << std::fixed << std::setprecision(2)
+                << seconds(reader.getFrame().cycle, instructionsPerFrame)
+                << " s at " << instructionsPerFrame
+                << " instructions per frame\n"
+                << "size: " << fileBytes << " bytes, " << rawBytes
+                << " bytes of packed frames ("
+                << std::setprecision(1)
+                << (fileBytes > 0 ? static_cast<double>(rawBytes) / fileBytes
+                                  : 0.0)
+                << ":1)\n";
+    } else if (onlyFrame && !found) {
+      std::cerr << "error: " << captureFile << " has only " << frameCount
+                << " frames\n";
+      return EXIT_FAILURE;
+    }
+  } catch (std::exception &e) {
+    std::cerr << "error: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,112 @@
+#include "profile.h"
+#include <fstream>
+#include <stdexcept>
+
+namespace PChip8 {
+namespace {
+bool isSkip(int op) {
+  switch (static_cast<Op>(op)) {
+  case Op::SE_VX_KK:
+  case Op::SNE_VX_KK:
+  case Op::SE_VX_VY:
+  case Op::SNE_VX_VY:
+  case Op::SKP_VX:
+  case Op::SKNP_VX:
+    return true;
+  default:
+    return false;
+  }
+}
+} // namespace
+
+void Profile::clear() { *this = Profile{}; }
+
+void Profile::merge(const Profile &other) {
+  for (int op = 0; op < OP_COUNT; ++op) {
+    opCounts[op] += other.opCounts[op];
+    skipsTaken[op] += other.skipsTaken[op];
+  }
+  for (int address = 0; address < ADDRESS_COUNT; ++address) {
+    pcHeatmap[address] += other.pcHeatmap[address];
+  }
+  spriteRows += other.spriteRows;
+}
+
+uint64_t Profile::instructions() const {
+  uint64_t total = 0;
+  for (auto count : opCounts) {
+    total += count;
+  }
+  return total;
+}
+
+double Profile::skipTakenRatio() const {
+  uint64_t skips = 0;
+  uint64_t taken = 0;
+  for (int op = 0; op < OP_COUNT; ++op) {
+    if (isSkip(op)) {
+      skips += opCounts[op];
+      taken += skipsTaken[op];
+    }
+  }
+  return skips > 0 ? static_cast<double>(taken) / skips : 0.0;
+}
+
+void Profile::writeCsv(std::ostream &out) const {
+  out << "kind,key,count,skips_taken\n";
+  for (int op = 0; op < OP_COUNT; ++op) {
+    out << "op," << OP_PATTERNS[op] << ',' << opCounts[op] << ',';
+    if (isSkip(op))
+      out << skipsTaken[op];
+    out << '\n';
+  }
+  out << "sprite_rows,," << spriteRows << ",\n";
+  for (int address = 0; address < ADDRESS_COUNT; ++address) {
+    if (pcHeatmap[address] != 0)
+      out << "pc," << address << ',' << pcHeatmap[address] << ",\n";
+  }
+}
+
+void Profile::writeJson(std::ostream &out) const {
+  out << "{\n  \"instructions\": " << instructions()
+      << ",\n  \"draws\": " << opCounts[static_cast<int>(Op::DRW_VX_VY)]
+      << ",\n  \"sprite_rows\": " << spriteRows
+      << ",\n  \"skip_taken_ratio\": " << skipTakenRatio()
+      << ",\n  \"ops\": [";
+
+  for (int op = 0; op < OP_COUNT; ++op) {
+    out << (op == 0 ? "\n" : ",\n") << "    {\"name\": \"" << OP_NAMES[op]
+        << "\", \"pattern\": \"" << OP_PATTERNS[op]
+        << "\", \"count\": " << opCounts[op];
+    if (isSkip(op))
+      out << ", \"skips_taken\": " << skipsTaken[op];
+    out << '}';
+  }
+
+  // sparse [address, count] pairs, most of the 4K is never executed
+  out << "\n  ],\n  \"pc_heatmap\": [";
+  bool first = true;
+  for (int address = 0; address < ADDRESS_COUNT; ++address) {
+    if (pcHeatmap[address] == 0)
+      continue;
+    out << (first ? "" : ", ") << '[' << address << ", " << pcHeatmap[address]
+        << ']';
+    first = false;
+  }
+  out << "]\n}\n";
+}
+
+void Profile::save(const std::string &fileName) const {
+  std::ofstream profileData{fileName};
+  if (!profileData)
+    throw std::runtime_error("Could not open " + fileName);
+
+  if (fileName.ends_with(".csv"))
+    writeCsv(profileData);
+  else
+    writeJson(profileData);
+
+  if (!profileData)
+    throw std::runtime_error(fileName + " write failed");
+}
+} // namespace PChip8
@@ -0,0 +1,367 @@
+#include "chip8.h"
+#include "scheduler.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Golden-frame regression runner
+//
+// Runs every ROM of a manifest headlessly on a work-stealing thread pool and
+// compares the display hash and the V/I/pc hash at each of its cycle
+// checkpoints with the golden values in the manifest. With -u it records the
+// values of the current build into the manifest instead.
+//
+// A manifest is a text file of ROMs, each followed by its checkpoints:
+//   # comment
+//   rom flags.ch8 ipf=12 quirks=vip seed=0
+//   at 1000 display=73445f9ea82ba8a9 registers=0c1d2e3f40516273
+//   at 50000
+// ROM paths are relative to the manifest, the settings are optional and a
+// checkpoint without hashes fails until recorded.
+
+namespace {
+void printUsage(const char *program) {
+  std::cerr << "usage: " << program
+            << " [-j workers] [-e engine ...] [-u] manifest\n"
+            << "engines: switch, table, threaded, predecoded, jit, aot, or "
+               "all (default: the build's default engine)\n"
+            << "-e can be given more than once, every ROM runs on every "
+               "engine\n"
+            << "-u records the hashes of the first engine into the manifest, "
+               "the others must agree with it\n";
+}
+
+struct Checkpoint {
+  uint64_t cycle = 0;
+  std::optional<uint64_t> displayHash;
+  std::optional<uint64_t> registerHash;
+  // line of the manifest it was read from
+  std::size_t line = 0;
+};
+
+struct ManifestRom {
+  std::string name;
+  std::filesystem::path path;
+  uint32_t instructionsPerFrame = 12;
+  PChip8::QuirkProfile quirks = PChip8::DEFAULT_QUIRKS;
+  uint64_t seed = 0;
+  std::vector<Checkpoint> checkpoints;
+};
+
+struct Manifest {
+  std::vector<std::string> lines;
+  std::vector<ManifestRom> roms;
+};
+
+// What a ROM showed at each checkpoint reached
+struct RunResult {
+  std::vector<std::pair<uint64_t, uint64_t>> hashes;
+  std::string error;
+};
+
+uint64_t parseHash(const std::string &value) {
+  std::size_t end = 0;
+  uint64_t hash = std::stoull(value, &end, 16);
+  if (end != value.size())
+    throw std::invalid_argument("bad hash " + value);
+  return hash;
+}
+
+std::string formatHash(uint64_t hash) {
+  std::ostringstream text;
+  text << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return text.str();
+}
+
+// throws std::invalid_argument naming the line on a malformed one
+Manifest loadManifest(const std::filesystem::path &fileName) {
+  std::ifstream in{fileName};
+  if (!in)
+    throw std::runtime_error("Could not open " + fileName.string());
+
+  Manifest manifest;
+  for (std::string line; std::getline(in, line);) {
+    manifest.lines.push_back(line);
+    std::istringstream fields{line};
+    std::string kind;
+    if (!(fields >> kind) || kind[0] == '#')
+      continue;
+
+    try {
+      if (kind == "rom") {
+        ManifestRom rom;
+        if (!(fields >> rom.name))
+          throw std::invalid_argument("rom needs a path");
+        rom.path = fileName.parent_path() / rom.name;
+        for (std::string field; fields >> field;) {
+          auto equals = field.find('=');
+          std::string key = field.substr(0, equals);
+          std::string value =
+              equals == std::string::npos ? "" : field.substr(equals + 1);
+          if (key == "ipf")
+            rom.instructionsPerFrame = std::stoul(value);
+          else if (key == "quirks")
+            rom.quirks = PChip8::parseQuirkProfile(value);
+          else if (key == "seed")
+            rom.seed = std::stoull(value);
+          else
+            throw std::invalid_argument("unknown setting " + field);
+        }
+        manifest.roms.push_back(std::move(rom));
+      } else if (kind == "at") {
+        if (manifest.roms.empty())
+          throw std::invalid_argument("checkpoint before the first rom");
+        auto &checkpoints = manifest.roms.back().checkpoints;
+        Checkpoint checkpoint;
+        checkpoint.line = manifest.lines.size() - 1;
+        std::string cycle;
+        fields >> cycle;
+        checkpoint.cycle = std::stoull(cycle);
+        if (!checkpoints.empty() && checkpoint.cycle <= checkpoints.back().cycle)
+          throw std::invalid_argument("checkpoints must be in cycle order");
+        for (std::string field; fields >> field;) {
+          if (field.starts_with("display="))
+            checkpoint.displayHash = parseHash(field.substr(8));
+          else if (field.starts_with("registers="))
+            checkpoint.registerHash = parseHash(field.substr(10));
+          else
+            throw std::invalid_argument("unknown field " + field);
+        }
+        checkpoints.push_back(checkpoint);
+      } else {
+        throw std::invalid_argument("expected rom or at, not " + kind);
+      }
+    } catch (std::exception &e) {
+      throw std::invalid_argument(fileName.string() + ":" +
+                                  std::to_string(manifest.lines.size()) +
+                                  ": " + e.what());
+    }
+  }
+  return manifest;
+}
+
+void saveManifest(const std::filesystem::path &fileName,
+                  const Manifest &manifest) {
+  std::ofstream out{fileName, std::ios::trunc};
+  for (const auto &line : manifest.lines) {
+    out << line << '\n';
+  }
+  if (!out)
+    throw std::runtime_error("Could not write " + fileName.string());
+}
+
+RunResult runROM(const ManifestRom &rom, PChip8::Engine engine) {
+  RunResult result;
+  auto chip8 = std::make_unique<PChip8::Chip8>();
+  chip8->setEngine(engine);
+  chip8->setQuirks(rom.quirks);
+  chip8->seedRandom(rom.seed);
+  PChip8::Scheduler scheduler{
+      *chip8, {.instructionsPerFrame = rom.instructionsPerFrame, .turbo = true}};
+
+  try {
+    chip8->loadROM(rom.path.string());
+    for (const auto &checkpoint : rom.checkpoints) {
+      scheduler.runCycles(checkpoint.cycle - chip8->getCycleCount());
+      result.hashes.emplace_back(chip8->display.hash(), chip8->registerHash());
+    }
+  } catch (std::exception &e) {
+    result.error = "stopped at cycle " +
+                   std::to_string(chip8->getCycleCount()) + ": " + e.what();
+  }
+  return result;
+}
+
+// Compare a run with the expected hashes, printing every mismatch. Returns
+// the number of failures.
+int check(const ManifestRom &rom, PChip8::Engine engine,
+          const RunResult &result,
+          const std::vector<std::pair<std::optional<uint64_t>,
+                                      std::optional<uint64_t>>> &expected) {
+  std::string name =
+      rom.name + " [" + std::string(PChip8::engineName(engine)) + "]";
+  int failures = 0;
+  for (std::size_t i = 0; i < result.hashes.size(); ++i) {
+    auto [display, registers] = result.hashes[i];
+    const auto &[expectedDisplay, expectedRegisters] = expected[i];
+    std::string at = " at " + std::to_string(rom.checkpoints[i].cycle) + ": ";
+    if (!expectedDisplay || !expectedRegisters) {
+      std::cout << "FAIL " << name << at << "no golden hashes, record them "
+                << "with -u\n";
+      ++failures;
+      continue;
+    }
+    if (display != *expectedDisplay) {
+      std::cout << "FAIL " << name << at << "display " << formatHash(display)
+                << ", expected " << formatHash(*expectedDisplay) << '\n';
+      ++failures;
+    }
+    if (registers != *expectedRegisters) {
+      std::cout << "FAIL " << name << at << "registers "
+                << formatHash(registers) << ", expected "
+                << formatHash(*expectedRegisters) << '\n';
+      ++failures;
+    }
+  }
+  if (!result.error.empty()) {
+    std::cout << "FAIL " << name << ": " << result.error << '\n';
+    ++failures;
+  }
+  return failures;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  unsigned int workerCount = std::thread::hardware_concurrency();
+  std::vector<PChip8::Engine> engines;
+  bool update = false;
+  std::string manifestFile;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if ((arg == "-j" || arg == "-e") && i + 1 >= argc) {
+      printUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+
+    if (arg == "-j") {
+      workerCount = std::stoul(argv[++i]);
+    } else if (arg == "-e") {
+      std::string name = argv[++i];
+      if (name == "all") {
+        for (auto engine :
+             {PChip8::Engine::Switch, PChip8::Engine::Table,
+              PChip8::Engine::Threaded, PChip8::Engine::Predecoded,
+              PChip8::Engine::Jit, PChip8::Engine::Aot}) {
+          engines.push_back(engine);
+        }
+        continue;
+      }
+      try {
+        engines.push_back(PChip8::parseEngine(name));
+      } catch (std::exception &e) {
+        std::cerr << "error: " << e.what() << '\n';
+        return EXIT_FAILURE;
+      }
+    } else if (arg == "-u") {
+      update = true;
+    } else if (arg == "-h" || arg == "--help") {
+      printUsage(argv[0]);
+      return EXIT_SUCCESS;
+    } else {
+      manifestFile = arg;
+    }
+  }
+
+  if (manifestFile.empty()) {
+    printUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (engines.empty())
+    engines.push_back(PChip8::DEFAULT_ENGINE);
+  // every engine once, in the order first given
+  for (std::size_t i = 1; i < engines.size();) {
+    if (std::find(engines.begin(), engines.begin() + i, engines[i]) !=
+        engines.begin() + i)
+      engines.erase(engines.begin() + i);
+    else
+      ++i;
+  }
+
+  Manifest manifest;
+  try {
+    manifest = loadManifest(manifestFile);
+  } catch (std::exception &e) {
+    std::cerr << "error: " << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+
+  // one task per ROM and engine, results[rom][engine]
+  std::vector<std::vector<RunResult>> results(
+      manifest.roms.size(), std::vector<RunResult>(engines.size()));
+  auto start = std::chrono::steady_clock::now();
+  {
+    PChip8::ThreadPool pool{workerCount};
+    for (std::size_t rom = 0; rom < manifest.roms.size(); ++rom) {
+      for (std::size_t engine = 0; engine < engines.size(); ++engine) {
+        pool.submit([&, rom, engine] {
+          results[rom][engine] = runROM(manifest.roms[rom], engines[engine]);
+        });
+      }
+    }
+    pool.wait();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  int failures = 0;
+  std::size_t checkpointCount = 0;
+  for (std::size_t rom = 0; rom < manifest.roms.size(); ++rom) {
+    auto &manifestRom = manifest.roms[rom];
+    checkpointCount += manifestRom.checkpoints.size() * engines.size();
+
+    std::vector<std::pair<std::optional<uint64_t>, std::optional<uint64_t>>>
+        expected;
+    for (const auto &checkpoint : manifestRom.checkpoints) {
+      expected.emplace_back(checkpoint.displayHash, checkpoint.registerHash);
+    }
+    std::size_t firstChecked = 0;
+    if (update) {
+      // the first engine sets the golden hashes of every checkpoint it
+      // reached, the rest are checked against it
+      const auto &golden = results[rom][0];
+      for (std::size_t i = 0; i < golden.hashes.size(); ++i) {
+        auto [display, registers] = golden.hashes[i];
+        expected[i] = {display, registers};
+        manifest.lines[manifestRom.checkpoints[i].line] =
+            "at " + std::to_string(manifestRom.checkpoints[i].cycle) +
+            " display=" + formatHash(display) +
+            " registers=" + formatHash(registers);
+      }
+      if (!golden.error.empty()) {
+        std::cout << "FAIL " << manifestRom.name << " ["
+                  << PChip8::engineName(engines[0]) << "]: " << golden.error
+                  << '\n';
+        ++failures;
+      }
+      firstChecked = 1;
+    }
+    for (std::size_t engine = firstChecked; engine < engines.size();
+         ++engine) {
+      failures +=
+          check(manifestRom, engines[engine], results[rom][engine], expected);
+    }
+  }
+
+  double wallSeconds = std::chrono::duration<double>(end - start).count();
+  std::cerr << manifest.roms.size() << " roms on " << engines.size()
+            << " engines, " << checkpointCount << " checkpoints, " << failures
+            << " failures in " << std::fixed << std::setprecision(3)
+            << wallSeconds << "s\n";
+
+  if (update) {
+    if (failures > 0) {
+      std::cerr << "error: not updating " << manifestFile << '\n';
+      return EXIT_FAILURE;
+    }
+    try {
+      saveManifest(manifestFile, manifest);
+    } catch (std::exception &e) {
+      std::cerr << "error: " << e.what() << '\n';
+      return EXIT_FAILURE;
+    }
+  }
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,343 @@
+#include "render_kernels.h"
+#include <cstring>
+
+// SSE2 is only baseline on x86-64, so both SIMD kernels carry their own
+// target attribute and an i386 build without -msse2 still gets them, picked
+// at runtime like AVX2. Other targets use the scalar kernel.
+#if defined(__x86_64__) || defined(__i386__)
+#define PCHIP8_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace PChip8 {
+namespace {
+uint32_t *lineAt(uint32_t *dst, int dstPitch, int line) {
+  return reinterpret_cast<uint32_t *>(reinterpret_cast<uint8_t *>(dst) +
+                                      static_cast<std::ptrdiff_t>(line) *
+                                          dstPitch);
+}
+
+// Every kernel fills the first line of each scaled row,
+// the remaining scale - 1 lines are plain copies of it. From scale 4 up
+// these copies take most of the time and run at memory bandwidth, wider
+// SIMD copies or streaming stores are no faster than memcpy.
+void replicateLines(uint32_t *dst, int dstPitch, int line, int scale,
+                    int lineBytes) {
+  const uint32_t *source = lineAt(dst, dstPitch, line);
+  for (int copy = 1; copy < scale; ++copy) {
+    std::memcpy(lineAt(dst, dstPitch, line + copy), source, lineBytes);
+  }
+}
+
+void expandScalar(const uint64_t *rows, int width, int height, uint32_t *dst,
+                  int dstPitch, int scale, Palette palette) {
+  int wordsPerRow = width / 64;
+
+  for (int y = 0; y < height; ++y) {
+    uint32_t *out = lineAt(dst, dstPitch, y * scale);
+    for (int x = 0; x < width; ++x) {
+      uint64_t word = rows[y * wordsPerRow + x / 64];
+      uint32_t color = (word >> (63 - x % 64)) & 1 ? palette.on : palette.off;
+      for (int repeat = 0; repeat < scale; ++repeat) {
+        *out++ = color;
+      }
+    }
+    replicateLines(dst, dstPitch, y * scale, scale, width * scale * 4);
+  }
+}
+
+// Scaled two-plane pixels, laid out like the single-plane kernels
+void expandPlanesScalar(const uint64_t *plane0, const uint64_t *plane1,
+                        int width, int height, uint32_t *dst, int dstPitch,
+                        int scale, Palette palette) {
+  const uint32_t colors[4] = {palette.off, palette.on, palette.plane2,
+                              palette.both};
+  int wordsPerRow = width / 64;
+
+  for (int y = 0; y < height; ++y) {
+    uint32_t *out = lineAt(dst, dstPitch, y * scale);
+    for (int x = 0; x < width; ++x) {
+      int word = y * wordsPerRow + x / 64;
+      int shift = 63 - x % 64;
+      uint32_t color = colors[(plane0[word] >> shift & 1) |
+                              (plane1[word] >> shift & 1) << 1];
+      for (int repeat = 0; repeat < scale; ++repeat) {
+        *out++ = color;
+      }
+    }
+    replicateLines(dst, dstPitch, y * scale, scale, width * scale * 4);
+  }
+}
+
+#ifdef PCHIP8_X86_KERNELS
+// scale copies of color at out, 4 per store
+__attribute__((target("sse2"))) inline void
+storeRunSSE2(uint32_t *out, __m128i color, int scale) {
+  int repeat = 0;
+  for (; repeat + 4 <= scale; repeat += 4) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + repeat), color);
+  }
+  for (; repeat < scale; ++repeat) {
+    out[repeat] = _mm_cvtsi128_si32(color);
+  }
+}
+
+// scale copies of color at out, 8 per store
+__attribute__((target("avx2"))) inline void
+storeRunAVX2(uint32_t *out, __m256i color, int scale) {
+  int repeat = 0;
+  for (; repeat + 8 <= scale; repeat += 8) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + repeat), color);
+  }
+  for (; repeat + 4 <= scale; repeat += 4) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + repeat),
+                     _mm256_castsi256_si128(color));
+  }
+  for (; repeat < scale; ++repeat) {
+    out[repeat] = _mm256_cvtsi256_si32(color);
+  }
+}
+
+__attribute__((target("sse2"))) void
+expandSSE2(const uint64_t *rows, int width, int height, uint32_t *dst,
+           int dstPitch, int scale, Palette palette) {
+  int wordsPerRow = width / 64;
+  const __m128i on = _mm_set1_epi32(palette.on);
+  const __m128i off = _mm_set1_epi32(palette.off);
+  // lane i tests pixel i of a 4 pixel nibble, MSB first
+  const __m128i bits = _mm_set_epi32(1, 2, 4, 8);
+
+  for (int y = 0; y < height; ++y) {
+    uint32_t *out = lineAt(dst, dstPitch, y * scale);
+
+    for (int wordIndex = 0; wordIndex < wordsPerRow; ++wordIndex) {
+      uint64_t word = rows[y * wordsPerRow + wordIndex];
+
+      if (scale == 1) {
+        // 4 pixels per store, blend on/off through a compare mask
+        for (int shift = 60; shift >= 0; shift -= 4) {
+          __m128i nibble = _mm_set1_epi32((word >> shift) & 0xF);
+          __m128i lit = _mm_cmpeq_epi32(_mm_and_si128(nibble, bits), bits);
+          __m128i color = _mm_or_si128(_mm_and_si128(lit, on),
+                                       _mm_andnot_si128(lit, off));
+          _mm_storeu_si128(reinterpret_cast<__m128i *>(out), color);
+          out += 4;
+        }
+        continue;
+      }
+
+      // one broadcast per pixel, 4 copies per store
+      for (int shift = 63; shift >= 0; --shift) {
+        storeRunSSE2(out, (word >> shift) & 1 ? on : off, scale);
+        out += scale;
+      }
+    }
+    replicateLines(dst, dstPitch, y * scale, scale, width * scale * 4);
+  }
+}
+
+__attribute__((target("avx2"))) void
+expandAVX2(const uint64_t *rows, int width, int height, uint32_t *dst,
+           int dstPitch, int scale, Palette palette) {
+  int wordsPerRow = width / 64;
+  const __m256i on = _mm256_set1_epi32(palette.on);
+  const __m256i off = _mm256_set1_epi32(palette.off);
+  // lane i tests pixel i of an 8 pixel byte, MSB first
+  const __m256i bits = _mm256_set_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+
+  for (int y = 0; y < height; ++y) {
+    uint32_t *out = lineAt(dst, dstPitch, y * scale);
+
+    for (int wordIndex = 0; wordIndex < wordsPerRow; ++wordIndex) {
+      uint64_t word = rows[y * wordsPerRow + wordIndex];
+
+      if (scale == 1) {
+        // 8 pixels per store
+        for (int shift = 56; shift >= 0; shift -= 8) {
+          __m256i byte = _mm256_set1_epi32((word >> shift) & 0xFF);
+          __m256i lit =
+              _mm256_cmpeq_epi32(_mm256_and_si256(byte, bits), bits);
+          __m256i color = _mm256_blendv_epi8(off, on, lit);
+          _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), color);
+          out += 8;
+        }
+        continue;
+      }
+
+      for (int shift = 63; shift >= 0; --shift) {
+        storeRunAVX2(out, (word >> shift) & 1 ? on : off, scale);
+        out += scale;
+      }
+    }
+    replicateLines(dst, dstPitch, y * scale, scale, width * scale * 4);
+  }
+}
+
+__attribute__((target("sse2"))) void
+expandPlanesSSE2(const uint64_t *plane0, const uint64_t *plane1, int width,
+                 int height, uint32_t *dst, int dstPitch, int scale,
+                 Palette palette) {
+  int wordsPerRow = width / 64;
+  // indexed by plane 1 bit << 1 | plane 0 bit
+  const __m128i colors[4] = {
+      _mm_set1_epi32(palette.off), _mm_set1_epi32(palette.on),
+      _mm_set1_epi32(palette.plane2), _mm_set1_epi32(palette.both)};
+  const __m128i bits = _mm_set_epi32(1, 2, 4, 8);
+  auto select = [](__m128i mask, __m128i set, __m128i clear) {
+    return _mm_or_si128(_mm_and_si128(mask, set),
+                        _mm_andnot_si128(mask, clear));
+  };
+
+  for (int y = 0; y < height; ++y) {
+    uint32_t *out = lineAt(dst, dstPitch, y * scale);
+
+    for (int wordIndex = 0; wordIndex < wordsPerRow; ++wordIndex) {
+      uint64_t low = plane0[y * wordsPerRow + wordIndex];
+      uint64_t high = plane1[y * wordsPerRow + wordIndex];
+
+      if (scale == 1) {
+        // pick between the plane 1 off and on pairs by plane 0, then
+        // between the pairs by plane 1
+        for (int shift = 60; shift >= 0; shift -= 4) {
+          __m128i nibble0 = _mm_set1_epi32((low >> shift) & 0xF);
+          __m128i nibble1 = _mm_set1_epi32((high >> shift) & 0xF);
+          __m128i lit0 = _mm_cmpeq_epi32(_mm_and_si128(nibble0, bits), bits);
+          __m128i lit1 = _mm_cmpeq_epi32(_mm_and_si128(nibble1, bits), bits);
+          __m128i color =
+              select(lit1, select(lit0, colors[3], colors[2]),
+                     select(lit0, colors[1], colors[0]));
+          _mm_storeu_si128(reinterpret_cast<__m128i *>(out), color);
+          out += 4;
+        }
+        continue;
+      }
+
+      for (int shift = 63; shift >= 0; --shift) {
+        storeRunSSE2(out, colors[(low >> shift & 1) | (high >> shift & 1) << 1],
+                     scale);
+        out += scale;
+      }
+    }
+    replicateLines(dst, dstPitch, y * scale, scale, width * scale * 4);
+  }
+}
+
+__attribute__((target("avx2"))) void
+expandPlanesAVX2(const uint64_t *plane0, const uint64_t *plane1, int width,
+                 int height, uint32_t *dst, int dstPitch, int scale,
+                 Palette palette) {
+  int wordsPerRow = width / 64;
+  const __m256i colors[4] = {
+      _mm256_set1_epi32(palette.off), _mm256_set1_epi32(palette.on),
+      _mm256_set1_epi32(palette.plane2), _mm256_set1_epi32(palette.both)};
+  const __m256i bits = _mm256_set_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+
+  for (int y = 0; y < height; ++y) {
+    uint32_t *out = lineAt(dst, dstPitch, y * scale);
+
+    for (int wordIndex = 0; wordIndex < wordsPerRow; ++wordIndex) {
+      uint64_t low = plane0[y * wordsPerRow + wordIndex];
+      uint64_t high = plane1[y * wordsPerRow + wordIndex];
+
+      if (scale == 1) {
+        for (int shift = 56; shift >= 0; shift -= 8) {
+          __m256i byte0 = _mm256_set1_epi32((low >> shift) & 0xFF);
+          __m256i byte1 = _mm256_set1_epi32((high >> shift) & 0xFF);
+          __m256i lit0 =
+              _mm256_cmpeq_epi32(_mm256_and_si256(byte0, bits), bits);
+          __m256i lit1 =
+              _mm256_cmpeq_epi32(_mm256_and_si256(byte1, bits), bits);
+          __m256i color = _mm256_blendv_epi8(
+              _mm256_blendv_epi8(colors[0], colors[1], lit0),
+              _mm256_blendv_epi8(colors[2], colors[3], lit0), lit1);
+          _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), color);
+          out += 8;
+        }
+        continue;
+      }
+
+      for (int shift = 63; shift >= 0; --shift) {
+        storeRunAVX2(out, colors[(low >> shift & 1) | (high >> shift & 1) << 1],
+                     scale);
+        out += scale;
+      }
+    }
+    replicateLines(dst, dstPitch, y * scale, scale, width * scale * 4);
+  }
+}
+#endif
+} // namespace
+
+std::string_view kernelName(KernelIsa isa) {
+  switch (isa) {
+  case KernelIsa::Scalar:
+    return "scalar";
+  case KernelIsa::SSE2:
+    return "sse2";
+  case KernelIsa::AVX2:
+    return "avx2";
+  }
+  return "unknown";
+}
+
+bool kernelSupported(KernelIsa isa) {
+  switch (isa) {
+  case KernelIsa::Scalar:
+    return true;
+#ifdef PCHIP8_X86_KERNELS
+  case KernelIsa::SSE2:
+    return __builtin_cpu_supports("sse2");
+  case KernelIsa::AVX2:
+    return __builtin_cpu_supports("avx2");
+#endif
+  default:
+    return false;
+  }
+}
+
+ExpandKernel expandKernel(KernelIsa isa) {
+  switch (isa) {
+  case KernelIsa::Scalar:
+    return &expandScalar;
+#ifdef PCHIP8_X86_KERNELS
+  case KernelIsa::SSE2:
+    return &expandSSE2;
+  case KernelIsa::AVX2:
+    return &expandAVX2;
+#endif
+  default:
+    return nullptr;
+  }
+}
+
+ExpandKernel selectExpandKernel() {
+  for (auto isa : {KernelIsa::AVX2, KernelIsa::SSE2}) {
+    if (kernelSupported(isa))
+      return expandKernel(isa);
+  }
+  return expandKernel(KernelIsa::Scalar);
+}
+
+ExpandPlanesKernel expandPlanesKernel(KernelIsa isa) {
+  switch (isa) {
+  case KernelIsa::Scalar:
+    return &expandPlanesScalar;
+#ifdef PCHIP8_X86_KERNELS
+  case KernelIsa::SSE2:
+    return &expandPlanesSSE2;
+  case KernelIsa::AVX2:
+    return &expandPlanesAVX2;
+#endif
+  default:
+    return nullptr;
+  }
+}
+
+ExpandPlanesKernel selectExpandPlanesKernel() {
+  for (auto isa : {KernelIsa::AVX2, KernelIsa::SSE2}) {
+    if (kernelSupported(isa))
+      return expandPlanesKernel(isa);
+  }
+  return expandPlanesKernel(KernelIsa::Scalar);
+}
+} // namespace PChip8
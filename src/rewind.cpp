@@ -0,0 +1,82 @@
+#include "rewind.h"
+#include "delta_codec.h"
+#include <algorithm>
+
+namespace PChip8 {
+namespace {
+constexpr SaveState ZERO_STATE{};
+} // namespace
+
+RewindBuffer::RewindBuffer(RewindConfig config) : config(config) {
+  this->config.keyframeInterval = std::max<uint32_t>(1, config.keyframeInterval);
+  framesSinceKeyframe = this->config.keyframeInterval;
+}
+
+void RewindBuffer::capture(const Chip8 &chip8) {
+  chip8.saveState(snapshot);
+
+  bool isKeyframe = framesSinceKeyframe >= config.keyframeInterval;
+  if (isKeyframe) {
+    keyframe = snapshot;
+    framesSinceKeyframe = 0;
+  }
+  encodeDelta(snapshot, isKeyframe ? ZERO_STATE : keyframe, encoded);
+  ++framesSinceKeyframe;
+
+  entries.push_back({isKeyframe, encoded});
+  sizeBytes += encoded.size();
+
+  while (sizeBytes > config.capacityBytes && !entries.empty()) {
+    dropOldestGroup();
+  }
+}
+
+bool RewindBuffer::rewind(Chip8 &chip8) {
+  // the newest frame is the state the machine is in
+  if (entries.size() < 2)
+    return false;
+
+  sizeBytes -= entries.back().delta.size();
+  entries.pop_back();
+
+  // walk back to the keyframe the frame before was encoded against
+  std::size_t keyIndex = entries.size() - 1;
+  while (!entries[keyIndex].keyframe) {
+    --keyIndex;
+  }
+
+  SaveState restored{};
+  applyDelta(entries[keyIndex].delta, restored);
+  keyframe = restored;
+  if (keyIndex != entries.size() - 1)
+    applyDelta(entries.back().delta, restored);
+
+  chip8.loadState(restored);
+
+  // the restored frame stays the newest, later captures keep encoding
+  // against its keyframe
+  framesSinceKeyframe = entries.size() - keyIndex;
+  return true;
+}
+
+void RewindBuffer::clear() {
+  entries.clear();
+  sizeBytes = 0;
+  framesSinceKeyframe = config.keyframeInterval;
+}
+
+std::size_t RewindBuffer::getFrameCount() const { return entries.size(); }
+
+std::size_t RewindBuffer::getSizeBytes() const { return sizeBytes; }
+
+void RewindBuffer::dropOldestGroup() {
+  do {
+    sizeBytes -= entries.front().delta.size();
+    entries.pop_front();
+  } while (!entries.empty() && !entries.front().keyframe);
+
+  // the current keyframe went with it, start a new group
+  if (entries.empty())
+    framesSinceKeyframe = config.keyframeInterval;
+}
+} // namespace PChip8
@@ -0,0 +1,180 @@
+#include "rom_cache.h"
+#include <algorithm>
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define PCHIP8_HAS_MMAP
+#endif
+
+namespace PChip8 {
+uint64_t romHash(std::span<const uint8_t> bytes) {
+  // 64-bit FNV-1a
+  uint64_t result = 0xCBF29CE484222325;
+  for (auto byte : bytes) {
+    result = (result ^ byte) * 0x100000001B3;
+  }
+  return result;
+}
+
+std::shared_ptr<const MappedFile>
+MappedFile::open(const std::string &fileName) {
+  std::shared_ptr<MappedFile> file{new MappedFile};
+
+#ifdef PCHIP8_HAS_MMAP
+  // one open, one fstat and one mmap, the page cache is shared with every
+  // other process reading the same file
+  int fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw std::runtime_error(errno == ENOENT ? fileName + " does not exist"
+                                             : "Could not open " + fileName);
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+    close(fd);
+    throw std::runtime_error("Could not open " + fileName);
+  }
+  std::size_t size = info.st_size;
+
+  // an empty file cannot be mapped, and has nothing to map anyway
+  if (size > 0) {
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error(fileName + " read failed");
+    }
+    file->mapping = mapping;
+    file->mappingSize = size;
+  }
+  close(fd);
+
+  file->bytes = {static_cast<const uint8_t *>(file->mapping), size};
+#else
+  if (!std::filesystem::exists(fileName))
+    throw std::runtime_error(fileName + " does not exist");
+  std::size_t size = std::filesystem::file_size(fileName);
+
+  std::ifstream data{fileName, std::ios::binary};
+  if (!data)
+    throw std::runtime_error("Could not open " + fileName);
+  file->owned.resize(size);
+  data.read(reinterpret_cast<char *>(file->owned.data()), size);
+  if (!data)
+    throw std::runtime_error(fileName + " read failed");
+
+  file->bytes = file->owned;
+#endif
+  return file;
+}
+
+MappedFile::~MappedFile() {
+#ifdef PCHIP8_HAS_MMAP
+  if (mapping)
+    munmap(mapping, mappingSize);
+#endif
+}
+
+std::span<const uint8_t> MappedFile::getBytes() const { return bytes; }
+
+std::shared_ptr<const RomImage> RomImage::fromFile(const std::string &fileName) {
+  auto file = MappedFile::open(fileName);
+  if (file->getBytes().size() > MAX_ROM_SIZE)
+    throw std::runtime_error(fileName + " is too large");
+  return fromShared(file->getBytes(), file, fileName);
+}
+
+std::shared_ptr<const RomImage>
+RomImage::fromBytes(std::span<const uint8_t> romData, std::string name) {
+  if (romData.size() > MAX_ROM_SIZE)
+    throw std::runtime_error("ROM is too large");
+
+  auto copy = std::make_shared<const std::vector<uint8_t>>(romData.begin(),
+                                                           romData.end());
+  return fromShared(*copy, copy, std::move(name));
+}
+
+std::shared_ptr<const RomImage>
+RomImage::fromShared(std::span<const uint8_t> romData,
+                     std::shared_ptr<const void> owner, std::string name) {
+  if (romData.size() > MAX_ROM_SIZE)
+    throw std::runtime_error(name.empty() ? "ROM is too large"
+                                          : name + " is too large");
+
+  std::shared_ptr<RomImage> image{new RomImage};
+  image->name = std::move(name);
+  image->owner = std::move(owner);
+  image->build(romData);
+  return image;
+}
+
+void RomImage::build(std::span<const uint8_t> romData) {
+  bytes = romData;
+  hash = romHash(romData);
+  std::copy(BUILTIN_FONT.begin(), BUILTIN_FONT.end(),
+            memory.begin() + FONT_LOCATION);
+  std::copy(romData.begin(), romData.end(),
+            memory.begin() + START_EXEC_LOCATION);
+}
+
+std::span<const uint8_t> RomImage::getBytes() const { return bytes; }
+
+uint64_t RomImage::getHash() const { return hash; }
+
+const std::string &RomImage::getName() const { return name; }
+
+const std::array<uint8_t, MEMORY_SIZE> &RomImage::getMemory() const {
+  return memory;
+}
+
+RomCache &RomCache::shared() {
+  static RomCache cache;
+  return cache;
+}
+
+std::shared_ptr<const RomImage> RomCache::load(const std::string &fileName) {
+  {
+    std::lock_guard lock{mutex};
+    if (auto found = byName.find(fileName); found != byName.end())
+      return found->second;
+  }
+
+  // read outside the lock, two threads racing on a new file both read it
+  // and the first to finish wins
+  auto image = RomImage::fromFile(fileName);
+
+  std::lock_guard lock{mutex};
+  if (auto found = byName.find(fileName); found != byName.end())
+    return found->second;
+
+  auto &sameHash = byHash[image->getHash()];
+  if (sameHash && std::ranges::equal(sameHash->getBytes(), image->getBytes()))
+    image = sameHash;
+  else if (!sameHash)
+    sameHash = image;
+  byName.emplace(fileName, image);
+  return image;
+}
+
+std::shared_ptr<const RomImage> RomCache::find(uint64_t hash) const {
+  std::lock_guard lock{mutex};
+  auto found = byHash.find(hash);
+  return found != byHash.end() ? found->second : nullptr;
+}
+
+void RomCache::clear() {
+  std::lock_guard lock{mutex};
+  byName.clear();
+  byHash.clear();
+}
+
+std::size_t RomCache::size() const {
+  std::lock_guard lock{mutex};
+  return byHash.size();
+}
+} // namespace PChip8
@@ -0,0 +1,192 @@
+#include "rom_pack.h"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace PChip8 {
+namespace {
+constexpr std::array<uint8_t, 8> PACK_MAGIC = {'P', 'C', 'H', '8',
+                                                'P', 'A', 'C', 'K'};
+constexpr uint32_t PACK_VERSION = 1;
+
+// magic, version, ROM count
+constexpr std::size_t HEADER_SIZE = 16;
+// hash, name offset and size, ROM size and offset, instructions per frame,
+// quirks, key map
+constexpr std::size_t INDEX_ENTRY_SIZE = 48;
+
+uint64_t getLittle(const uint8_t *in, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i) {
+    value |= uint64_t{in[i]} << (8 * i);
+  }
+  return value;
+}
+
+void putLittle(std::vector<uint8_t> &out, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    out.push_back((value >> (8 * i)) & 0xFF);
+  }
+}
+} // namespace
+
+std::shared_ptr<const RomPack> RomPack::open(const std::string &fileName) {
+  std::shared_ptr<RomPack> pack{new RomPack};
+  pack->file = MappedFile::open(fileName);
+  auto data = pack->file->getBytes();
+
+  auto corrupt = [&] {
+    return std::runtime_error(fileName + " is not a valid ROM pack");
+  };
+  if (data.size() < HEADER_SIZE ||
+      !std::equal(PACK_MAGIC.begin(), PACK_MAGIC.end(), data.begin()))
+    throw corrupt();
+  if (getLittle(&data[8], 4) != PACK_VERSION)
+    throw std::runtime_error(fileName + " has an unsupported pack version");
+
+  uint64_t count = getLittle(&data[12], 4);
+  uint64_t namesOffset = HEADER_SIZE + count * INDEX_ENTRY_SIZE;
+  if (namesOffset > data.size())
+    throw corrupt();
+
+  pack->entries.reserve(count);
+  for (uint64_t i = 0; i < count; ++i) {
+    const uint8_t *in = &data[HEADER_SIZE + i * INDEX_ENTRY_SIZE];
+    uint64_t nameOffset = namesOffset + getLittle(in + 8, 4);
+    uint64_t nameSize = getLittle(in + 12, 2);
+    uint64_t romSize = getLittle(in + 14, 2);
+    uint64_t romOffset = getLittle(in + 16, 4);
+    if (nameOffset + nameSize > data.size() ||
+        romOffset + romSize > data.size() || romSize > MAX_ROM_SIZE)
+      throw corrupt();
+
+    Entry entry{
+        .name = {reinterpret_cast<const char *>(&data[nameOffset]), nameSize},
+        .hash = getLittle(in, 8),
+        .bytes = data.subspan(romOffset, romSize),
+        .settings = {},
+    };
+    entry.settings.instructionsPerFrame = getLittle(in + 20, 4);
+    entry.settings.quirks = static_cast<QuirkProfile>(in[24]);
+    std::copy(in + 32, in + 48, entry.settings.keyMap.begin());
+    if (in[24] >= QUIRK_PROFILE_COUNT ||
+        std::ranges::any_of(entry.settings.keyMap,
+                            [](uint8_t key) { return key >= KEY_COUNT; }))
+      throw corrupt();
+
+    // find() relies on the order
+    if (!pack->entries.empty() && pack->entries.back().name >= entry.name)
+      throw corrupt();
+    pack->entries.push_back(entry);
+  }
+  return pack;
+}
+
+void RomPack::write(const std::string &fileName,
+                    std::vector<RomPackEntry> entries) {
+  std::ranges::sort(entries, {}, &RomPackEntry::name);
+  for (std::size_t i = 0; i < entries.size(); ++i) {
+    if (entries[i].bytes.size() > MAX_ROM_SIZE)
+      throw std::runtime_error(entries[i].name + " is too large");
+    if (entries[i].name.size() > UINT16_MAX)
+      throw std::runtime_error(entries[i].name + " has too long a name");
+    if (i > 0 && entries[i].name == entries[i - 1].name)
+      throw std::runtime_error(entries[i].name + " is in the pack twice");
+  }
+
+  std::vector<uint8_t> index;
+  std::vector<uint8_t> names;
+  std::vector<uint8_t> roms;
+  uint64_t romsOffset = HEADER_SIZE + entries.size() * INDEX_ENTRY_SIZE;
+  for (const auto &entry : entries) {
+    romsOffset += entry.name.size();
+  }
+
+  // offset and size of the ROMs already stored, by hash
+  std::unordered_multimap<uint64_t, std::pair<uint64_t, std::size_t>> stored;
+  for (const auto &entry : entries) {
+    uint64_t hash = romHash(entry.bytes);
+    std::optional<uint64_t> offset;
+    for (auto [it, end] = stored.equal_range(hash); it != end && !offset;
+         ++it) {
+      auto [storedOffset, storedSize] = it->second;
+      auto at = roms.begin() + (storedOffset - romsOffset);
+      if (storedSize == entry.bytes.size() &&
+          std::equal(entry.bytes.begin(), entry.bytes.end(), at))
+        offset = storedOffset;
+    }
+    if (!offset) {
+      offset = romsOffset + roms.size();
+      stored.emplace(hash, std::pair{*offset, entry.bytes.size()});
+      roms.insert(roms.end(), entry.bytes.begin(), entry.bytes.end());
+    }
+    if (*offset + entry.bytes.size() > UINT32_MAX)
+      throw std::runtime_error(fileName + " would be too large");
+
+    putLittle(index, hash, 8);
+    putLittle(index, names.size(), 4);
+    putLittle(index, entry.name.size(), 2);
+    putLittle(index, entry.bytes.size(), 2);
+    putLittle(index, *offset, 4);
+    putLittle(index, entry.settings.instructionsPerFrame, 4);
+    putLittle(index, static_cast<uint8_t>(entry.settings.quirks), 1);
+    putLittle(index, 0, 7);
+    index.insert(index.end(), entry.settings.keyMap.begin(),
+                 entry.settings.keyMap.end());
+    names.insert(names.end(), entry.name.begin(), entry.name.end());
+  }
+
+  std::vector<uint8_t> header(PACK_MAGIC.begin(), PACK_MAGIC.end());
+  putLittle(header, PACK_VERSION, 4);
+  putLittle(header, entries.size(), 4);
+
+  std::ofstream out{fileName, std::ios::binary};
+  if (!out)
+    throw std::runtime_error("Could not open " + fileName);
+  for (const auto *part : {&header, &index, &names, &roms}) {
+    out.write(reinterpret_cast<const char *>(part->data()), part->size());
+  }
+  if (!out)
+    throw std::runtime_error(fileName + " write failed");
+}
+
+std::size_t RomPack::size() const { return entries.size(); }
+
+std::string_view RomPack::getName(std::size_t index) const {
+  return entries.at(index).name;
+}
+
+uint64_t RomPack::getHash(std::size_t index) const {
+  return entries.at(index).hash;
+}
+
+const RomSettings &RomPack::getSettings(std::size_t index) const {
+  return entries.at(index).settings;
+}
+
+std::span<const uint8_t> RomPack::getBytes(std::size_t index) const {
+  return entries.at(index).bytes;
+}
+
+std::shared_ptr<const RomImage> RomPack::getImage(std::size_t index) const {
+  const auto &entry = entries.at(index);
+  auto image = RomImage::fromShared(entry.bytes, file, std::string(entry.name));
+  // the image hashed its bytes anyway, so a damaged ROM costs nothing to spot
+  if (image->getHash() != entry.hash)
+    throw std::runtime_error(std::string(entry.name) +
+                             " does not match its hash in the pack");
+  return image;
+}
+
+std::optional<std::size_t> RomPack::find(std::string_view name) const {
+  auto found = std::ranges::lower_bound(entries, name, {}, &Entry::name);
+  if (found == entries.end() || found->name != name)
+    return std::nullopt;
+  return found - entries.begin();
+}
+
+bool isRomPack(std::string_view fileName) {
+  return fileName.ends_with(".c8pk");
+}
+} // namespace PChip8
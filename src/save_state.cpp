@@ -0,0 +1,169 @@
+#include "chip8.h"
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+namespace PChip8 {
+namespace {
+// byte offset of sp, the only field that can make a snapshot unsafe to run
+constexpr int STACK_POINTER_OFFSET = 8 + MEMORY_SIZE + VREG_COUNT + 4;
+
+// Sequential little-endian field access into a SaveState
+class StateWriter {
+public:
+  explicit StateWriter(SaveState &state) : out(state.data()) {}
+
+  void put8(uint8_t value) { *out++ = value; }
+  void put16(uint16_t value) {
+    put8(value & 0xFF);
+    put8(value >> 8);
+  }
+  void put64(uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+      put8((value >> (8 * i)) & 0xFF);
+    }
+  }
+  template <typename Container> void putBytes(const Container &bytes) {
+    out = std::copy(bytes.begin(), bytes.end(), out);
+  }
+
+private:
+  uint8_t *out;
+};
+
+class StateReader {
+public:
+  explicit StateReader(const SaveState &state) : in(state.data()) {}
+
+  uint8_t get8() { return *in++; }
+  uint16_t get16() {
+    uint16_t low = get8();
+    return low | (get8() << 8);
+  }
+  uint64_t get64() {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+      value |= uint64_t{get8()} << (8 * i);
+    }
+    return value;
+  }
+  template <typename Container> void getBytes(Container &bytes) {
+    std::copy(in, in + bytes.size(), bytes.begin());
+    in += bytes.size();
+  }
+
+private:
+  const uint8_t *in;
+};
+} // namespace
+
+void Chip8::saveState(SaveState &state) const {
+  StateWriter writer{state};
+  writer.put16(SAVE_STATE_MAGIC & 0xFFFF);
+  writer.put16(SAVE_STATE_MAGIC >> 16);
+  writer.put16(SAVE_STATE_VERSION);
+  writer.put16(0);
+
+  writer.putBytes(memory);
+  writer.putBytes(V);
+  writer.put16(I);
+  writer.put16(pc);
+  writer.put8(sp);
+  writer.put8(delayTimer);
+  writer.put8(soundTimer);
+  writer.put8(display.isHires() | display.getPlaneMask() << 1);
+
+  for (auto address : stack) {
+    writer.put16(address);
+  }
+  writer.put64(cycleCount);
+  writer.put64(rng.getState());
+  for (int plane = 0; plane < PLANE_COUNT; ++plane) {
+    auto rows = display.getRows(plane);
+    for (auto word : rows) {
+      writer.put64(word);
+    }
+    for (auto pad = rows.size(); pad < PlanarDisplay::MAX_WORDS; ++pad) {
+      writer.put64(0);
+    }
+  }
+}
+
+void Chip8::loadState(const SaveState &state) {
+  StateReader reader{state};
+  uint32_t magic = reader.get16();
+  magic |= uint32_t{reader.get16()} << 16;
+  if (magic != SAVE_STATE_MAGIC)
+    throw std::runtime_error("not a save state");
+
+  uint16_t version = reader.get16();
+  if (version != SAVE_STATE_VERSION)
+    throw std::runtime_error("unsupported save state version " +
+                             std::to_string(version));
+  if (state[STACK_POINTER_OFFSET] > STACK_DEPTH)
+    throw std::runtime_error("corrupt save state");
+  reader.get16();
+
+  std::array<uint8_t, MEMORY_SIZE> image;
+  reader.getBytes(image);
+  restoreMemory(image);
+  reader.getBytes(V);
+  I = reader.get16();
+  pc = reader.get16();
+  sp = reader.get8();
+  delayTimer = reader.get8();
+  soundTimer = reader.get8();
+  buzzerChangeCount = 0;
+  uint8_t displayFlags = reader.get8();
+
+  for (auto &address : stack) {
+    address = reader.get16();
+  }
+  cycleCount = reader.get64();
+  rng.setState(reader.get64());
+
+  display.setHires(displayFlags & 1);
+  display.setPlaneMask(displayFlags >> 1);
+  std::array<uint64_t, PlanarDisplay::MAX_WORDS> rows;
+  for (int plane = 0; plane < PLANE_COUNT; ++plane) {
+    for (auto &word : rows) {
+      word = reader.get64();
+    }
+    display.setRows(plane, rows);
+  }
+
+  current = Instruction{};
+  drawFlag = true;
+}
+
+void Chip8::saveStateFile(std::string fileName) const {
+  SaveState state;
+  saveState(state);
+
+  std::ofstream stateData{fileName, std::ios::binary};
+  if (!stateData)
+    throw std::runtime_error("Could not open " + fileName);
+
+  stateData.write(reinterpret_cast<const char *>(state.data()), state.size());
+  if (!stateData)
+    throw std::runtime_error(fileName + " write failed");
+}
+
+void Chip8::loadStateFile(std::string fileName) {
+  if (!std::filesystem::exists(fileName))
+    throw std::runtime_error(fileName + " does not exist");
+  if (std::filesystem::file_size(fileName) != SAVE_STATE_SIZE)
+    throw std::runtime_error(fileName + " is not a save state");
+
+  std::ifstream stateData{fileName, std::ios::binary};
+  if (!stateData)
+    throw std::runtime_error("Could not open " + fileName);
+
+  SaveState state;
+  stateData.read(reinterpret_cast<char *>(state.data()), state.size());
+  if (!stateData)
+    throw std::runtime_error(fileName + " read failed");
+
+  loadState(state);
+}
+} // namespace PChip8
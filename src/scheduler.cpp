@@ -0,0 +1,192 @@
+#include "scheduler.h"
+#include "audio.h"
+#include "capture.h"
+#include <algorithm>
+#include <thread>
+
+namespace PChip8 {
+Scheduler::Scheduler(Chip8 &chip8, SchedulerConfig config)
+    : chip8(chip8),
+      frameDuration(std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(1.0 / TIMER_HZ))) {
+  setConfig(config);
+}
+
+void Scheduler::runFrame() {
+  uint32_t cycles = config.instructionsPerFrame - cyclesIntoFrame;
+  input.apply(chip8, chip8.getCycleCount());
+  bool idle = chip8.idleState() != IdleState::Running;
+  cyclesIntoFrame += advance(cycles, idle);
+  if (cyclesIntoFrame < config.instructionsPerFrame)
+    return;
+  endFrame();
+
+  if (!config.turbo)
+    waitForDeadline(idle);
+}
+
+uint64_t Scheduler::runCycles(uint64_t cycles) {
+  uint64_t total = 0;
+  while (cycles > 0) {
+    uint64_t chunk =
+        std::min<uint64_t>(cycles, config.instructionsPerFrame - cyclesIntoFrame);
+
+    // idle loops are only looked for at frame starts, a frame that goes
+    // idle halfway spins out its few remaining instructions
+    input.apply(chip8, chip8.getCycleCount());
+    uint64_t executed;
+    if (cyclesIntoFrame != 0 || chip8.idleState() == IdleState::Running) {
+      executed = advance(chunk, false);
+    } else if (chip8.getDelayTimer() == 0 && chip8.getSoundTimer() == 0 &&
+               input.nextCycle() - chip8.getCycleCount() >= cycles &&
+               audio == nullptr) {
+      // no key changes in here and the timer ticks change nothing, so every
+      // remaining frame is the same. Audio needs every frame handed over.
+      executed = chip8.fastForward(cycles);
+      frameCount += executed / config.instructionsPerFrame;
+      cyclesIntoFrame = executed % config.instructionsPerFrame;
+      return total + executed;
+    } else {
+      executed = advance(chunk, true);
+    }
+    cycles -= executed;
+    total += executed;
+    cyclesIntoFrame += executed;
+
+    if (cyclesIntoFrame == config.instructionsPerFrame)
+      endFrame();
+    if (executed < chunk)
+      break;
+  }
+  return total;
+}
+
+void Scheduler::idleFrame() {
+  if (audio)
+    audio->idleFrame();
+  if (!config.turbo)
+    waitForDeadline(true);
+}
+
+uint64_t Scheduler::advance(uint64_t cycles, bool idle) {
+  uint64_t total = 0;
+  while (total < cycles) {
+    uint64_t chunk = cycles - total;
+    if (!input.empty())
+      chunk = std::min(chunk, input.nextCycle() - chip8.getCycleCount());
+    uint64_t executed = idle ? chip8.fastForward(chunk) : chip8.run(chunk);
+    total += executed;
+    if (executed < chunk)
+      break;
+
+    // fastForward() runs whatever is not idle, so it is safe after a key
+    // change either way
+    if (total < cycles) {
+      input.apply(chip8, chip8.getCycleCount());
+      idle = true;
+    }
+  }
+  return total;
+}
+
+void Scheduler::endFrame() {
+  chip8.tickTimers();
+  cyclesIntoFrame = 0;
+  ++frameCount;
+  if (audio) {
+    audio->endFrame(chip8.getBuzzerChanges(), chip8.getCycleCount(),
+                    config.instructionsPerFrame, chip8.getSoundTimer() > 0);
+    chip8.clearBuzzerChanges();
+  }
+  if (capture)
+    capture->capture(chip8);
+}
+
+void Scheduler::waitForDeadline(bool idle) {
+  deadline += frameDuration;
+
+  auto now = Clock::now();
+  if (now - deadline > frameDuration * MAX_FRAMES_BEHIND) {
+    // too far behind to catch up smoothly, start over from here
+    deadline = now;
+    return;
+  }
+
+  // an idle frame has nothing to show, so it can end late by a scheduler
+  // quantum rather than burn the spin
+  if (idle) {
+    std::this_thread::sleep_until(deadline);
+    return;
+  }
+
+  if (deadline - now > SPIN_MARGIN)
+    std::this_thread::sleep_until(deadline - SPIN_MARGIN);
+  while (Clock::now() < deadline) {
+    std::this_thread::yield();
+  }
+}
+
+void Scheduler::resync() { deadline = Clock::now(); }
+
+bool Scheduler::waitingForInput() const {
+  return input.empty() && chip8.getDelayTimer() == 0 &&
+         chip8.getSoundTimer() == 0 && chip8.idleState() != IdleState::Running;
+}
+
+void Scheduler::resumeAfterWait() {
+  if (cyclesIntoFrame != 0) {
+    resync();
+    return;
+  }
+
+  // woken within the frame, pacing is still on schedule
+  auto waited = Clock::now() - deadline;
+  if (waited <= frameDuration)
+    return;
+
+  // the frame about to run stands for the last frame of the wait, so the
+  // key that ended it lands in that frame and shows without further delay
+  uint64_t frames = waited / frameDuration - 1;
+  chip8.fastForward(frames * config.instructionsPerFrame);
+  frameCount += frames;
+  deadline = Clock::now() - frameDuration;
+}
+
+uint64_t Scheduler::cycleAt(Clock::time_point time) const {
+  uint64_t current = chip8.getCycleCount();
+  if (config.turbo)
+    return current;
+
+  // the frame about to run covers the frame of wall-clock time that ended at
+  // the last deadline, shifted one frame later
+  auto intoFrame = time - (deadline - frameDuration);
+  uint64_t ipf = config.instructionsPerFrame;
+  uint64_t offset = 0;
+  if (intoFrame > Clock::duration::zero())
+    offset = std::min<uint64_t>(ipf - 1, intoFrame * ipf / frameDuration);
+  return std::max(current, current - cyclesIntoFrame + offset);
+}
+
+InputQueue &Scheduler::getInput() { return input; }
+
+void Scheduler::setConfig(SchedulerConfig newConfig) {
+  config = newConfig;
+  config.instructionsPerFrame = std::max<uint32_t>(1, config.instructionsPerFrame);
+  cyclesIntoFrame = std::min(cyclesIntoFrame, config.instructionsPerFrame - 1);
+  resync();
+}
+
+const SchedulerConfig &Scheduler::getConfig() const { return config; }
+
+uint64_t Scheduler::getFrameCount() const { return frameCount; }
+
+uint32_t Scheduler::getCyclesIntoFrame() const { return cyclesIntoFrame; }
+
+void Scheduler::setCapture(FrameCapture *newCapture) { capture = newCapture; }
+
+void Scheduler::setAudio(Buzzer *newAudio) {
+  audio = newAudio;
+  // older changes are no longer in the frame that ends next
+  chip8.clearBuzzerChanges();
+}
+} // namespace PChip8
@@ -0,0 +1,35 @@
+#pragma once
+#include "spsc_queue.h"
+
+template <typename T, std::size_t capacity>
+bool SpscQueue<T, capacity>::push(const T &value) {
+  std::size_t currentTail = tail.load(std::memory_order_relaxed);
+  if (currentTail - head.load(std::memory_order_acquire) == capacity)
+    return false;
+
+  items[currentTail & (capacity - 1)] = value;
+  tail.store(currentTail + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T, std::size_t capacity>
+bool SpscQueue<T, capacity>::pop(T &value) {
+  std::size_t currentHead = head.load(std::memory_order_relaxed);
+  if (currentHead == tail.load(std::memory_order_acquire))
+    return false;
+
+  value = items[currentHead & (capacity - 1)];
+  head.store(currentHead + 1, std::memory_order_release);
+  return true;
+}
+
+template <typename T, std::size_t capacity>
+bool SpscQueue<T, capacity>::empty() const {
+  return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+}
+
+template <typename T, std::size_t capacity>
+SpscQueue<T, capacity>::SpscQueue() = default;
+
+template <typename T, std::size_t capacity>
+SpscQueue<T, capacity>::~SpscQueue() = default;
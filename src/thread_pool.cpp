@@ -0,0 +1,93 @@
+#include "thread_pool.h"
+
+namespace PChip8 {
+ThreadPool::ThreadPool(unsigned int workerCount)
+    : queues(workerCount == 0 ? 1 : workerCount) {
+  workers.reserve(queues.size());
+  for (unsigned int id = 0; id < queues.size(); ++id) {
+    workers.emplace_back([this, id] { workerLoop(id); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(stateMutex);
+    stopping = true;
+  }
+  workAvailable.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  // distribute round robin, stealing evens out the rest
+  unsigned int id = nextQueue.fetch_add(1) % queues.size();
+  {
+    std::lock_guard lock(queues[id].mutex);
+    queues[id].tasks.push_back(std::move(task));
+  }
+  {
+    std::lock_guard lock(stateMutex);
+    ++queuedTasks;
+    ++pendingTasks;
+  }
+  workAvailable.notify_one();
+}
+
+void ThreadPool::wait() {
+  std::unique_lock lock(stateMutex);
+  allDone.wait(lock, [this] { return pendingTasks == 0; });
+}
+
+unsigned int ThreadPool::getWorkerCount() const { return workers.size(); }
+
+bool ThreadPool::popTask(unsigned int id, std::function<void()> &task) {
+  std::lock_guard lock(queues[id].mutex);
+  if (queues[id].tasks.empty())
+    return false;
+
+  task = std::move(queues[id].tasks.back());
+  queues[id].tasks.pop_back();
+  return true;
+}
+
+bool ThreadPool::stealTask(unsigned int id, std::function<void()> &task) {
+  for (unsigned int offset = 1; offset < queues.size(); ++offset) {
+    auto &victim = queues[(id + offset) % queues.size()];
+    std::lock_guard lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::workerLoop(unsigned int id) {
+  while (true) {
+    {
+      std::unique_lock lock(stateMutex);
+      workAvailable.wait(lock, [this] { return stopping || queuedTasks > 0; });
+      if (queuedTasks == 0)
+        return; // stopping and nothing left to run
+      // claim one task before looking for it so that other workers
+      // do not sleep on a count that is already spoken for
+      --queuedTasks;
+    }
+
+    std::function<void()> task;
+    while (!popTask(id, task) && !stealTask(id, task)) {
+      // another worker raced us to the queue we scanned, look again
+      std::this_thread::yield();
+    }
+
+    task();
+
+    std::lock_guard lock(stateMutex);
+    if (--pendingTasks == 0)
+      allDone.notify_all();
+  }
+}
+} // namespace PChip8
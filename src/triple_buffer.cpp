@@ -0,0 +1,35 @@
+#pragma once
+#include "triple_buffer.h"
+
+template <typename T>
+T &TripleBuffer<T>::back() {
+  return slots[backIndex];
+}
+
+template <typename T>
+void TripleBuffer<T>::publish() {
+  // release the filled slot, take whatever was shared in exchange
+  uint8_t previous = shared.exchange(backIndex | FRESH_BIT, std::memory_order_acq_rel);
+  backIndex = previous & INDEX_MASK;
+}
+
+template <typename T>
+bool TripleBuffer<T>::update() {
+  if ((shared.load(std::memory_order_relaxed) & FRESH_BIT) == 0)
+    return false;
+
+  uint8_t previous = shared.exchange(frontIndex, std::memory_order_acq_rel);
+  frontIndex = previous & INDEX_MASK;
+  return true;
+}
+
+template <typename T>
+const T &TripleBuffer<T>::front() const {
+  return slots[frontIndex];
+}
+
+template <typename T>
+TripleBuffer<T>::TripleBuffer() = default;
+
+template <typename T>
+TripleBuffer<T>::~TripleBuffer() = default;